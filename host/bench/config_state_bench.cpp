@@ -0,0 +1,516 @@
+#include "config_state.h"
+#include "config_state_cbor.h"
+#include "config_state_reader.h"
+#include "config_state_snapshot.h"
+#include "config_state_static.h"
+#include "config_state_storage.h"
+#include "nvs_mem.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <esp_log.h>
+#include <functional>
+#include <nvs_flash.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <utility>
+
+static const char BENCH_NAMESPACE[] = "bench";
+
+static bool bench_quick = false;
+static const char *bench_filter = nullptr;
+
+/**
+ * Runs given operation repeatedly and prints average time per operation, together with NVS operations per call.
+ */
+static void bench_run(const char *name, size_t iterations, const std::function<void()> &setup, const std::function<void()> &op)
+{
+    if (bench_filter && !std::strstr(name, bench_filter))
+    {
+        return;
+    }
+
+    if (bench_quick)
+    {
+        iterations = 1;
+    }
+
+    std::chrono::nanoseconds total(0);
+    nvs_mem_stats stats = {};
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        if (setup)
+        {
+            setup();
+        }
+
+        nvs_mem_reset_stats();
+        auto start = std::chrono::steady_clock::now();
+        op();
+        total += std::chrono::steady_clock::now() - start;
+
+        nvs_mem_stats s = nvs_mem_get_stats();
+        stats.get_count += s.get_count;
+        stats.set_count += s.set_count;
+        stats.write_count += s.write_count;
+        stats.commit_count += s.commit_count;
+        stats.bytes_written += s.bytes_written;
+    }
+
+    std::printf("%-36s %8zu %14.1f %10zu %10zu %10zu %12zu\n",
+                name,
+                iterations,
+                static_cast<double>(total.count()) / static_cast<double>(iterations),
+                stats.get_count / iterations,
+                stats.set_count / iterations,
+                stats.write_count / iterations,
+                stats.bytes_written / iterations);
+}
+
+/**
+ * Applies JSON text via config_state_reader, without building a Document.
+ */
+template<typename S>
+static void bench_read_stream(const config_state<S> &state, S &inst, const rapidjson::StringBuffer &json)
+{
+    config_state_reader<S> handler(state, inst);
+    rapidjson::Reader reader;
+    rapidjson::StringStream stream(json.GetString());
+    reader.Parse(stream, handler);
+}
+
+static void bench_stringify(const rapidjson::Document &doc, rapidjson::StringBuffer &json)
+{
+    rapidjson::Writer<rapidjson::StringBuffer> writer(json);
+    doc.Accept(writer);
+}
+
+// Flat struct with N int32_t fields, members are provided by distinct base classes, so that each has its own member pointer
+template<size_t I>
+struct bench_slot
+{
+    int32_t value = 0;
+};
+
+template<size_t... I>
+struct bench_fields : bench_slot<I>...
+{
+};
+
+template<size_t... I>
+static bench_fields<I...> bench_fields_of(std::index_sequence<I...>);
+
+template<size_t N>
+using bench_config = decltype(bench_fields_of(std::make_index_sequence<N>{}));
+
+template<typename S, size_t I>
+static void bench_add_field(config_state_set<S> &state)
+{
+    // Fields are grouped by ten, so pointers share common prefix, e.g. "/g12/f123"
+    char json_ptr[24] = {};
+    std::snprintf(json_ptr, sizeof(json_ptr), "/g%zu/f%zu", I / 10, I);
+
+    int32_t S::*field = &bench_slot<I>::value;
+    state.add_field(field, json_ptr);
+}
+
+template<typename S, size_t... I>
+static void bench_add_fields(config_state_set<S> &state, std::index_sequence<I...>)
+{
+    (bench_add_field<S, I>(state), ...);
+}
+
+template<typename S, size_t... I>
+static void bench_fill(S &inst, int32_t seed, std::index_sequence<I...>)
+{
+    ((static_cast<bench_slot<I> &>(inst).value = seed + static_cast<int32_t>(I)), ...);
+}
+
+template<size_t N>
+static void bench_schema(size_t iterations)
+{
+    using S = bench_config<N>;
+
+    config_state_set<S> state;
+    bench_add_fields(state, std::make_index_sequence<N>{});
+
+    S inst;
+    bench_fill(inst, 1, std::make_index_sequence<N>{});
+
+    char name[48] = {};
+
+    // JSON
+    rapidjson::Document doc;
+    state.write(inst, doc, doc.GetAllocator());
+
+    std::snprintf(name, sizeof(name), "fields/%zu/write", N);
+    bench_run(name, iterations, nullptr, [&]() {
+        rapidjson::Document out;
+        state.write(inst, out, out.GetAllocator());
+    });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/write-stringify", N);
+    bench_run(name, iterations, nullptr, [&]() {
+        rapidjson::Document out;
+        state.write(inst, out, out.GetAllocator());
+        rapidjson::StringBuffer json;
+        bench_stringify(out, json);
+    });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/serialize", N);
+    bench_run(name, iterations, nullptr, [&]() {
+        rapidjson::StringBuffer json;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(json);
+        state.serialize(inst, writer);
+    });
+
+    S target;
+    std::snprintf(name, sizeof(name), "fields/%zu/read", N);
+    bench_run(
+        name, iterations, [&]() { target = S(); }, [&]() { state.read(target, doc); });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/read-unchanged", N);
+    bench_run(name, iterations, nullptr, [&]() { state.read(target, doc); });
+
+    config_state_snapshot<S> snapshot(inst);
+    std::snprintf(name, sizeof(name), "fields/%zu/snapshot-read", N);
+    bench_run(name, iterations, [&]() { snapshot.update([](S &s) { s = S(); return true; }); }, [&]() { snapshot.read(state, doc); });
+
+    int32_t sink = 0;
+    std::snprintf(name, sizeof(name), "fields/%zu/snapshot-acquire", N);
+    bench_run(name, iterations, nullptr, [&]() { sink += static_cast<const bench_slot<0> &>(*snapshot.acquire()).value; });
+    (void)sink;
+
+    rapidjson::StringBuffer json;
+    bench_stringify(doc, json);
+
+    std::snprintf(name, sizeof(name), "fields/%zu/read-stream", N);
+    bench_run(
+        name, iterations, [&]() { target = S(); }, [&]() { bench_read_stream<S>(state, target, json); });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/read-stream-unchanged", N);
+    bench_run(name, iterations, nullptr, [&]() { bench_read_stream<S>(state, target, json); });
+
+    // CBOR
+    std::vector<uint8_t> cbor(N * 24 + 64);
+    size_t cbor_length = 0;
+    ESP_ERROR_CHECK(config_state_cbor_encode<S>(state, inst, cbor.data(), cbor.size(), &cbor_length));
+
+    std::snprintf(name, sizeof(name), "fields/%zu/cbor-encode", N);
+    bench_run(name, iterations, nullptr, [&]() { config_state_cbor_encode<S>(state, inst, cbor.data(), cbor.size(), &cbor_length); });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/cbor-decode", N);
+    bench_run(
+        name, iterations, [&]() { target = S(); }, [&]() { config_state_cbor_decode<S>(state, target, cbor.data(), cbor_length); });
+
+    // NVS
+    nvs_mem_reset();
+    ESP_ERROR_CHECK(nvs_flash_init());
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(BENCH_NAMESPACE, NVS_READWRITE, &err);
+    ESP_ERROR_CHECK(err);
+
+    std::snprintf(name, sizeof(name), "fields/%zu/store", N);
+    bench_run(
+        name, iterations, [&]() { ESP_ERROR_CHECK(handle->erase_all()); }, [&]() { state.store(inst, handle); });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/store-unchanged", N);
+    bench_run(name, iterations, nullptr, [&]() { state.store(inst, handle); });
+
+    // Single field differs from persisted copy
+    S persisted;
+    std::snprintf(name, sizeof(name), "fields/%zu/store-changed", N);
+    bench_run(
+        name, iterations, [&]() {
+            persisted = inst;
+            static_cast<bench_slot<0> &>(persisted).value++;
+        },
+        [&]() { state.store_changed(inst, persisted, handle); });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/load", N);
+    bench_run(
+        name, iterations, [&]() { target = S(); }, [&]() { state.load(target, handle); });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/load-bulk", N);
+    bench_run(
+        name, iterations, [&]() { target = S(); }, [&]() { state.load_bulk(target, *handle, BENCH_NAMESPACE); });
+
+    // First boot, nothing is stored
+    std::snprintf(name, sizeof(name), "fields/%zu/load-empty", N);
+    bench_run(
+        name, iterations, [&]() { ESP_ERROR_CHECK(handle->erase_all()); }, [&]() { state.load(target, handle); });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/load-bulk-empty", N);
+    bench_run(
+        name, iterations, [&]() { ESP_ERROR_CHECK(handle->erase_all()); }, [&]() { state.load_bulk(target, *handle, BENCH_NAMESPACE); });
+
+    // Single file, written once per commit
+    config_state_file_storage file("config_state_bench.kv");
+    std::snprintf(name, sizeof(name), "fields/%zu/store-file", N);
+    bench_run(
+        name, iterations, [&]() { ESP_ERROR_CHECK(file.erase_all()); }, [&]() {
+            state.store(inst, file);
+            ESP_ERROR_CHECK(file.commit());
+        });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/load-file", N);
+    bench_run(
+        name, iterations, [&]() { target = S(); }, [&]() {
+            ESP_ERROR_CHECK(file.open());
+            state.load(target, file);
+        });
+    std::remove(file.path().c_str());
+
+    // NVS, single blob
+    config_state_set<S> blob_state;
+    bench_add_fields(blob_state, std::make_index_sequence<N>{});
+    blob_state.store_as_blob("blob");
+
+    std::snprintf(name, sizeof(name), "fields/%zu/store-blob", N);
+    bench_run(
+        name, iterations, [&]() { ESP_ERROR_CHECK(handle->erase_all()); }, [&]() { blob_state.store(inst, handle); });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/load-blob", N);
+    bench_run(
+        name, iterations, [&]() { target = S(); }, [&]() { blob_state.load(target, handle); });
+}
+
+template<size_t I>
+static const char *bench_pointer()
+{
+    // Static storage, schema references it
+    static char json_ptr[24] = {};
+    std::snprintf(json_ptr, sizeof(json_ptr), "/g%zu/f%zu", I / 10, I);
+    return json_ptr;
+}
+
+template<typename S, size_t... I>
+static auto bench_static_schema(std::index_sequence<I...>)
+{
+    return config_state_schema_of<S>(config_state_static_field_of(static_cast<int32_t S::*>(&bench_slot<I>::value), bench_pointer<I>())...);
+}
+
+// Same as bench_schema, with compile-time schema (large N would exceed template depth of std::tuple)
+template<size_t N>
+static void bench_static(size_t iterations)
+{
+    using S = bench_config<N>;
+
+    static const auto schema = bench_static_schema<S>(std::make_index_sequence<N>{});
+
+    S inst;
+    bench_fill(inst, 1, std::make_index_sequence<N>{});
+
+    char name[48] = {};
+
+    // JSON
+    rapidjson::Document doc;
+    schema.write(inst, doc, doc.GetAllocator());
+
+    std::snprintf(name, sizeof(name), "fields/%zu/static-write", N);
+    bench_run(name, iterations, nullptr, [&]() {
+        rapidjson::Document out;
+        schema.write(inst, out, out.GetAllocator());
+    });
+
+    S target;
+    std::snprintf(name, sizeof(name), "fields/%zu/static-read", N);
+    bench_run(
+        name, iterations, [&]() { target = S(); }, [&]() { schema.read(target, doc); });
+
+    // NVS
+    nvs_mem_reset();
+    ESP_ERROR_CHECK(nvs_flash_init());
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(BENCH_NAMESPACE, NVS_READWRITE, &err);
+    ESP_ERROR_CHECK(err);
+
+    std::snprintf(name, sizeof(name), "fields/%zu/static-store", N);
+    bench_run(
+        name, iterations, [&]() { ESP_ERROR_CHECK(handle->erase_all()); }, [&]() { schema.store(inst, *handle); });
+
+    std::snprintf(name, sizeof(name), "fields/%zu/static-load", N);
+    bench_run(
+        name, iterations, [&]() { target = S(); }, [&]() { schema.load(target, *handle); });
+}
+
+struct bench_list_config
+{
+    std::vector<uint32_t> values;
+};
+
+static void bench_list(size_t length, size_t iterations)
+{
+    config_state_set<bench_list_config> state;
+    state.add_value_list(&bench_list_config::values, "/list", "/l");
+
+    bench_list_config inst;
+    inst.values.resize(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        inst.values[i] = static_cast<uint32_t>(i * 7);
+    }
+
+    char name[48] = {};
+
+    // JSON
+    rapidjson::Document doc;
+    state.write(inst, doc, doc.GetAllocator());
+
+    std::snprintf(name, sizeof(name), "list/%zu/write", length);
+    bench_run(name, iterations, nullptr, [&]() {
+        rapidjson::Document out;
+        state.write(inst, out, out.GetAllocator());
+    });
+
+    std::snprintf(name, sizeof(name), "list/%zu/write-stringify", length);
+    bench_run(name, iterations, nullptr, [&]() {
+        rapidjson::Document out;
+        state.write(inst, out, out.GetAllocator());
+        rapidjson::StringBuffer json;
+        bench_stringify(out, json);
+    });
+
+    std::snprintf(name, sizeof(name), "list/%zu/serialize", length);
+    bench_run(name, iterations, nullptr, [&]() {
+        rapidjson::StringBuffer json;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(json);
+        state.serialize(inst, writer);
+    });
+
+    bench_list_config target;
+    std::snprintf(name, sizeof(name), "list/%zu/read", length);
+    bench_run(
+        name, iterations, [&]() { target = bench_list_config(); }, [&]() { state.read(target, doc); });
+
+    std::snprintf(name, sizeof(name), "list/%zu/read-unchanged", length);
+    bench_run(name, iterations, nullptr, [&]() { state.read(target, doc); });
+
+    // JSON, element by element, same as lists of objects, to compare with numeric list above
+    config_state_set<bench_list_config> generic_state;
+    generic_state.add_list(&bench_list_config::values, "/list", "/l", new config_state_value<uint32_t>());
+
+    std::snprintf(name, sizeof(name), "list/%zu/write-generic", length);
+    bench_run(name, iterations, nullptr, [&]() {
+        rapidjson::Document out;
+        generic_state.write(inst, out, out.GetAllocator());
+    });
+
+    std::snprintf(name, sizeof(name), "list/%zu/read-generic", length);
+    bench_run(
+        name, iterations, [&]() { target = bench_list_config(); }, [&]() { generic_state.read(target, doc); });
+
+    std::snprintf(name, sizeof(name), "list/%zu/read-generic-unchanged", length);
+    bench_run(name, iterations, nullptr, [&]() { generic_state.read(target, doc); });
+
+    rapidjson::StringBuffer json;
+    bench_stringify(doc, json);
+
+    std::snprintf(name, sizeof(name), "list/%zu/read-stream", length);
+    bench_run(
+        name, iterations, [&]() { target = bench_list_config(); }, [&]() { bench_read_stream<bench_list_config>(state, target, json); });
+
+    std::snprintf(name, sizeof(name), "list/%zu/read-stream-unchanged", length);
+    bench_run(name, iterations, nullptr, [&]() { bench_read_stream<bench_list_config>(state, target, json); });
+
+    // NVS
+    nvs_mem_reset();
+    ESP_ERROR_CHECK(nvs_flash_init());
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(BENCH_NAMESPACE, NVS_READWRITE, &err);
+    ESP_ERROR_CHECK(err);
+
+    std::snprintf(name, sizeof(name), "list/%zu/store", length);
+    bench_run(
+        name, iterations, [&]() { ESP_ERROR_CHECK(handle->erase_all()); }, [&]() { state.store(inst, handle); });
+
+    std::snprintf(name, sizeof(name), "list/%zu/store-unchanged", length);
+    bench_run(name, iterations, nullptr, [&]() { state.store(inst, handle); });
+
+    // Single element differs from persisted copy
+    bench_list_config persisted;
+    std::snprintf(name, sizeof(name), "list/%zu/store-changed", length);
+    bench_run(
+        name, iterations, [&]() {
+            persisted = inst;
+            persisted.values[length / 2]++;
+        },
+        [&]() { state.store_changed(inst, persisted, handle); });
+
+    std::snprintf(name, sizeof(name), "list/%zu/load", length);
+    bench_run(
+        name, iterations, [&]() { target = bench_list_config(); }, [&]() { state.load(target, handle); });
+
+    // Single step of 16 values, latency stays the same regardless of length
+    config_state_cursor cursor;
+    std::snprintf(name, sizeof(name), "list/%zu/store-step", length);
+    bench_run(
+        name, iterations, [&]() {
+            if (cursor.done()) cursor.reset();
+        },
+        [&]() {
+            config_state_budget budget(16);
+            state.store_step(inst, *handle, cursor, budget);
+        });
+
+    // NVS, packed list
+    config_state_set<bench_list_config> packed_state;
+    packed_state.add_packed_list(&bench_list_config::values, "/list", "/l");
+
+    std::snprintf(name, sizeof(name), "list/%zu/store-packed", length);
+    bench_run(
+        name, iterations, [&]() { ESP_ERROR_CHECK(handle->erase_all()); }, [&]() { packed_state.store(inst, handle); });
+
+    std::snprintf(name, sizeof(name), "list/%zu/load-packed", length);
+    bench_run(
+        name, iterations, [&]() { target = bench_list_config(); }, [&]() { packed_state.load(target, handle); });
+
+    // NVS, single blob
+    config_state_set<bench_list_config> blob_state;
+    blob_state.add_value_list(&bench_list_config::values, "/list", "/l");
+    blob_state.store_as_blob("blob");
+
+    std::snprintf(name, sizeof(name), "list/%zu/store-blob", length);
+    bench_run(
+        name, iterations, [&]() { ESP_ERROR_CHECK(handle->erase_all()); }, [&]() { blob_state.store(inst, handle); });
+
+    std::snprintf(name, sizeof(name), "list/%zu/load-blob", length);
+    bench_run(
+        name, iterations, [&]() { target = bench_list_config(); }, [&]() { blob_state.load(target, handle); });
+}
+
+/**
+ * Usage: config_state_bench [--quick] [filter]
+ *
+ * --quick runs each benchmark once, used as a smoke test by ctest.
+ * filter runs only benchmarks, whose name contains given string.
+ */
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            bench_quick = true;
+        }
+        else
+        {
+            bench_filter = argv[i];
+        }
+    }
+
+    // Missing keys are expected during benchmarks, don't measure logging
+    esp_log_level_set("*", ESP_LOG_ERROR);
+
+    std::printf("%-36s %8s %14s %10s %10s %10s %12s\n", "benchmark", "iters", "ns/op", "nvs get", "nvs set", "nvs write", "bytes");
+
+    bench_schema<10>(1000);
+    bench_schema<100>(100);
+    bench_static<10>(1000);
+    bench_static<100>(100);
+    bench_schema<1000>(10);
+    bench_list(10000, 10);
+
+    return 0;
+}
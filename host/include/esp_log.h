@@ -0,0 +1,46 @@
+#pragma once
+
+// Host (Linux) subset of ESP-IDF esp_log.h, writes to stderr
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#endif
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+void esp_log_writev(esp_log_level_t level, const char *tag, const char *format, va_list args);
+
+#define ESP_LOG_LEVEL_LOCAL(level, letter, tag, format, ...)                        \
+    do                                                                              \
+    {                                                                               \
+        if (LOG_LOCAL_LEVEL >= (level))                                             \
+        {                                                                           \
+            esp_log_write((level), (tag), letter " %s: " format "\n", (tag), ##__VA_ARGS__); \
+        }                                                                           \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+// Host (Linux) subset of ESP-IDF nvs.h, backed by in-memory emulation, see nvs_mem.h
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_INITIALIZED (ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_READ_ONLY (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_NAME (ESP_ERR_NVS_BASE + 0x06)
+#define ESP_ERR_NVS_INVALID_HANDLE (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_REMOVE_FAILED (ESP_ERR_NVS_BASE + 0x08)
+#define ESP_ERR_NVS_KEY_TOO_LONG (ESP_ERR_NVS_BASE + 0x09)
+#define ESP_ERR_NVS_PAGE_FULL (ESP_ERR_NVS_BASE + 0x0a)
+#define ESP_ERR_NVS_INVALID_STATE (ESP_ERR_NVS_BASE + 0x0b)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_VALUE_TOO_LONG (ESP_ERR_NVS_BASE + 0x0e)
+#define ESP_ERR_NVS_PART_NOT_FOUND (ESP_ERR_NVS_BASE + 0x0f)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND (ESP_ERR_NVS_BASE + 0x10)
+
+#define NVS_DEFAULT_PART_NAME "nvs"
+#define NVS_PART_NAME_MAX_SIZE 16
+#define NVS_KEY_NAME_MAX_SIZE 16
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum
+{
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+
+typedef enum
+{
+    NVS_TYPE_U8 = 0x01,
+    NVS_TYPE_I8 = 0x11,
+    NVS_TYPE_U16 = 0x02,
+    NVS_TYPE_I16 = 0x12,
+    NVS_TYPE_U32 = 0x04,
+    NVS_TYPE_I32 = 0x14,
+    NVS_TYPE_U64 = 0x08,
+    NVS_TYPE_I64 = 0x18,
+    NVS_TYPE_STR = 0x21,
+    NVS_TYPE_BLOB = 0x42,
+    NVS_TYPE_ANY = 0xff
+} nvs_type_t;
+
+typedef struct
+{
+    char namespace_name[16];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+} nvs_entry_info_t;
+
+typedef struct nvs_opaque_iterator_t *nvs_iterator_t;
+
+// ESP-IDF 5.x iterator API, see esp_idf_version.h
+esp_err_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type, nvs_iterator_t *output_iterator);
+esp_err_t nvs_entry_next(nvs_iterator_t *iterator);
+esp_err_t nvs_entry_info(const nvs_iterator_t iterator, nvs_entry_info_t *out_info);
+void nvs_release_iterator(nvs_iterator_t iterator);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+// Host (Linux) subset of ESP-IDF nvs_flash.h, backed by in-memory emulation, see nvs_mem.h
+
+#include "nvs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_deinit(void);
+esp_err_t nvs_flash_erase(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,78 @@
+#pragma once
+
+// Host (Linux) subset of ESP-IDF nvs_handle.hpp, backed by in-memory emulation, see nvs_mem.h
+
+#include "nvs.h"
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace nvs {
+
+enum class ItemType : uint8_t
+{
+    U8 = NVS_TYPE_U8,
+    I8 = NVS_TYPE_I8,
+    U16 = NVS_TYPE_U16,
+    I16 = NVS_TYPE_I16,
+    U32 = NVS_TYPE_U32,
+    I32 = NVS_TYPE_I32,
+    U64 = NVS_TYPE_U64,
+    I64 = NVS_TYPE_I64,
+    SZ = NVS_TYPE_STR,
+    BLOB = 0x41,
+    BLOB_DATA = NVS_TYPE_BLOB,
+    BLOB_IDX = 0x48,
+    ANY = NVS_TYPE_ANY
+};
+
+template<typename T, typename std::enable_if<std::is_integral<T>::value, void *>::type = nullptr>
+constexpr ItemType itemTypeOf()
+{
+    return static_cast<ItemType>(((std::is_signed<T>::value) ? 0x10 : 0x00) | sizeof(T));
+}
+
+template<typename T>
+constexpr ItemType itemTypeOf(const T &)
+{
+    return itemTypeOf<T>();
+}
+
+class NVSHandle
+{
+ public:
+    virtual ~NVSHandle() = default;
+
+    template<typename T>
+    esp_err_t set_item(const char *key, T value)
+    {
+        return set_typed_item(itemTypeOf(value), key, &value, sizeof(value));
+    }
+
+    virtual esp_err_t set_string(const char *key, const char *value) = 0;
+
+    template<typename T>
+    esp_err_t get_item(const char *key, T &value)
+    {
+        return get_typed_item(itemTypeOf(value), key, &value, sizeof(value));
+    }
+
+    virtual esp_err_t get_string(const char *key, char *out_str, size_t len) = 0;
+    virtual esp_err_t get_item_size(ItemType datatype, const char *key, size_t &size) = 0;
+    virtual esp_err_t set_blob(const char *key, const void *blob, size_t len) = 0;
+    virtual esp_err_t get_blob(const char *key, void *blob, size_t len) = 0;
+    virtual esp_err_t erase_item(const char *key) = 0;
+    virtual esp_err_t erase_all() = 0;
+    virtual esp_err_t commit() = 0;
+    virtual esp_err_t get_used_entry_count(size_t &usedEntries) = 0;
+
+ protected:
+    virtual esp_err_t set_typed_item(ItemType datatype, const char *key, const void *data, size_t dataSize) = 0;
+    virtual esp_err_t get_typed_item(ItemType datatype, const char *key, void *data, size_t dataSize) = 0;
+};
+
+std::unique_ptr<NVSHandle> open_nvs_handle_from_partition(const char *partition_name, const char *ns_name, nvs_open_mode_t open_mode, esp_err_t *err = nullptr);
+
+std::unique_ptr<NVSHandle> open_nvs_handle(const char *ns_name, nvs_open_mode_t open_mode, esp_err_t *err = nullptr);
+
+} // namespace nvs
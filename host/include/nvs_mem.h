@@ -0,0 +1,36 @@
+#pragma once
+
+// In-memory NVS emulation used by the host (Linux) build.
+//
+// Items live in process memory, keyed by partition, namespace and key. Emulation follows NVS rules where they matter
+// for callers: key length, read-only handles, typed lookups and writes skipped when the stored value is unchanged.
+
+#include "nvs.h"
+#include <cstddef>
+
+/**
+ * Counters of all operations performed on any emulated NVS handle, since last nvs_mem_reset_stats().
+ */
+struct nvs_mem_stats
+{
+    size_t get_count;     ///< get_item, get_string, get_blob and get_item_size calls
+    size_t set_count;     ///< set_item, set_string and set_blob calls
+    size_t erase_count;   ///< erase_item and erase_all calls
+    size_t commit_count;  ///< commit calls
+    size_t write_count;   ///< set calls, which actually modified stored value
+    size_t bytes_written; ///< flash bytes written by modifying set calls, in 32 byte NVS entries
+};
+
+/**
+ * Size of a single NVS entry, storage is allocated in these units.
+ */
+static constexpr size_t NVS_MEM_ENTRY_SIZE = 32;
+
+nvs_mem_stats nvs_mem_get_stats();
+
+void nvs_mem_reset_stats();
+
+/**
+ * Erases all emulated partitions and resets stats.
+ */
+void nvs_mem_reset();
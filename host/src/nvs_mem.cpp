@@ -0,0 +1,436 @@
+#include "nvs_mem.h"
+#include "nvs_flash.h"
+#include "nvs_handle.hpp"
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+static constexpr size_t NVS_MEM_STRING_MAX_SIZE = 4000;
+static constexpr size_t NVS_MEM_BLOB_MAX_SIZE = 508000;
+
+struct nvs_mem_item
+{
+    nvs::ItemType type = nvs::ItemType::ANY;
+    std::vector<uint8_t> data;
+
+    size_t entry_count() const
+    {
+        // Primitive types fit into the entry itself, variable length data follow the header entry
+        return type == nvs::ItemType::SZ || type == nvs::ItemType::BLOB_DATA ? 1 + (data.size() + NVS_MEM_ENTRY_SIZE - 1) / NVS_MEM_ENTRY_SIZE : 1;
+    }
+};
+
+typedef std::map<std::string, nvs_mem_item> nvs_mem_namespace;
+typedef std::map<std::string, nvs_mem_namespace> nvs_mem_partition;
+
+static std::mutex nvs_mem_mutex;
+static std::map<std::string, nvs_mem_partition> nvs_mem_partitions;
+static nvs_mem_stats nvs_mem_stats_value = {};
+static bool nvs_mem_initialized = false;
+
+struct nvs_opaque_iterator_t
+{
+    std::vector<nvs_entry_info_t> entries;
+    size_t pos;
+};
+
+static nvs::ItemType nvs_mem_storage_type(nvs::ItemType type)
+{
+    // Both blob formats are stored the same way
+    return type == nvs::ItemType::BLOB ? nvs::ItemType::BLOB_DATA : type;
+}
+
+static esp_err_t nvs_mem_check_key(const char *key)
+{
+    if (!key || key[0] == '\0')
+    {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    if (std::strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+    {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return ESP_OK;
+}
+
+namespace nvs {
+
+class NVSHandleMem : public NVSHandle
+{
+ public:
+    NVSHandleMem(std::string partition_name, std::string ns_name, nvs_open_mode_t open_mode)
+        : partition_name_(std::move(partition_name)),
+          ns_name_(std::move(ns_name)),
+          open_mode_(open_mode)
+    {
+    }
+
+    esp_err_t set_string(const char *key, const char *value) override
+    {
+        if (!value)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        size_t len = std::strlen(value) + 1;
+        if (len > NVS_MEM_STRING_MAX_SIZE)
+        {
+            return ESP_ERR_NVS_VALUE_TOO_LONG;
+        }
+        return write(ItemType::SZ, key, value, len);
+    }
+
+    esp_err_t get_string(const char *key, char *out_str, size_t len) override
+    {
+        return read(ItemType::SZ, key, out_str, len, false);
+    }
+
+    esp_err_t get_item_size(ItemType datatype, const char *key, size_t &size) override
+    {
+        std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+        nvs_mem_stats_value.get_count++;
+
+        const nvs_mem_item *item = nullptr;
+        esp_err_t err = find(datatype, key, item);
+        if (err == ESP_OK)
+        {
+            size = item->data.size();
+        }
+        return err;
+    }
+
+    esp_err_t set_blob(const char *key, const void *blob, size_t len) override
+    {
+        if (!blob && len > 0)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (len > NVS_MEM_BLOB_MAX_SIZE)
+        {
+            return ESP_ERR_NVS_VALUE_TOO_LONG;
+        }
+        return write(ItemType::BLOB_DATA, key, blob, len);
+    }
+
+    esp_err_t get_blob(const char *key, void *blob, size_t len) override
+    {
+        return read(ItemType::BLOB_DATA, key, blob, len, false);
+    }
+
+    esp_err_t erase_item(const char *key) override
+    {
+        std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+        nvs_mem_stats_value.erase_count++;
+
+        esp_err_t err = check_writable(key);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+
+        return nvs_mem_partitions[partition_name_][ns_name_].erase(key) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    esp_err_t erase_all() override
+    {
+        std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+        nvs_mem_stats_value.erase_count++;
+
+        if (open_mode_ == NVS_READONLY)
+        {
+            return ESP_ERR_NVS_READ_ONLY;
+        }
+
+        nvs_mem_partitions[partition_name_][ns_name_].clear();
+        return ESP_OK;
+    }
+
+    esp_err_t commit() override
+    {
+        std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+        nvs_mem_stats_value.commit_count++;
+        return ESP_OK;
+    }
+
+    esp_err_t get_used_entry_count(size_t &usedEntries) override
+    {
+        std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+
+        usedEntries = 0;
+        for (const auto &item : nvs_mem_partitions[partition_name_][ns_name_])
+        {
+            usedEntries += item.second.entry_count();
+        }
+        return ESP_OK;
+    }
+
+ protected:
+    esp_err_t set_typed_item(ItemType datatype, const char *key, const void *data, size_t dataSize) override
+    {
+        return write(datatype, key, data, dataSize);
+    }
+
+    esp_err_t get_typed_item(ItemType datatype, const char *key, void *data, size_t dataSize) override
+    {
+        return read(datatype, key, data, dataSize, true);
+    }
+
+ private:
+    const std::string partition_name_;
+    const std::string ns_name_;
+    const nvs_open_mode_t open_mode_;
+
+    esp_err_t check_writable(const char *key) const
+    {
+        if (open_mode_ == NVS_READONLY)
+        {
+            return ESP_ERR_NVS_READ_ONLY;
+        }
+        return nvs_mem_check_key(key);
+    }
+
+    // NOTE must be called with the mutex held
+    esp_err_t find(ItemType datatype, const char *key, const nvs_mem_item *&out_item) const
+    {
+        esp_err_t err = nvs_mem_check_key(key);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+
+        const nvs_mem_namespace &ns = nvs_mem_partitions[partition_name_][ns_name_];
+        auto it = ns.find(key);
+        if (it == ns.end() || (datatype != ItemType::ANY && it->second.type != nvs_mem_storage_type(datatype)))
+        {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+
+        out_item = &it->second;
+        return ESP_OK;
+    }
+
+    esp_err_t read(ItemType datatype, const char *key, void *data, size_t size, bool exact_size)
+    {
+        std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+        nvs_mem_stats_value.get_count++;
+
+        const nvs_mem_item *item = nullptr;
+        esp_err_t err = find(datatype, key, item);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+
+        if (exact_size ? size != item->data.size() : size < item->data.size())
+        {
+            return ESP_ERR_NVS_INVALID_LENGTH;
+        }
+
+        if (!item->data.empty())
+        {
+            std::memcpy(data, item->data.data(), item->data.size());
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t write(ItemType datatype, const char *key, const void *data, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+        nvs_mem_stats_value.set_count++;
+
+        esp_err_t err = check_writable(key);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+
+        nvs_mem_item &item = nvs_mem_partitions[partition_name_][ns_name_][key];
+        const auto *bytes = static_cast<const uint8_t *>(data);
+
+        // Same as real NVS, unchanged value is not written again
+        if (item.type == datatype && item.data.size() == size && (size == 0 || std::memcmp(item.data.data(), bytes, size) == 0))
+        {
+            return ESP_OK;
+        }
+
+        item.type = datatype;
+        item.data.assign(bytes, bytes + size);
+
+        nvs_mem_stats_value.write_count++;
+        nvs_mem_stats_value.bytes_written += item.entry_count() * NVS_MEM_ENTRY_SIZE;
+        return ESP_OK;
+    }
+};
+
+std::unique_ptr<NVSHandle> open_nvs_handle_from_partition(const char *partition_name, const char *ns_name, nvs_open_mode_t open_mode, esp_err_t *err)
+{
+    esp_err_t result = ESP_OK;
+    std::unique_ptr<NVSHandle> handle;
+
+    {
+        std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+
+        if (!nvs_mem_initialized)
+        {
+            result = ESP_ERR_NVS_NOT_INITIALIZED;
+        }
+        else if (!partition_name || !ns_name || ns_name[0] == '\0' || std::strlen(ns_name) >= NVS_KEY_NAME_MAX_SIZE)
+        {
+            result = ESP_ERR_NVS_INVALID_NAME;
+        }
+        else
+        {
+            nvs_mem_partition &partition = nvs_mem_partitions[partition_name];
+            if (open_mode == NVS_READONLY && partition.find(ns_name) == partition.end())
+            {
+                result = ESP_ERR_NVS_NOT_FOUND;
+            }
+            else
+            {
+                partition[ns_name]; // Create namespace
+                handle.reset(new NVSHandleMem(partition_name, ns_name, open_mode));
+            }
+        }
+    }
+
+    if (err)
+    {
+        *err = result;
+    }
+    return handle;
+}
+
+std::unique_ptr<NVSHandle> open_nvs_handle(const char *ns_name, nvs_open_mode_t open_mode, esp_err_t *err)
+{
+    return open_nvs_handle_from_partition(NVS_DEFAULT_PART_NAME, ns_name, open_mode, err);
+}
+
+} // namespace nvs
+
+esp_err_t nvs_flash_init()
+{
+    std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+    nvs_mem_initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_deinit()
+{
+    std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+    if (!nvs_mem_initialized)
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    nvs_mem_initialized = false;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase()
+{
+    std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+    nvs_mem_partitions.erase(NVS_DEFAULT_PART_NAME);
+    return ESP_OK;
+}
+
+esp_err_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type, nvs_iterator_t *output_iterator)
+{
+    if (!output_iterator)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *output_iterator = nullptr;
+
+    std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+
+    auto partition = nvs_mem_partitions.find(part_name ? part_name : NVS_DEFAULT_PART_NAME);
+    if (partition == nvs_mem_partitions.end())
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    auto *it = new nvs_opaque_iterator_t();
+    it->pos = 0;
+
+    for (const auto &ns : partition->second)
+    {
+        if (namespace_name && ns.first != namespace_name)
+        {
+            continue;
+        }
+
+        for (const auto &item : ns.second)
+        {
+            if (type != NVS_TYPE_ANY && static_cast<nvs_type_t>(item.second.type) != type)
+            {
+                continue;
+            }
+
+            nvs_entry_info_t info = {};
+            std::strncpy(info.namespace_name, ns.first.c_str(), sizeof(info.namespace_name) - 1);
+            std::strncpy(info.key, item.first.c_str(), sizeof(info.key) - 1);
+            info.type = static_cast<nvs_type_t>(item.second.type);
+            it->entries.push_back(info);
+        }
+    }
+
+    if (it->entries.empty())
+    {
+        delete it;
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *output_iterator = it;
+    return ESP_OK;
+}
+
+esp_err_t nvs_entry_next(nvs_iterator_t *iterator)
+{
+    if (!iterator || !*iterator)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Same as ESP-IDF, iterator is released at the end
+    if (++(*iterator)->pos >= (*iterator)->entries.size())
+    {
+        delete *iterator;
+        *iterator = nullptr;
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_entry_info(const nvs_iterator_t iterator, nvs_entry_info_t *out_info)
+{
+    if (!iterator || !out_info)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_info = iterator->entries[iterator->pos];
+    return ESP_OK;
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator)
+{
+    delete iterator;
+}
+
+nvs_mem_stats nvs_mem_get_stats()
+{
+    std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+    return nvs_mem_stats_value;
+}
+
+void nvs_mem_reset_stats()
+{
+    std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+    nvs_mem_stats_value = {};
+}
+
+void nvs_mem_reset()
+{
+    std::lock_guard<std::mutex> lock(nvs_mem_mutex);
+    nvs_mem_partitions.clear();
+    nvs_mem_stats_value = {};
+}
@@ -1,11 +1,36 @@
 #pragma once
 
 #include "config_state_helper.h"
+#include "config_state_storage.h"
+#include "config_state_stream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <nvs_handle.hpp>
 #include <rapidjson/pointer.h>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#ifndef CONFIG_STATE_PACKED_CHUNK_SIZE
+/**
+ * Max size of a single NVS blob of config_state_packed_list. Single chunk fits into one NVS page.
+ */
+#define CONFIG_STATE_PACKED_CHUNK_SIZE 4000
+#endif
+
+#ifndef CONFIG_STATE_LIST_KEY_CAPACITY
+/**
+ * Number of leading elements of config_state_list, whose NVS keys are composed once, when the list is created.
+ * Costs NVS_KEY_NAME_MAX_SIZE bytes per key, 0 composes all keys on the stack.
+ */
+#define CONFIG_STATE_LIST_KEY_CAPACITY 8
+#endif
+
 enum config_state_flags
 {
     config_state_no_flags = 0,
@@ -17,8 +42,170 @@ enum config_state_flags
     config_state_disable_persistence = config_state_disable_load | config_state_disable_store,
 };
 
+/**
+ * Default constructed instance, including default member initializers, used to reset values, see config_state::apply_patch.
+ */
+template<typename S>
+const S &config_state_defaults()
+{
+    static const S defaults{};
+    return defaults;
+}
+
+/**
+ * Changed states of config_state_set, reported by its read, indexed by ordinal of the state,
+ * which is order in which states were added to the set.
+ */
+struct config_state_changes
+{
+    bool test(size_t ordinal) const
+    {
+        return ordinal / 32 < words_.size() && (words_[ordinal / 32] & (1u << (ordinal % 32))) != 0;
+    }
+
+    void set(size_t ordinal)
+    {
+        if (ordinal / 32 >= words_.size())
+        {
+            words_.resize(ordinal / 32 + 1);
+        }
+        words_[ordinal / 32] |= 1u << (ordinal % 32);
+    }
+
+    bool any() const
+    {
+        return std::any_of(words_.begin(), words_.end(), [](uint32_t word) { return word != 0; });
+    }
+
+    void clear()
+    {
+        words_.clear();
+    }
+
+ private:
+    std::vector<uint32_t> words_;
+};
+
+/**
+ * Limit of a single config_state::store_step or config_state::load_step call, by number of operations
+ * (single NVS value read or written), by time, or both. At least one operation is always done, so every step makes
+ * progress.
+ */
+struct config_state_budget
+{
+    explicit config_state_budget(size_t max_ops)
+        : config_state_budget(max_ops, std::chrono::microseconds::max())
+    {
+    }
+
+    explicit config_state_budget(std::chrono::microseconds max_time)
+        : config_state_budget(SIZE_MAX, max_time)
+    {
+    }
+
+    config_state_budget(size_t max_ops, std::chrono::microseconds max_time)
+        : max_ops_(max_ops),
+          deadline_(max_time == std::chrono::microseconds::max() ? std::chrono::steady_clock::time_point::max() : std::chrono::steady_clock::now() + max_time)
+    {
+    }
+
+    bool exhausted() const
+    {
+        if (used_ == 0)
+        {
+            return false;
+        }
+        return used_ >= max_ops_ || (deadline_ != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline_);
+    }
+
+    void consume()
+    {
+        used_++;
+    }
+
+    size_t used() const
+    {
+        return used_;
+    }
+
+ private:
+    size_t max_ops_;
+    std::chrono::steady_clock::time_point deadline_;
+    size_t used_ = 0;
+};
+
+/**
+ * Progress of config_state::store_step or config_state::load_step. Holds position at each nesting level,
+ * so next step continues where previous one stopped, including in the middle of a list.
+ */
+struct config_state_cursor
+{
+    /**
+     * Whether whole instance has been processed.
+     */
+    bool done() const
+    {
+        return done_;
+    }
+
+    /**
+     * Last error of all steps so far, same as store or load would return.
+     */
+    esp_err_t error() const
+    {
+        return last_err_;
+    }
+
+    /**
+     * Starts over, e.g. when instance has changed during store.
+     */
+    void reset()
+    {
+        positions_.clear();
+        done_ = false;
+        last_err_ = ESP_OK;
+    }
+
+    size_t position(size_t depth) const
+    {
+        return depth < positions_.size() ? positions_[depth] : 0;
+    }
+
+    /**
+     * Moves to next position at given level, and forgets positions of deeper levels.
+     *
+     * @return New position
+     */
+    size_t advance(size_t depth)
+    {
+        positions_.resize(depth + 1);
+        return ++positions_[depth];
+    }
+
+    void merge(esp_err_t err)
+    {
+        if (err != ESP_OK && (err != ESP_ERR_NVS_NOT_FOUND || last_err_ == ESP_OK)) // Don't overwrite more important error with NOT_FOUND
+        {
+            last_err_ = err;
+        }
+    }
+
+    void finish()
+    {
+        done_ = true;
+    }
+
+ private:
+    std::vector<size_t> positions_;
+    bool done_ = false;
+    esp_err_t last_err_ = ESP_OK;
+};
+
 template<typename S>
-struct config_state
+struct config_state_path_target;
+
+template<typename S>
+struct config_state : config_state_stream_target
 {
     const config_state_flags flags;
 
@@ -45,6 +232,121 @@ struct config_state
         return false;
     }
 
+    /**
+     * Same as read, but with JSON value already resolved by pointer(), relative to the root object.
+     *
+     * @param value JSON value at pointer()
+     * @return true if value has changed, false otherwise
+     */
+    bool read_resolved(S &inst, const rapidjson::Value &value) const
+    {
+        if ((flags & config_state_disable_read) == 0)
+        {
+            return do_read_resolved(inst, value);
+        }
+        return false;
+    }
+
+    /**
+     * Writes only values, which differ between current and baseline instance, e.g. last published one.
+     * Lists are written whole, so the output is a valid JSON Merge Patch, see apply_patch.
+     *
+     * @param root JSON root object, untouched when there is no difference
+     * @return true if anything was written, false otherwise
+     */
+    bool write_diff(const S &current, const S &baseline, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const
+    {
+        if ((flags & config_state_disable_write) == 0)
+        {
+            return do_write_diff(current, baseline, root, allocator);
+        }
+        return false;
+    }
+
+    /**
+     * Compares values of this state in two instances, see config_state_helper::equals.
+     */
+    bool equals(const S &a, const S &b) const
+    {
+        return do_equals(a, b);
+    }
+
+    /**
+     * Applies JSON Merge Patch (RFC 7386). Members absent in the patch are untouched, null resets value to its default,
+     * see config_state_defaults. Arrays replace whole lists, including their elements, absent members of elements are reset.
+     *
+     * @param patch JSON root of the patch
+     * @return true if value has changed, false otherwise
+     */
+    bool apply_patch(S &inst, const rapidjson::Value &patch) const
+    {
+        if ((flags & config_state_disable_read) == 0)
+        {
+            return do_apply_patch(inst, patch);
+        }
+        return false;
+    }
+
+    /**
+     * Same as apply_patch, but with patch value already resolved by pointer().
+     */
+    bool apply_patch_resolved(S &inst, const rapidjson::Value &value) const
+    {
+        if ((flags & config_state_disable_read) == 0)
+        {
+            return do_apply_patch_resolved(inst, value);
+        }
+        return false;
+    }
+
+    /**
+     * Resets value to its default, see config_state_defaults.
+     *
+     * @return true if value has changed, false otherwise
+     */
+    bool reset(S &inst) const
+    {
+        if ((flags & config_state_disable_read) == 0)
+        {
+            return do_reset(inst);
+        }
+        return false;
+    }
+
+    /**
+     * Calls change callbacks of values, which differ from previous instance, e.g. after the instance has been
+     * replaced by one built with config_state_quiet_changes.
+     */
+    void notify_changes(S &inst, const S &previous) const
+    {
+        if ((flags & config_state_disable_read) == 0)
+        {
+            do_notify_changes(inst, previous);
+        }
+    }
+
+    /**
+     * Appends consumers of streamed JSON value, starting at the root object, see config_state_reader.
+     */
+    void read_stream(S &inst, config_state_stream_consumers &out) const
+    {
+        if ((flags & config_state_disable_read) == 0)
+        {
+            do_read_stream(inst, out);
+        }
+    }
+
+    /**
+     * Same as read_stream, but starting at the value already resolved by pointer().
+     */
+    void read_stream_resolved(S &inst, config_state_stream_consumers &out) const
+    {
+        if ((flags & config_state_disable_read) == 0)
+        {
+            do_read_stream_resolved(inst, out);
+        }
+    }
+
     void write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const
     {
         if ((flags & config_state_disable_write) == 0)
@@ -53,6 +355,48 @@ struct config_state
         }
     }
 
+    /**
+     * Emits this state directly into SAX handler (e.g. rapidjson::Writer or PrettyWriter), without building a DOM.
+     * Produces the same JSON as write into an empty Document, followed by Accept.
+     *
+     * @return false if handler failed
+     */
+    template<typename Handler>
+    bool serialize(const S &inst, Handler &handler) const
+    {
+        config_state_stream_handler_of<Handler> out(handler);
+        return serialize(inst, static_cast<config_state_stream_handler &>(out));
+    }
+
+    bool serialize(const S &inst, config_state_stream_handler &out) const
+    {
+        if ((flags & config_state_disable_write) == 0)
+        {
+            return do_serialize(inst, out);
+        }
+        return out.Null(); // Nothing written into empty Document
+    }
+
+    /**
+     * Same as serialize, but emits only the value at pointer().
+     */
+    bool serialize_resolved(const S &inst, config_state_stream_handler &out) const
+    {
+        return do_serialize_resolved(inst, out);
+    }
+
+    /**
+     * Appends all states, which write into the root object, when writing this state.
+     * Used by config_state_set to merge members of nested sets, which share common prefix.
+     */
+    virtual void collect_writers(std::vector<const config_state<S> *> &out) const
+    {
+        if ((flags & config_state_disable_write) == 0)
+        {
+            out.push_back(this);
+        }
+    }
+
     esp_err_t load(S &inst, const std::unique_ptr<nvs::NVSHandle> &handle, const char *prefix = nullptr) const
     {
         if (!handle)
@@ -72,6 +416,29 @@ struct config_state
         return ESP_OK;
     }
 
+    /**
+     * Same as load, for boot, or after schema upgrade, when many values are missing. Lists the namespace once via NVS
+     * entry iterator, and then reads only keys which exist. Missing values don't reach NVS, and are not logged.
+     * Namespace must be the one the handle has been opened with.
+     *
+     * @param missing Optional, set to number of reads of keys, which don't exist
+     * @return Same as load
+     */
+    esp_err_t load_bulk(S &inst, nvs::NVSHandle &handle, const char *namespace_name, const char *partition_name = NVS_DEFAULT_PART_NAME,
+                        size_t *missing = nullptr, const char *prefix = nullptr) const
+    {
+        config_state_indexed_handle indexed(handle);
+        indexed.index(namespace_name, partition_name);
+
+        config_state_quiet_missing quiet;
+        esp_err_t err = load(inst, indexed, prefix);
+        if (missing)
+        {
+            *missing = indexed.missing();
+        }
+        return err;
+    }
+
     esp_err_t store(S &inst, const std::unique_ptr<nvs::NVSHandle> &handle, const char *prefix = nullptr) const
     {
         if (!handle)
@@ -91,345 +458,3780 @@ struct config_state
         return ESP_OK;
     }
 
-    virtual bool do_read(S &inst, const rapidjson::Value &root) const = 0;
-    virtual void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const = 0;
-
-    virtual esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const = 0;
-    virtual esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const = 0;
-};
-
-template<typename S, typename T>
-struct config_state_field : config_state<S>
-{
-    const rapidjson::Pointer ptr;
-    const std::string key;
-    T S::*const field;
-
-    explicit config_state_field(T S::*field, const char *json_ptr, const char *nvs_key = nullptr, config_state_flags flags = config_state_no_flags)
-        : config_state<S>(flags),
-          ptr(json_ptr),
-          key(nvs_key ? nvs_key : json_ptr),
-          field(field)
+    esp_err_t store_changed(const S &inst, S &persisted, const std::unique_ptr<nvs::NVSHandle> &handle, const char *prefix = nullptr) const
     {
-        assert(field);
-    }
+        if (!handle)
+        {
+            return ESP_ERR_NVS_INVALID_HANDLE;
+        }
 
-    bool do_read(S &inst, const rapidjson::Value &root) const final
-    {
-        return config_state_helper<T>::read(ptr, root, inst.*field);
+        return store_changed(inst, persisted, *handle, prefix);
     }
 
-    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    /**
+     * Same as store, but stores only values, which differ from persisted instance, e.g. a copy of the instance made
+     * after last load or store. Each successfully stored value is copied to persisted instance, so it reflects NVS
+     * content for the next call.
+     *
+     * To force store of all values, use store, and copy the instance afterwards.
+     *
+     * @param persisted Shadow of values stored in NVS
+     */
+    esp_err_t store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix = nullptr) const
     {
-        config_state_helper<T>::write(ptr, root, allocator, inst.*field);
+        if ((flags & config_state_disable_store) == 0)
+        {
+            return do_store_changed(inst, persisted, handle, prefix);
+        }
+        return ESP_OK;
     }
 
-    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    /**
+     * Same as store, but stores only as many values as given budget allows, and returns. Next call with the same
+     * cursor continues with the next value. Use it to spread a long store over several iterations of a task loop,
+     * keeping each of them short. Instance must not change between steps, otherwise reset the cursor.
+     *
+     * Unlike store, list length is stored after the elements, and stale elements are erased one by one.
+     *
+     * @param depth Nesting level of this state, 0 unless called by a parent state
+     * @return true if done, result is then in cursor.error(), false if more steps are needed
+     */
+    bool store_step(const S &inst, nvs::NVSHandle &handle, config_state_cursor &cursor, config_state_budget &budget, const char *prefix = nullptr, size_t depth = 0) const
     {
-        return config_state_helper<T>::load(key, handle, prefix, inst.*field);
-    }
+        if (cursor.done())
+        {
+            return true;
+        }
 
-    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const final
-    {
-        return config_state_helper<T>::store(key, handle, prefix, inst.*field);
+        if ((flags & config_state_disable_store) == 0 && !do_store_step(inst, handle, prefix, cursor, depth, budget))
+        {
+            return false;
+        }
+
+        if (depth == 0)
+        {
+            cursor.finish();
+        }
+        return true;
     }
-};
 
-template<typename T>
-struct config_state_value : config_state<T>
+    /**
+     * Same as load, but loads only as many values as given budget allows, see store_step.
+     * Instance must not be used until done, since it is partially loaded.
+     */
+    bool load_step(S &inst, nvs::NVSHandle &handle, config_state_cursor &cursor, config_state_budget &budget, const char *prefix = nullptr, size_t depth = 0) const
+    {
+        if (cursor.done())
+        {
+            return true;
+        }
+
+        if ((flags & config_state_disable_load) == 0 && !do_load_step(inst, handle, prefix, cursor, depth, budget))
+        {
+            return false;
+        }
+
+        if (depth == 0)
+        {
+            cursor.finish();
+        }
+        return true;
+    }
+
+    /**
+     * Erases all NVS keys of this state.
+     */
+    esp_err_t erase(nvs::NVSHandle &handle, const char *prefix = nullptr) const
+    {
+        if ((flags & config_state_disable_store) == 0)
+        {
+            return do_erase(handle, prefix);
+        }
+        return ESP_OK;
+    }
+
+    /**
+     * Whether given NVS key belongs to this state, for given instance. Keys of list elements beyond the list length
+     * don't belong to it.
+     */
+    bool owns_key(const S &inst, const char *nvs_key, const char *prefix = nullptr) const
+    {
+        if ((flags & config_state_disable_store) == 0)
+        {
+            return do_owns_key(inst, nvs_key, prefix);
+        }
+        return false;
+    }
+
+    /**
+     * Erases all keys in the namespace, which don't belong to this state, see owns_key.
+     * Namespace is listed via NVS entry iterator, so it must be the one the handle has been opened with.
+     *
+     * @return ESP_OK, or last error of erase_item
+     */
+    esp_err_t compact(const S &inst, nvs::NVSHandle &handle, const char *namespace_name, const char *partition_name = NVS_DEFAULT_PART_NAME) const
+    {
+        // Collect first, don't modify the namespace while iterating it
+        std::vector<std::string> stale;
+        config_state_nvs_list(partition_name, namespace_name, [&](const char *key) {
+            if (!owns_key(inst, key))
+            {
+                stale.emplace_back(key);
+            }
+        });
+
+        esp_err_t last_err = ESP_OK;
+        for (const auto &key : stale)
+        {
+            esp_err_t err = handle.erase_item(key.c_str());
+            if (err != ESP_OK)
+            {
+                config_state_logw("failed to erase_item %s: %d %s", key.c_str(), err, esp_err_to_name(err));
+                last_err = err;
+            }
+        }
+        return last_err;
+    }
+
+    /**
+     * Appends records of this state into a blob snapshot, see config_state_set::store_as_blob.
+     */
+    void pack(const S &inst, config_state_blob_writer &out) const
+    {
+        if ((flags & config_state_disable_store) == 0)
+        {
+            do_pack(inst, out);
+        }
+    }
+
+    /**
+     * Reads a record of a blob snapshot, see config_state_set::store_as_blob.
+     *
+     * @return true if the record belongs to this state, false otherwise
+     */
+    bool unpack(S &inst, uint32_t record_tag, config_state_blob_reader &record) const
+    {
+        if ((flags & config_state_disable_load) == 0)
+        {
+            return do_unpack(inst, record_tag, record);
+        }
+        return false;
+    }
+
+    /**
+     * Tag of the blob snapshot record of this state, or 0 if it does not have single record (e.g. config_state_set).
+     */
+    virtual uint32_t blob_tag() const
+    {
+        return 0;
+    }
+
+    /**
+     * Whether this state can be packed into a blob snapshot. Other states are stored under their own NVS keys.
+     */
+    virtual bool blob_supported() const
+    {
+        return false;
+    }
+
+    /**
+     * JSON pointer of the value this state reads, or nullptr if it does not read single value (e.g. config_state_set).
+     * States with a pointer can be read via read_resolved.
+     */
+    virtual const rapidjson::Pointer *pointer() const
+    {
+        return nullptr;
+    }
+
+    /**
+     * Heap bytes of this state, including the state itself and states it owns. Shared pool of JSON pointers is not
+     * included, see config_state_pointer_pool_footprint. Default implementation doesn't know its size.
+     */
+    virtual size_t footprint() const
+    {
+        return 0;
+    }
+
+    virtual bool do_read(S &inst, const rapidjson::Value &root) const = 0;
+    virtual bool do_read_resolved(S &inst, const rapidjson::Value &value) const
+    {
+        return false;
+    }
+
+    /**
+     * Default implementation resolves pointer() in the patch, where null on the way resets the value as well.
+     * States without pointer read the patch as a document.
+     */
+    virtual bool do_apply_patch(S &inst, const rapidjson::Value &patch) const
+    {
+        const rapidjson::Pointer *ptr = pointer();
+        if (!ptr)
+        {
+            return patch.IsNull() ? do_reset(inst) : do_read(inst, patch);
+        }
+
+        const rapidjson::Value *value = &patch;
+        for (size_t i = 0; i < ptr->GetTokenCount() && !value->IsNull(); i++)
+        {
+            const auto &token = ptr->GetTokens()[i];
+            if (value->IsObject())
+            {
+                auto member = value->FindMember(rapidjson::Value(rapidjson::StringRef(token.name, token.length)));
+                if (member == value->MemberEnd())
+                {
+                    return false; // Absent, untouched
+                }
+                value = &member->value;
+            }
+            else if (value->IsArray() && token.index < value->Size())
+            {
+                value = &(*value)[token.index];
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return do_apply_patch_resolved(inst, *value);
+    }
+    virtual bool do_apply_patch_resolved(S &inst, const rapidjson::Value &value) const
+    {
+        return value.IsNull() ? do_reset(inst) : do_read_resolved(inst, value);
+    }
+
+    /**
+     * Default implementation doesn't know its value, so it is always considered different.
+     */
+    virtual bool do_equals(const S &a, const S &b) const
+    {
+        return false;
+    }
+    virtual bool do_write_diff(const S &current, const S &baseline, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const
+    {
+        if (do_equals(current, baseline))
+        {
+            return false;
+        }
+
+        do_write(current, root, allocator);
+        return true;
+    }
+
+    /**
+     * Default implementation doesn't know its value, so it can't reset it.
+     */
+    virtual bool do_reset(S &inst) const
+    {
+        return false;
+    }
+
+    /**
+     * Default implementation has no callbacks.
+     */
+    virtual void do_notify_changes(S &inst, const S &previous) const
+    {
+    }
+
+    virtual void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const = 0;
+
+    virtual esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const = 0;
+    virtual esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const = 0;
+
+    /**
+     * Default implementation doesn't know its keys, so it neither erases nor owns any.
+     */
+    virtual esp_err_t do_erase(nvs::NVSHandle &handle, const char *prefix) const
+    {
+        return ESP_OK;
+    }
+
+    virtual bool do_owns_key(const S &inst, const char *nvs_key, const char *prefix) const
+    {
+        return false;
+    }
+
+    virtual void do_pack(const S &inst, config_state_blob_writer &out) const
+    {
+    }
+
+    virtual bool do_unpack(S &inst, uint32_t record_tag, config_state_blob_reader &record) const
+    {
+        return false;
+    }
+
+    /**
+     * Default implementation can't compare values, so it always stores them all.
+     */
+    virtual esp_err_t do_store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix) const
+    {
+        return do_store(inst, handle, prefix);
+    }
+
+    /**
+     * Default implementation loads or stores whole state as single operation.
+     *
+     * @return true if done, false if budget was exhausted first
+     */
+    virtual bool do_load_step(S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const
+    {
+        if (budget.exhausted())
+        {
+            return false;
+        }
+        cursor.merge(do_load(inst, handle, prefix));
+        budget.consume();
+        return true;
+    }
+
+    virtual bool do_store_step(const S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const
+    {
+        if (budget.exhausted())
+        {
+            return false;
+        }
+        cursor.merge(do_store(inst, handle, prefix));
+        budget.consume();
+        return true;
+    }
+
+    /**
+     * Default serialization follows pointer() token by token, same as rapidjson::Pointer::Create, and then emits
+     * resolved value. States without a pointer are written into a temporary Document.
+     */
+    virtual bool do_serialize(const S &inst, config_state_stream_handler &out) const
+    {
+        const rapidjson::Pointer *ptr = pointer();
+        if (!ptr || !ptr->IsValid())
+        {
+            rapidjson::Document doc;
+            do_write(inst, doc, doc.GetAllocator());
+            return doc.Accept(out);
+        }
+        return serialize_path(inst, *ptr, 0, out);
+    }
+
+    virtual bool do_serialize_resolved(const S &inst, config_state_stream_handler &out) const
+    {
+        rapidjson::Document doc;
+        do_write(inst, doc, doc.GetAllocator());
+
+        const rapidjson::Pointer *ptr = pointer();
+        const rapidjson::Value *value = ptr ? ptr->Get(doc) : &doc;
+        return value ? value->Accept(out) : out.Null();
+    }
+
+    /**
+     * Default streaming read follows pointer() token by token, and then reads resolved value the same way as
+     * read_resolved. States without a pointer get the whole root value, as DOM.
+     */
+    virtual void do_read_stream(S &inst, config_state_stream_consumers &out) const
+    {
+        const rapidjson::Pointer *ptr = pointer();
+        if (!ptr || !ptr->IsValid())
+        {
+            out.push_back({this, &inst, nullptr, stream_root});
+        }
+        else if (ptr->GetTokenCount() == 0)
+        {
+            do_read_stream_resolved(inst, out);
+        }
+        else
+        {
+            out.push_back({&config_state_path_target<S>::instance(), &inst, this, 0});
+        }
+    }
+
+    virtual void do_read_stream_resolved(S &inst, config_state_stream_consumers &out) const
+    {
+        out.push_back({this, &inst, nullptr, stream_resolved});
+    }
+
+    config_state_stream_mode stream_begin(config_state_stream_consumer &consumer, bool array) const override
+    {
+        return config_state_stream_capture;
+    }
+
+    bool stream_scalar(const config_state_stream_consumer &consumer, const rapidjson::Value &value) const override
+    {
+        return stream_captured(consumer, value);
+    }
+
+    bool stream_captured(const config_state_stream_consumer &consumer, const rapidjson::Value &value) const override
+    {
+        S &inst = *static_cast<S *>(consumer.inst);
+        return consumer.data == stream_resolved ? do_read_resolved(inst, value) : do_read(inst, value);
+    }
+
+ private:
+    static constexpr size_t stream_root = 0;
+    static constexpr size_t stream_resolved = 1;
+
+    bool serialize_path(const S &inst, const rapidjson::Pointer &ptr, size_t i, config_state_stream_handler &out) const
+    {
+        if (i == ptr.GetTokenCount())
+        {
+            return do_serialize_resolved(inst, out);
+        }
+
+        const auto &token = ptr.GetTokens()[i];
+        if (token.index == rapidjson::kPointerInvalidIndex)
+        {
+            return out.StartObject()
+                   && out.Key(token.name, token.length, false)
+                   && serialize_path(inst, ptr, i + 1, out)
+                   && out.EndObject(1);
+        }
+
+        // Numeric token creates an array, padded with nulls
+        if (!out.StartArray())
+        {
+            return false;
+        }
+        for (rapidjson::SizeType n = 0; n < token.index; n++)
+        {
+            if (!out.Null())
+            {
+                return false;
+            }
+        }
+        return serialize_path(inst, ptr, i + 1, out) && out.EndArray(token.index + 1);
+    }
+};
+
+/**
+ * Follows pointer() of a state in streamed JSON, see config_state::do_read_stream.
+ */
+template<typename S>
+struct config_state_path_target : config_state_stream_target
 {
-    const rapidjson::Pointer ptr;
-    const std::string key;
+    static const config_state_path_target &instance()
+    {
+        static const config_state_path_target target;
+        return target;
+    }
 
-    explicit config_state_value(config_state_flags flags = config_state_no_flags)
-        : config_state_value("", "", flags)
+    config_state_stream_mode stream_begin(config_state_stream_consumer &consumer, bool array) const final
     {
+        return config_state_stream_members;
     }
 
-    explicit config_state_value(const char *json_ptr = "", const char *nvs_key = nullptr, config_state_flags flags = config_state_no_flags)
-        : config_state<T>(flags),
-          ptr(json_ptr),
-          key(nvs_key ? nvs_key : json_ptr)
+    void stream_member(const config_state_stream_consumer &consumer, const char *name, rapidjson::SizeType length, config_state_stream_consumers &out) const final
+    {
+        const auto &token = token_of(consumer);
+        if (token.length == length && std::equal(name, name + length, token.name))
+        {
+            next(consumer, out);
+        }
+    }
+
+    void stream_element(const config_state_stream_consumer &consumer, rapidjson::SizeType index, config_state_stream_consumers &out) const final
+    {
+        if (token_of(consumer).index == index)
+        {
+            next(consumer, out);
+        }
+    }
+
+ private:
+    static const rapidjson::Pointer::Token &token_of(const config_state_stream_consumer &consumer)
+    {
+        auto state = static_cast<const config_state<S> *>(consumer.cursor);
+        return state->pointer()->GetTokens()[consumer.data];
+    }
+
+    void next(const config_state_stream_consumer &consumer, config_state_stream_consumers &out) const
     {
+        auto state = static_cast<const config_state<S> *>(consumer.cursor);
+        if (consumer.data + 1 < state->pointer()->GetTokenCount())
+        {
+            out.push_back({this, consumer.inst, consumer.cursor, consumer.data + 1});
+        }
+        else
+        {
+            state->do_read_stream_resolved(*static_cast<S *>(consumer.inst), out);
+        }
     }
+};
+
+template<typename S, typename T>
+struct config_state_field : config_state<S>
+{
+    const rapidjson::Pointer ptr;
+    const std::string key;
+    const uint32_t tag;
+    T S::*const field;
+    const std::function<void(S &)> on_change;
+
+    /**
+     * @param on_change Optional callback, called with the instance whenever read (including streamed read) changes the value,
+     *                  for list elements it is called with the element, without its index or parent instance
+     */
+    explicit config_state_field(T S::*field, const char *json_ptr, const char *nvs_key = nullptr, config_state_flags flags = config_state_no_flags,
+                                std::function<void(S &)> on_change = nullptr)
+        : config_state<S>(flags),
+          ptr(config_state_pointer(json_ptr)),
+          key(nvs_key ? nvs_key : json_ptr),
+          tag(config_state_blob_tag(key.c_str())),
+          field(field),
+          on_change(std::move(on_change))
+    {
+        assert(field);
+    }
+
+    const rapidjson::Pointer *pointer() const final
+    {
+        return &ptr;
+    }
+
+    size_t footprint() const final
+    {
+        return sizeof(*this) + config_state_pointer_footprint(ptr) + config_state_string_footprint(key);
+    }
+
+    bool do_read(S &inst, const rapidjson::Value &root) const final
+    {
+        return notify(inst, config_state_helper<T>::read(ptr, root, inst.*field));
+    }
+
+    bool do_read_resolved(S &inst, const rapidjson::Value &value) const final
+    {
+        return notify(inst, config_state_helper<T>::read(value, inst.*field));
+    }
+
+    bool do_equals(const S &a, const S &b) const final
+    {
+        return config_state_helper<T>::equals(a.*field, b.*field);
+    }
+
+    bool do_reset(S &inst) const final
+    {
+        const T &value = config_state_defaults<S>().*field;
+        if (inst.*field == value)
+        {
+            return false;
+        }
+
+        inst.*field = value;
+        return notify(inst, true);
+    }
+
+    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        config_state_helper<T>::write(ptr, root, allocator, inst.*field);
+    }
+
+    bool do_serialize_resolved(const S &inst, config_state_stream_handler &out) const final
+    {
+        return config_state_helper<T>::serialize(out, inst.*field);
+    }
+
+    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return config_state_helper<T>::load(key, handle, prefix, inst.*field);
+    }
+
+    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return config_state_helper<T>::store(key, handle, prefix, inst.*field);
+    }
+
+    esp_err_t do_erase(nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return config_state_nvs_erase(handle, prefix, key);
+    }
+
+    bool do_owns_key(const S &inst, const char *nvs_key, const char *prefix) const final
+    {
+        return config_state_nvs_key_equals(nvs_key, prefix, key);
+    }
+
+    uint32_t blob_tag() const final
+    {
+        return tag;
+    }
+
+    bool blob_supported() const final
+    {
+        return true;
+    }
+
+    void do_pack(const S &inst, config_state_blob_writer &out) const final
+    {
+        size_t record = out.begin_record(tag);
+        config_state_helper<T>::pack(out, inst.*field);
+        out.end_record(record);
+    }
+
+    bool do_unpack(S &inst, uint32_t record_tag, config_state_blob_reader &record) const final
+    {
+        if (record_tag != tag)
+        {
+            return false;
+        }
+
+        config_state_helper<T>::unpack(record, inst.*field);
+        return true;
+    }
+
+    esp_err_t do_store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        if (config_state_helper<T>::equals(inst.*field, persisted.*field))
+        {
+            return ESP_OK;
+        }
+
+        esp_err_t err = config_state_helper<T>::store(key, handle, prefix, inst.*field);
+        if (err == ESP_OK)
+        {
+            persisted.*field = inst.*field;
+        }
+        return err;
+    }
+
+    void do_notify_changes(S &inst, const S &previous) const final
+    {
+        notify(inst, !do_equals(inst, previous));
+    }
+
+ private:
+    bool notify(S &inst, bool changed) const
+    {
+        if (changed && on_change && !config_state_quiet_changes::active())
+        {
+            on_change(inst);
+        }
+        return changed;
+    }
+};
+
+template<typename T>
+struct config_state_value : config_state<T>
+{
+    const rapidjson::Pointer ptr;
+    const std::string key;
+    const uint32_t tag;
+
+    explicit config_state_value(config_state_flags flags = config_state_no_flags)
+        : config_state_value("", "", flags)
+    {
+    }
+
+    explicit config_state_value(const char *json_ptr = "", const char *nvs_key = nullptr, config_state_flags flags = config_state_no_flags)
+        : config_state<T>(flags),
+          ptr(config_state_pointer(json_ptr)),
+          key(nvs_key ? nvs_key : json_ptr),
+          tag(config_state_blob_tag(key.c_str()))
+    {
+    }
+
+    const rapidjson::Pointer *pointer() const final
+    {
+        return &ptr;
+    }
+
+    size_t footprint() const final
+    {
+        return sizeof(*this) + config_state_pointer_footprint(ptr) + config_state_string_footprint(key);
+    }
+
+    bool do_read(T &inst, const rapidjson::Value &root) const final
+    {
+        return config_state_helper<T>::read(ptr, root, inst);
+    }
+
+    bool do_read_resolved(T &inst, const rapidjson::Value &value) const final
+    {
+        return config_state_helper<T>::read(value, inst);
+    }
+
+    bool do_equals(const T &a, const T &b) const final
+    {
+        return config_state_helper<T>::equals(a, b);
+    }
+
+    bool do_reset(T &inst) const final
+    {
+        const T &value = config_state_defaults<T>();
+        if (inst == value)
+        {
+            return false;
+        }
+
+        inst = value;
+        return true;
+    }
+
+    void do_write(const T &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        config_state_helper<T>::write(ptr, root, allocator, inst);
+    }
+
+    bool do_serialize_resolved(const T &inst, config_state_stream_handler &out) const final
+    {
+        return config_state_helper<T>::serialize(out, inst);
+    }
+
+    esp_err_t do_load(T &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return config_state_helper<T>::load(key, handle, prefix, inst);
+    }
+
+    esp_err_t do_store(const T &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return config_state_helper<T>::store(key, handle, prefix, inst);
+    }
+
+    esp_err_t do_erase(nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return config_state_nvs_erase(handle, prefix, key);
+    }
+
+    bool do_owns_key(const T &inst, const char *nvs_key, const char *prefix) const final
+    {
+        return config_state_nvs_key_equals(nvs_key, prefix, key);
+    }
+
+    uint32_t blob_tag() const final
+    {
+        return tag;
+    }
+
+    bool blob_supported() const final
+    {
+        return true;
+    }
+
+    void do_pack(const T &inst, config_state_blob_writer &out) const final
+    {
+        size_t record = out.begin_record(tag);
+        config_state_helper<T>::pack(out, inst);
+        out.end_record(record);
+    }
+
+    bool do_unpack(T &inst, uint32_t record_tag, config_state_blob_reader &record) const final
+    {
+        if (record_tag != tag)
+        {
+            return false;
+        }
+
+        config_state_helper<T>::unpack(record, inst);
+        return true;
+    }
+
+    esp_err_t do_store_changed(const T &inst, T &persisted, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        if (config_state_helper<T>::equals(inst, persisted))
+        {
+            return ESP_OK;
+        }
+
+        esp_err_t err = config_state_helper<T>::store(key, handle, prefix, inst);
+        if (err == ESP_OK)
+        {
+            persisted = inst;
+        }
+        return err;
+    }
+};
+
+template<typename S, typename T>
+struct config_state_list : config_state<S>
+{
+    const rapidjson::Pointer ptr;
+    const std::string key;
+    const uint32_t tag;
+    std::vector<T> S::*const field;
+    const std::unique_ptr<const config_state<T>> element;
+    const config_state_list_keys keys;
+
+    config_state_list(std::vector<T> S::*field, const char *json_ptr, const config_state<T> *element, config_state_flags flags = config_state_no_flags)
+        : config_state_list(field, json_ptr, nullptr, element, flags)
+    {
+    }
+
+    config_state_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, const config_state<T> *element, config_state_flags flags = config_state_no_flags)
+        : config_state<S>(flags),
+          ptr(config_state_pointer(json_ptr)),
+          key(nvs_key ? nvs_key : json_ptr),
+          tag(config_state_blob_tag(key.c_str())),
+          field(field),
+          element(element),
+          keys(key, CONFIG_STATE_LIST_KEY_CAPACITY)
+    {
+        assert(field);
+        assert(element);
+    }
+
+    const rapidjson::Pointer *pointer() const final
+    {
+        return &ptr;
+    }
+
+    size_t footprint() const override
+    {
+        return sizeof(*this) + config_state_pointer_footprint(ptr) + config_state_string_footprint(key) + keys.size() + element->footprint();
+    }
+
+    bool do_read(S &inst, const rapidjson::Value &root) const final
+    {
+        const rapidjson::Value *list = ptr.Get(root);
+        return list && do_read_resolved(inst, *list);
+    }
+
+    bool do_read_resolved(S &inst, const rapidjson::Value &list) const override
+    {
+        if (!list.IsArray())
+        {
+            return false;
+        }
+
+        auto &items = inst.*field;
+
+        // Resize
+        auto array = list.GetArray();
+        size_t length = array.Size();
+
+        items.resize(length);
+
+        // Get each
+        bool changed = false;
+        for (size_t i = 0; i < length; i++)
+        {
+            changed |= element->read(items[i], array[i]);
+        }
+        return changed;
+    }
+
+    bool do_apply_patch_resolved(S &inst, const rapidjson::Value &list) const override
+    {
+        if (list.IsNull())
+        {
+            return do_reset(inst);
+        }
+        if (!list.IsArray())
+        {
+            return false;
+        }
+
+        auto &items = inst.*field;
+
+        // Array replaces the list wholesale, including its length and every element (RFC 7386)
+        auto array = list.GetArray();
+        size_t length = array.Size();
+
+        bool changed = items.size() != length;
+        items.resize(length);
+
+        for (size_t i = 0; i < length; i++)
+        {
+            changed |= replace_element(items[i], array[i]);
+        }
+        return changed;
+    }
+
+    bool do_equals(const S &a, const S &b) const override
+    {
+        const auto &a_items = a.*field;
+        const auto &b_items = b.*field;
+        if (a_items.size() != b_items.size())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < a_items.size(); i++)
+        {
+            if (!element->equals(a_items[i], b_items[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool do_reset(S &inst) const final
+    {
+        const S &defaults = config_state_defaults<S>();
+        if (do_equals(inst, defaults))
+        {
+            return false;
+        }
+
+        inst.*field = defaults.*field;
+        return true;
+    }
+
+    /**
+     * Elements are compared by index, new elements with defaults, same as they are read.
+     */
+    void do_notify_changes(S &inst, const S &previous) const final
+    {
+        auto &items = inst.*field;
+        const auto &previous_items = previous.*field;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            element->notify_changes(items[i], i < previous_items.size() ? previous_items[i] : config_state_defaults<T>());
+        }
+    }
+
+    void do_read_stream_resolved(S &inst, config_state_stream_consumers &out) const override
+    {
+        out.push_back({this, &inst, nullptr, 0});
+    }
+
+    config_state_stream_mode stream_begin(config_state_stream_consumer &consumer, bool array) const override
+    {
+        return array ? config_state_stream_members : config_state_stream_ignore;
+    }
+
+    bool stream_scalar(const config_state_stream_consumer &consumer, const rapidjson::Value &value) const final
+    {
+        return false;
+    }
+
+    void stream_element(const config_state_stream_consumer &consumer, rapidjson::SizeType index, config_state_stream_consumers &out) const final
+    {
+        auto &items = static_cast<S *>(consumer.inst)->*field;
+
+        // Length is not known in advance, grow as elements arrive
+        if (index >= items.size())
+        {
+            items.resize(index + 1);
+        }
+        element->read_stream(items[index], out);
+    }
+
+    bool stream_end(const config_state_stream_consumer &consumer, rapidjson::SizeType count) const final
+    {
+        // Same as do_read, resize itself is not considered a change
+        (static_cast<S *>(consumer.inst)->*field).resize(count);
+        return false;
+    }
+
+    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const override
+    {
+        auto &array = ptr.Create(root, allocator);
+        if (!array.IsArray())
+        {
+            array.SetArray();
+        }
+
+        auto &items = inst.*field;
+        size_t len = items.size();
+
+        // Resize array
+        array.Reserve(len, allocator);
+
+        while (array.Size() < len)
+        {
+            array.PushBack(rapidjson::Value(), allocator);
+        }
+        while (array.Size() > len)
+        {
+            array.PopBack();
+        }
+
+        // Set each
+        for (size_t i = 0; i < len; i++)
+        {
+            element->write(items[i], array[i], allocator);
+        }
+    }
+
+    bool do_serialize_resolved(const S &inst, config_state_stream_handler &out) const override
+    {
+        auto &items = inst.*field;
+        if (!out.StartArray())
+        {
+            return false;
+        }
+
+        // Each element is written as a root of its own
+        for (const auto &item : items)
+        {
+            if (!element->serialize(item, out))
+            {
+                return false;
+            }
+        }
+        return out.EndArray(static_cast<rapidjson::SizeType>(items.size()));
+    }
+
+    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const override
+    {
+        char item_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        auto &items = inst.*field;
+
+        // Read length
+        const char *len_nvs_key = len_key(item_prefix, prefix);
+        uint16_t length = 0;
+        handle.get_item(len_nvs_key, length); // Ignore error
+
+        // Resize
+        items.resize(length);
+
+        // Read items
+        esp_err_t last_err = ESP_OK;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            const char *item_nvs_key = item_key(item_prefix, prefix, i);
+            esp_err_t err = element->load(items[i], handle, item_nvs_key);
+            if (err != ESP_OK && (err != ESP_ERR_NVS_NOT_FOUND || last_err == ESP_OK)) // Don't overwrite more important error with NOT_FOUND
+            {
+                last_err = err;
+            }
+        }
+        return last_err;
+    }
+
+    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const override
+    {
+        char item_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        auto &items = inst.*field;
+
+        // Store length, previous one is needed to erase elements, which are no longer part of the list
+        const char *len_nvs_key = len_key(item_prefix, prefix);
+        uint16_t stored_length = 0;
+        handle.get_item(len_nvs_key, stored_length); // Ignore error
+        handle.set_item(len_nvs_key, static_cast<uint16_t>(items.size())); // No need to store all 32 bytes, that would never fit in memory
+
+        // Store items
+        esp_err_t last_err = ESP_OK;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            const char *item_nvs_key = item_key(item_prefix, prefix, i);
+            esp_err_t err = element->store(items[i], handle, item_nvs_key);
+            if (err != ESP_OK)
+            {
+                last_err = err;
+            }
+        }
+
+        erase_items(handle, prefix, items.size(), stored_length);
+        return last_err;
+    }
+
+    bool do_load_step(S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const override
+    {
+        char item_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        auto &items = inst.*field;
+
+        // Position 0 is the length, positions 1..n are elements
+        if (cursor.position(depth) == 0)
+        {
+            if (budget.exhausted())
+            {
+                return false;
+            }
+
+            const char *len_nvs_key = len_key(item_prefix, prefix);
+            uint16_t length = 0;
+            handle.get_item(len_nvs_key, length); // Ignore error
+            items.resize(length);
+            budget.consume();
+            cursor.advance(depth);
+        }
+
+        for (size_t i = cursor.position(depth); i <= items.size(); i = cursor.advance(depth))
+        {
+            const char *item_nvs_key = item_key(item_prefix, prefix, i - 1);
+            if (!element->load_step(items[i - 1], handle, cursor, budget, item_nvs_key, depth + 1))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool do_store_step(const S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const override
+    {
+        char item_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        auto &items = inst.*field;
+
+        // Positions 0..n-1 are elements
+        for (size_t i = cursor.position(depth); i < items.size(); i = cursor.advance(depth))
+        {
+            const char *item_nvs_key = item_key(item_prefix, prefix, i);
+            if (!element->store_step(items[i], handle, cursor, budget, item_nvs_key, depth + 1))
+            {
+                return false;
+            }
+        }
+
+        // Stale elements are erased one per operation, previous length is kept until they are all gone
+        const char *len_nvs_key = len_key(item_prefix, prefix);
+        uint16_t stored_length = 0;
+        handle.get_item(len_nvs_key, stored_length); // Ignore error
+
+        for (size_t i = items.size() + cursor.position(depth + 1); i < stored_length; i = items.size() + cursor.advance(depth + 1))
+        {
+            if (budget.exhausted())
+            {
+                return false;
+            }
+            cursor.merge(erase_items(handle, prefix, i, i + 1));
+            budget.consume();
+        }
+
+        if (budget.exhausted())
+        {
+            return false;
+        }
+        cursor.merge(handle.set_item(len_nvs_key, static_cast<uint16_t>(items.size())));
+        budget.consume();
+        return true;
+    }
+
+    esp_err_t do_erase(nvs::NVSHandle &handle, const char *prefix) const override
+    {
+        char item_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        const char *len_nvs_key = len_key(item_prefix, prefix);
+        uint16_t length = 0;
+        handle.get_item(len_nvs_key, length); // Ignore error
+
+        esp_err_t last_err = erase_items(handle, prefix, 0, length);
+        esp_err_t err = config_state_nvs_erase(handle, len_nvs_key);
+        return err != ESP_OK ? err : last_err;
+    }
+
+    bool do_owns_key(const S &inst, const char *nvs_key, const char *prefix) const override
+    {
+        char item_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        // Keys are "key/len" and "key/<index>..."
+        std::snprintf(item_prefix, sizeof(item_prefix) - 1, "%s%s/", prefix, key.c_str());
+        const char *base = config_state_nvs_key(item_prefix);
+        size_t base_length = std::strlen(base);
+        if (std::strncmp(nvs_key, base, base_length) != 0)
+        {
+            return false;
+        }
+
+        const char *rest = nvs_key + base_length;
+        if (std::strcmp(rest, "len") == 0)
+        {
+            return true;
+        }
+
+        char *end = nullptr;
+        unsigned long index = std::strtoul(rest, &end, 10);
+        auto &items = inst.*field;
+        if (end == rest || index >= items.size())
+        {
+            return false;
+        }
+
+        const char *item_nvs_key = item_key(item_prefix, prefix, index);
+        return element->owns_key(items[index], nvs_key, item_nvs_key);
+    }
+
+    uint32_t blob_tag() const final
+    {
+        return tag;
+    }
+
+    bool blob_supported() const final
+    {
+        return element->blob_supported();
+    }
+
+    void do_pack(const S &inst, config_state_blob_writer &out) const final
+    {
+        auto &items = inst.*field;
+
+        size_t record = out.begin_record(tag);
+        out.put_value(static_cast<uint32_t>(items.size()));
+
+        // Each element is a record tagged by its index, containing records of the element itself
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            size_t item_record = out.begin_record(static_cast<uint32_t>(i));
+            element->pack(items[i], out);
+            out.end_record(item_record);
+        }
+        out.end_record(record);
+    }
+
+    bool do_unpack(S &inst, uint32_t record_tag, config_state_blob_reader &record) const final
+    {
+        if (record_tag != tag)
+        {
+            return false;
+        }
+
+        // Each element needs at least its record header, don't trust malformed length
+        uint32_t length = 0;
+        if (!record.get_value(length) || length > record.remaining() / (2 * sizeof(uint32_t)))
+        {
+            return true;
+        }
+
+        auto &items = inst.*field;
+        items.resize(length);
+
+        uint32_t index = 0;
+        config_state_blob_reader item;
+        while (record.next_record(index, item))
+        {
+            if (index < length)
+            {
+                uint32_t item_tag = 0;
+                config_state_blob_reader item_record;
+                while (item.next_record(item_tag, item_record))
+                {
+                    element->unpack(items[index], item_tag, item_record);
+                }
+            }
+        }
+        return true;
+    }
+
+    esp_err_t do_store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix) const override
+    {
+        char item_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        auto &items = inst.*field;
+        auto &persisted_items = persisted.*field;
+        size_t persisted_len = persisted_items.size();
+
+        // Store length, only if changed
+        esp_err_t last_err = ESP_OK;
+        if (items.size() != persisted_len)
+        {
+            const char *len_nvs_key = len_key(item_prefix, prefix);
+            last_err = handle.set_item(len_nvs_key, static_cast<uint16_t>(items.size()));
+        }
+        bool len_stored = last_err == ESP_OK;
+
+        // Store changed items, new ones are stored whole, since NVS might contain anything under their keys
+        size_t stored_len = items.size();
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            const char *item_nvs_key = item_key(item_prefix, prefix, i);
+
+            esp_err_t err = i < persisted_len
+                                ? element->store_changed(items[i], persisted_items[i], handle, item_nvs_key)
+                                : element->store(items[i], handle, item_nvs_key);
+            if (err != ESP_OK)
+            {
+                last_err = err;
+                if (i >= persisted_len)
+                {
+                    stored_len = std::min(stored_len, i);
+                }
+            }
+        }
+
+        // Persisted length must match stored length, otherwise it is stored again next time
+        if (len_stored && items.size() < persisted_len)
+        {
+            erase_items(handle, prefix, items.size(), persisted_len);
+            persisted_items.resize(items.size());
+        }
+        else if (len_stored && stored_len > persisted_len)
+        {
+            persisted_items.insert(persisted_items.end(), items.begin() + persisted_len, items.begin() + stored_len);
+        }
+        return last_err;
+    }
+ protected:
+    /**
+     * Replaces element by given value, members absent in the value are reset to their defaults, not merged.
+     * Replacement is built aside, so callbacks are called only for members, which really change.
+     *
+     * @return true if element has changed, false otherwise
+     */
+    bool replace_element(T &item, const rapidjson::Value &value) const
+    {
+        T replacement = item;
+        {
+            config_state_quiet_changes quiet;
+            element->reset(replacement);
+            element->read(replacement, value);
+        }
+        if (element->equals(replacement, item))
+        {
+            return false;
+        }
+
+        std::swap(item, replacement);
+        element->notify_changes(item, replacement);
+        return true;
+    }
+
+    /**
+     * Erases keys of elements from begin to end, e.g. those beyond new length of the list.
+     */
+    esp_err_t erase_items(nvs::NVSHandle &handle, const char *prefix, size_t begin, size_t end) const
+    {
+        char item_prefix[16] = {};
+
+        esp_err_t last_err = ESP_OK;
+        for (size_t i = begin; i < end; i++)
+        {
+            const char *item_nvs_key = item_key(item_prefix, prefix, i);
+            esp_err_t err = element->erase(handle, item_nvs_key);
+            if (err != ESP_OK)
+            {
+                last_err = err;
+            }
+        }
+        return last_err;
+    }
+
+    /**
+     * NVS key of the list length, interned when there is no prefix, otherwise composed in given buffer.
+     */
+    const char *len_key(char (&buffer)[16], const char *prefix) const
+    {
+        const char *interned = prefix[0] == '\0' ? keys.len() : nullptr;
+        if (interned)
+        {
+            return interned;
+        }
+
+        std::snprintf(buffer, sizeof(buffer) - 1, "%s%s/len", prefix, key.c_str());
+        return config_state_nvs_key(buffer);
+    }
+
+    /**
+     * NVS key prefix of given element, interned when there is no prefix, otherwise composed in given buffer.
+     */
+    const char *item_key(char (&buffer)[16], const char *prefix, size_t index) const
+    {
+        const char *interned = prefix[0] == '\0' ? keys.item(index) : nullptr;
+        if (interned)
+        {
+            return interned;
+        }
+
+        std::snprintf(buffer, sizeof(buffer) - 1, "%s%s/%zu", prefix, key.c_str(), index);
+        return config_state_nvs_key(buffer);
+    }
+};
+
+/**
+ * List of arithmetic values, e.g. filter coefficients or lookup tables, see config_state_set::add_value_list.
+ * Same as config_state_list with config_state_value elements, but whole array is converted in a single loop, instead
+ * of a virtual call per element.
+ *
+ * Types are checked first, and range of narrow types, which are read as int or unsigned, is checked once for the
+ * whole array. Arrays with any invalid element are read element by element, with the same result as
+ * config_state_list.
+ */
+template<typename S, typename T>
+struct config_state_numeric_list : config_state_list<S, T>
+{
+    static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value, "only arithmetic values have numeric lists");
+
+    /**
+     * Type of JSON value, same as config_state_helper reads, int or unsigned for narrow integers.
+     */
+    using json_type = typename std::conditional<std::is_integral<T>::value && sizeof(T) < sizeof(int),
+                                                typename std::conditional<std::is_signed<T>::value, int, unsigned>::type, T>::type;
+
+    config_state_numeric_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, const config_state<T> *element, config_state_flags flags = config_state_no_flags)
+        : config_state_list<S, T>(field, json_ptr, nvs_key, element, flags)
+    {
+    }
+
+    bool do_read_resolved(S &inst, const rapidjson::Value &list) const final
+    {
+        if (!list.IsArray() || (this->element->flags & config_state_disable_read) != 0)
+        {
+            return config_state_list<S, T>::do_read_resolved(inst, list);
+        }
+
+        auto &items = inst.*(this->field);
+        items.resize(list.Size());
+
+        bool changed = false;
+        if (read_values(list, items, changed))
+        {
+            return changed;
+        }
+        return config_state_list<S, T>::do_read_resolved(inst, list); // Some element is invalid, read one by one
+    }
+
+    bool do_apply_patch_resolved(S &inst, const rapidjson::Value &list) const final
+    {
+        if (!list.IsArray() || (this->element->flags & config_state_disable_read) != 0)
+        {
+            return config_state_list<S, T>::do_apply_patch_resolved(inst, list);
+        }
+
+        // Array replaces the list, including its length
+        auto &items = inst.*(this->field);
+        bool changed = items.size() != list.Size();
+        items.resize(list.Size());
+
+        if (read_values(list, items, changed))
+        {
+            return changed;
+        }
+        return config_state_list<S, T>::do_apply_patch_resolved(inst, list) || changed;
+    }
+
+    bool do_equals(const S &a, const S &b) const final
+    {
+        return a.*(this->field) == b.*(this->field);
+    }
+
+    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        if ((this->element->flags & config_state_disable_write) != 0)
+        {
+            config_state_list<S, T>::do_write(inst, root, allocator);
+            return;
+        }
+
+        auto &array = this->ptr.Create(root, allocator);
+        if (array.IsArray())
+        {
+            array.Clear();
+        }
+        else
+        {
+            array.SetArray();
+        }
+
+        // Values are appended directly, without null placeholders
+        auto &items = inst.*(this->field);
+        array.Reserve(static_cast<rapidjson::SizeType>(items.size()), allocator);
+        for (T item : items)
+        {
+            array.PushBack(rapidjson::Value(static_cast<json_type>(item)), allocator);
+        }
+    }
+
+    bool do_serialize_resolved(const S &inst, config_state_stream_handler &out) const final
+    {
+        if ((this->element->flags & config_state_disable_write) != 0)
+        {
+            return config_state_list<S, T>::do_serialize_resolved(inst, out);
+        }
+
+        auto &items = inst.*(this->field);
+        if (!out.StartArray())
+        {
+            return false;
+        }
+
+        // Same events as config_state_helper::serialize, without a virtual call per element
+        for (T item : items)
+        {
+            if (!rapidjson::Value(static_cast<json_type>(item)).Accept(out))
+            {
+                return false;
+            }
+        }
+        return out.EndArray(static_cast<rapidjson::SizeType>(items.size()));
+    }
+
+ private:
+    /**
+     * Converts whole array, already resized items must have the same length.
+     *
+     * @return false if any element is invalid, items are then untouched
+     */
+    static bool read_values(const rapidjson::Value &list, std::vector<T> &items, bool &changed)
+    {
+        const rapidjson::Value *values = list.Begin();
+        size_t length = items.size();
+
+        // Check types, without branching on each of them
+        bool valid = true;
+        for (size_t i = 0; i < length; i++)
+        {
+            valid &= values[i].template Is<json_type>();
+        }
+        if (!valid)
+        {
+            return false;
+        }
+
+        // Check range once, for types narrower than their JSON type
+        if (!std::is_same<json_type, T>::value && length > 0)
+        {
+            json_type low = values[0].template Get<json_type>();
+            json_type high = low;
+            for (size_t i = 1; i < length; i++)
+            {
+                json_type value = values[i].template Get<json_type>();
+                low = std::min(low, value);
+                high = std::max(high, value);
+            }
+            if (low < static_cast<json_type>(std::numeric_limits<T>::lowest()) || high > static_cast<json_type>(std::numeric_limits<T>::max()))
+            {
+                return false;
+            }
+        }
+
+        // Convert and compare
+        T *data = items.data();
+        bool different = false;
+        for (size_t i = 0; i < length; i++)
+        {
+            T value = static_cast<T>(values[i].template Get<json_type>());
+            different |= data[i] != value;
+            data[i] = value;
+        }
+        changed |= different;
+        return true;
+    }
+};
+
+/**
+ * List of values, config_state_numeric_list for arithmetic types, otherwise config_state_list.
+ */
+template<typename S, typename T>
+using config_state_value_list = typename std::conditional<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value,
+                                                          config_state_numeric_list<S, T>, config_state_list<S, T>>::type;
+
+/**
+ * List of arithmetic or enum values, stored as a single NVS blob with raw little-endian values, instead of one NVS
+ * entry per element. Element count is given by the blob size.
+ *
+ * Lists longer than CONFIG_STATE_PACKED_CHUNK_SIZE bytes are split into chunks, stored under keys "key", "key/1",
+ * "key/2" and so on. Every chunk except the last one is full.
+ */
+template<typename S, typename T>
+struct config_state_packed_list : config_state_value_list<S, T>
+{
+    static_assert((std::is_arithmetic<T>::value || std::is_enum<T>::value) && !std::is_same<T, bool>::value, "only arithmetic and enum values can be packed");
+
+    static constexpr size_t chunk_length = CONFIG_STATE_PACKED_CHUNK_SIZE / sizeof(T);
+
+    explicit config_state_packed_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key = nullptr, config_state_flags flags = config_state_no_flags)
+        : config_state_value_list<S, T>(field, json_ptr, nvs_key, new config_state_value<T>(), flags)
+    {
+    }
+
+    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        char chunk_key[16] = {};
+        if (!prefix) prefix = "";
+
+        // Read chunks, until the last one, which is not full
+        std::vector<T> items;
+        esp_err_t err = ESP_OK;
+        for (size_t chunk = 0;; chunk++)
+        {
+            format_chunk_key(chunk_key, sizeof(chunk_key), prefix, chunk);
+
+            size_t size = 0;
+            err = handle.get_item_size(nvs::ItemType::BLOB, config_state_nvs_key(chunk_key), size);
+            if (err != ESP_OK)
+            {
+                break;
+            }
+            if (size % sizeof(T) != 0 || size > chunk_length * sizeof(T))
+            {
+                err = ESP_ERR_NVS_INVALID_LENGTH; // Element type has changed
+                break;
+            }
+
+            size_t offset = items.size();
+            items.resize(offset + size / sizeof(T));
+            err = handle.get_blob(config_state_nvs_key(chunk_key), items.data() + offset, size);
+            if (err != ESP_OK || size < chunk_length * sizeof(T))
+            {
+                break;
+            }
+        }
+
+        // Missing chunk means end of the list, same as regular list with missing length
+        if (err == ESP_ERR_NVS_NOT_FOUND)
+        {
+            err = ESP_OK;
+        }
+
+        if (err == ESP_OK)
+        {
+            (inst.*(this->field)).swap(items);
+        }
+        else
+        {
+            config_state_logw("failed to get_blob %s: %d %s", chunk_key, err, esp_err_to_name(err));
+        }
+        return err;
+    }
+
+    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        char chunk_key[16] = {};
+        if (!prefix) prefix = "";
+
+        auto &items = inst.*(this->field);
+        size_t chunks = (items.size() + chunk_length - 1) / chunk_length;
+
+        // Store chunks, empty list has none
+        esp_err_t last_err = ESP_OK;
+        for (size_t chunk = 0; chunk < chunks; chunk++)
+        {
+            format_chunk_key(chunk_key, sizeof(chunk_key), prefix, chunk);
+
+            size_t offset = chunk * chunk_length;
+            size_t length = items.size() - offset;
+            if (length > chunk_length)
+            {
+                length = chunk_length;
+            }
+            esp_err_t err = handle.set_blob(config_state_nvs_key(chunk_key), items.data() + offset, length * sizeof(T));
+            if (err != ESP_OK)
+            {
+                config_state_logw("failed to set_blob %s: %d %s", chunk_key, err, esp_err_to_name(err));
+                last_err = err;
+            }
+        }
+
+        // Chunks following the last one must not exist, they would be loaded after a full one
+        esp_err_t err = erase_chunks(handle, prefix, chunks);
+        return err != ESP_OK ? err : last_err;
+    }
+
+    /**
+     * Whole list is single operation, same as a value.
+     */
+    bool do_load_step(S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const final
+    {
+        return config_state<S>::do_load_step(inst, handle, prefix, cursor, depth, budget);
+    }
+
+    bool do_store_step(const S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const final
+    {
+        return config_state<S>::do_store_step(inst, handle, prefix, cursor, depth, budget);
+    }
+
+    esp_err_t do_erase(nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return erase_chunks(handle, prefix ? prefix : "", 0);
+    }
+
+    bool do_owns_key(const S &inst, const char *nvs_key, const char *prefix) const final
+    {
+        char chunk_key[16] = {};
+        if (!prefix) prefix = "";
+
+        size_t chunks = ((inst.*(this->field)).size() + chunk_length - 1) / chunk_length;
+        for (size_t chunk = 0; chunk < chunks; chunk++)
+        {
+            format_chunk_key(chunk_key, sizeof(chunk_key), prefix, chunk);
+            if (std::strcmp(config_state_nvs_key(chunk_key), nvs_key) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    esp_err_t do_store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        if (inst.*(this->field) == persisted.*(this->field))
+        {
+            return ESP_OK;
+        }
+
+        esp_err_t err = do_store(inst, handle, prefix);
+        if (err == ESP_OK)
+        {
+            persisted.*(this->field) = inst.*(this->field);
+        }
+        return err;
+    }
+
+ private:
+    /**
+     * Erases chunks from given one until the first missing chunk, same as load reads them.
+     */
+    esp_err_t erase_chunks(nvs::NVSHandle &handle, const char *prefix, size_t first) const
+    {
+        char chunk_key[16] = {};
+        for (size_t chunk = first;; chunk++)
+        {
+            format_chunk_key(chunk_key, sizeof(chunk_key), prefix, chunk);
+            esp_err_t err = handle.erase_item(config_state_nvs_key(chunk_key));
+            if (err != ESP_OK)
+            {
+                return err != ESP_ERR_NVS_NOT_FOUND ? err : ESP_OK;
+            }
+        }
+    }
+
+    void format_chunk_key(char *out, size_t size, const char *prefix, size_t chunk) const
+    {
+        if (chunk == 0)
+        {
+            std::snprintf(out, size - 1, "%s%s", prefix, this->key.c_str());
+        }
+        else
+        {
+            std::snprintf(out, size - 1, "%s%s/%zu", prefix, this->key.c_str(), chunk);
+        }
+    }
+};
+
+/**
+ * List of objects, identified by an id member, e.g. "/id". On read, elements are matched to existing elements by
+ * their id instead of their index, and matching elements are moved into place and updated, not reconstructed. Only
+ * inserted, removed or modified elements are reported as a change, reordering alone is not.
+ *
+ * Elements without valid id are identified by default id, same as they would be after read. When ids are duplicate,
+ * the first unmatched element is used. NVS layout is the same as config_state_list, by index.
+ */
+template<typename S, typename T, typename K>
+struct config_state_keyed_list : config_state_list<S, T>
+{
+    K T::*const id;
+    const rapidjson::Pointer id_ptr;
+
+    config_state_keyed_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, K T::*id, const char *id_json_ptr, const config_state<T> *element,
+                            config_state_flags flags = config_state_no_flags)
+        : config_state_list<S, T>(field, json_ptr, nvs_key, element, flags),
+          id(id),
+          id_ptr(config_state_pointer(id_json_ptr))
+    {
+        assert(id);
+    }
+
+    size_t footprint() const final
+    {
+        return config_state_list<S, T>::footprint() - sizeof(config_state_list<S, T>) + sizeof(*this) + config_state_pointer_footprint(id_ptr);
+    }
+
+    bool do_read_resolved(S &inst, const rapidjson::Value &list) const final
+    {
+        return reconcile(inst, list, false);
+    }
+
+    bool do_apply_patch_resolved(S &inst, const rapidjson::Value &list) const final
+    {
+        if (list.IsNull())
+        {
+            return this->do_reset(inst);
+        }
+        return reconcile(inst, list, true);
+    }
+
+    void do_read_stream_resolved(S &inst, config_state_stream_consumers &out) const final
+    {
+        // Id might come last within an element, so whole array is captured and read as DOM
+        config_state<S>::do_read_stream_resolved(inst, out);
+    }
+
+    config_state_stream_mode stream_begin(config_state_stream_consumer &consumer, bool array) const final
+    {
+        return config_state_stream_capture;
+    }
+
+ private:
+    bool reconcile(S &inst, const rapidjson::Value &list, bool patch) const
+    {
+        if (!list.IsArray())
+        {
+            return false;
+        }
+
+        auto &items = inst.*(this->field);
+        auto array = list.GetArray();
+        size_t length = array.Size();
+
+        // Elements before i are already matched, the rest are candidates, in their original order
+        bool changed = false;
+        for (size_t i = 0; i < length; i++)
+        {
+            K item_id = K();
+            config_state_helper<K>::read(id_ptr, array[i], item_id); // Missing or invalid id stays default
+
+            // Unchanged order, or removal before the element, finds it right away
+            size_t j = i;
+            while (j < items.size() && !config_state_helper<K>::equals(items[j].*id, item_id))
+            {
+                j++;
+            }
+
+            if (j == items.size())
+            {
+                items.emplace(items.begin() + i);
+                changed = true;
+            }
+            else if (j != i)
+            {
+                std::rotate(items.begin() + i, items.begin() + j, items.begin() + j + 1);
+            }
+
+            changed |= patch ? this->replace_element(items[i], array[i]) : this->element->read(items[i], array[i]);
+        }
+
+        // Unmatched elements have been removed
+        if (items.size() > length)
+        {
+            items.erase(items.begin() + length, items.end());
+            changed = true;
+        }
+        return changed;
+    }
+};
+
+/**
+ * Nested object, e.g. "/mqtt", read and written by its own state relative to the object. Object is resolved once,
+ * and its members are then resolved from it, instead of from the root. NVS keys of its members are prefixed by
+ * the key of the object, e.g. "mqtt/host".
+ */
+template<typename S, typename T>
+struct config_state_object : config_state<S>
+{
+    const rapidjson::Pointer ptr;
+    const std::string key;
+    const uint32_t tag;
+    T S::*const field;
+    const std::unique_ptr<const config_state<T>> element;
+
+    config_state_object(T S::*field, const char *json_ptr, const config_state<T> *element, config_state_flags flags = config_state_no_flags)
+        : config_state_object(field, json_ptr, nullptr, element, flags)
+    {
+    }
+
+    config_state_object(T S::*field, const char *json_ptr, const char *nvs_key, const config_state<T> *element, config_state_flags flags = config_state_no_flags)
+        : config_state<S>(flags),
+          ptr(config_state_pointer(json_ptr)),
+          key(nvs_key ? nvs_key : json_ptr),
+          tag(config_state_blob_tag(key.c_str())),
+          field(field),
+          element(element)
+    {
+        assert(field);
+        assert(element);
+    }
+
+    const rapidjson::Pointer *pointer() const final
+    {
+        return &ptr;
+    }
+
+    size_t footprint() const final
+    {
+        return sizeof(*this) + config_state_pointer_footprint(ptr) + config_state_string_footprint(key) + element->footprint();
+    }
+
+    bool do_read(S &inst, const rapidjson::Value &root) const final
+    {
+        const rapidjson::Value *obj = ptr.Get(root);
+        return obj && do_read_resolved(inst, *obj);
+    }
+
+    bool do_read_resolved(S &inst, const rapidjson::Value &obj) const final
+    {
+        return obj.IsObject() && element->read(inst.*field, obj);
+    }
+
+    bool do_apply_patch_resolved(S &inst, const rapidjson::Value &obj) const final
+    {
+        if (obj.IsNull())
+        {
+            return do_reset(inst);
+        }
+        return obj.IsObject() && element->apply_patch(inst.*field, obj);
+    }
+
+    bool do_equals(const S &a, const S &b) const final
+    {
+        return element->equals(a.*field, b.*field);
+    }
+
+    bool do_write_diff(const S &current, const S &baseline, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        if (element->equals(current.*field, baseline.*field))
+        {
+            return false;
+        }
+
+        auto &obj = ptr.Create(root, allocator);
+        if (!obj.IsObject())
+        {
+            obj.SetObject();
+        }
+        return element->write_diff(current.*field, baseline.*field, obj, allocator);
+    }
+
+    bool do_reset(S &inst) const final
+    {
+        return element->reset(inst.*field);
+    }
+
+    void do_notify_changes(S &inst, const S &previous) const final
+    {
+        element->notify_changes(inst.*field, previous.*field);
+    }
+
+    void do_read_stream_resolved(S &inst, config_state_stream_consumers &out) const final
+    {
+        element->read_stream(inst.*field, out);
+    }
+
+    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        auto &obj = ptr.Create(root, allocator);
+        if (!obj.IsObject())
+        {
+            obj.SetObject();
+        }
+        element->write(inst.*field, obj, allocator);
+    }
+
+    bool do_serialize_resolved(const S &inst, config_state_stream_handler &out) const final
+    {
+        return element->serialize(inst.*field, out);
+    }
+
+    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        const config_state_nvs_full_key object_prefix(prefix, key.c_str());
+        return element->load(inst.*field, handle, object_prefix.c_str());
+    }
+
+    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        const config_state_nvs_full_key object_prefix(prefix, key.c_str());
+        return element->store(inst.*field, handle, object_prefix.c_str());
+    }
+
+    esp_err_t do_store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        const config_state_nvs_full_key object_prefix(prefix, key.c_str());
+        return element->store_changed(inst.*field, persisted.*field, handle, object_prefix.c_str());
+    }
+
+    bool do_load_step(S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const final
+    {
+        // Object itself has no position, its members continue at the same level
+        const config_state_nvs_full_key object_prefix(prefix, key.c_str());
+        return element->load_step(inst.*field, handle, cursor, budget, object_prefix.c_str(), depth);
+    }
+
+    bool do_store_step(const S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const final
+    {
+        const config_state_nvs_full_key object_prefix(prefix, key.c_str());
+        return element->store_step(inst.*field, handle, cursor, budget, object_prefix.c_str(), depth);
+    }
+
+    esp_err_t do_erase(nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        const config_state_nvs_full_key object_prefix(prefix, key.c_str());
+        return element->erase(handle, object_prefix.c_str());
+    }
+
+    bool do_owns_key(const S &inst, const char *nvs_key, const char *prefix) const final
+    {
+        const config_state_nvs_full_key object_prefix(prefix, key.c_str());
+        return element->owns_key(inst.*field, nvs_key, object_prefix.c_str());
+    }
+
+    uint32_t blob_tag() const final
+    {
+        return tag;
+    }
+
+    bool blob_supported() const final
+    {
+        return element->blob_supported();
+    }
+
+    void do_pack(const S &inst, config_state_blob_writer &out) const final
+    {
+        // Single record, containing records of the object members
+        size_t record = out.begin_record(tag);
+        element->pack(inst.*field, out);
+        out.end_record(record);
+    }
+
+    bool do_unpack(S &inst, uint32_t record_tag, config_state_blob_reader &record) const final
+    {
+        if (record_tag != tag)
+        {
+            return false;
+        }
+
+        uint32_t member_tag = 0;
+        config_state_blob_reader member;
+        while (record.next_record(member_tag, member))
+        {
+            element->unpack(inst.*field, member_tag, member);
+        }
+        return true;
+    }
+};
+
+/**
+ * Map of values, e.g. std::map or std::unordered_map, keyed by std::string or integer, see config_state_map_key.
+ * Read and written as JSON object, with a member per entry. Existing entries are updated in place, and entries
+ * missing in JSON are removed. Merge patch removes entries by null members.
+ *
+ * Each entry is stored under its own NVS key, "key/<map key>", so inserting or removing an entry doesn't touch any
+ * other entry. Map keys are listed in a blob "key/keys", since NVS can't be listed without namespace name. Map keys
+ * must not be empty, must not contain '/', must not be "keys", and must be short enough to fit NVS key length,
+ * other keys are ignored when read, and not stored.
+ */
+template<typename S, typename Map>
+struct config_state_map : config_state<S>
+{
+    using K = typename Map::key_type;
+    using T = typename Map::mapped_type;
+    using key_helper = config_state_map_key<K>;
+
+    const rapidjson::Pointer ptr;
+    const std::string key;
+    const uint32_t tag;
+    Map S::*const field;
+    const std::unique_ptr<const config_state<T>> element;
+
+    /**
+     * Maximum length of "<prefix><key>/<map key>", see entry_key_of.
+     */
+    static constexpr size_t max_entry_key_length = 14;
+
+    config_state_map(Map S::*field, const char *json_ptr, const config_state<T> *element, config_state_flags flags = config_state_no_flags)
+        : config_state_map(field, json_ptr, nullptr, element, flags)
+    {
+    }
+
+    config_state_map(Map S::*field, const char *json_ptr, const char *nvs_key, const config_state<T> *element, config_state_flags flags = config_state_no_flags)
+        : config_state<S>(flags),
+          ptr(config_state_pointer(json_ptr)),
+          key(nvs_key ? nvs_key : json_ptr),
+          tag(config_state_blob_tag(key.c_str())),
+          field(field),
+          element(element)
+    {
+        assert(field);
+        assert(element);
+    }
+
+    const rapidjson::Pointer *pointer() const final
+    {
+        return &ptr;
+    }
+
+    size_t footprint() const final
+    {
+        return sizeof(*this) + config_state_pointer_footprint(ptr) + config_state_string_footprint(key) + element->footprint();
+    }
+
+    bool do_read(S &inst, const rapidjson::Value &root) const final
+    {
+        const rapidjson::Value *obj = ptr.Get(root);
+        return obj && do_read_resolved(inst, *obj);
+    }
+
+    bool do_read_resolved(S &inst, const rapidjson::Value &obj) const final
+    {
+        if (!obj.IsObject())
+        {
+            return false;
+        }
+
+        auto &items = inst.*field;
+
+        // Update existing entries in place, insert new ones
+        bool changed = false;
+        size_t count = 0;
+        for (const auto &member : obj.GetObject())
+        {
+            K entry_key;
+            if (!parse_name("", member.name.GetString(), member.name.GetStringLength(), entry_key))
+            {
+                continue; // Ignore invalid keys, same as invalid values
+            }
+
+            auto it = items.find(entry_key);
+            if (it == items.end())
+            {
+                it = items.emplace(std::move(entry_key), T()).first;
+                changed = true;
+            }
+            changed |= element->read(it->second, member.value);
+            count++;
+        }
+
+        // Look for removed entries only when there are any
+        if (items.size() > count)
+        {
+            char buffer[24];
+            for (auto it = items.begin(); it != items.end();)
+            {
+                size_t length = 0;
+                const char *name = key_helper::format(it->first, buffer, length);
+                if (obj.FindMember(rapidjson::Value(rapidjson::StringRef(name, static_cast<rapidjson::SizeType>(length)))) == obj.MemberEnd())
+                {
+                    it = items.erase(it);
+                    changed = true;
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+        return changed;
+    }
+
+    bool do_apply_patch_resolved(S &inst, const rapidjson::Value &obj) const final
+    {
+        if (obj.IsNull())
+        {
+            return do_reset(inst);
+        }
+        if (!obj.IsObject())
+        {
+            return false;
+        }
+
+        auto &items = inst.*field;
+
+        // Absent members are untouched, null removes the entry
+        bool changed = false;
+        for (const auto &member : obj.GetObject())
+        {
+            K entry_key;
+            if (!parse_name("", member.name.GetString(), member.name.GetStringLength(), entry_key))
+            {
+                continue;
+            }
+
+            if (member.value.IsNull())
+            {
+                changed |= items.erase(entry_key) > 0;
+                continue;
+            }
+
+            auto it = items.find(entry_key);
+            if (it == items.end())
+            {
+                it = items.emplace(std::move(entry_key), T()).first;
+                changed = true;
+            }
+            changed |= element->apply_patch(it->second, member.value);
+        }
+        return changed;
+    }
+
+    bool do_equals(const S &a, const S &b) const final
+    {
+        const auto &a_items = a.*field;
+        const auto &b_items = b.*field;
+        if (a_items.size() != b_items.size())
+        {
+            return false;
+        }
+
+        for (const auto &entry : a_items)
+        {
+            auto it = b_items.find(entry.first);
+            if (it == b_items.end() || !element->equals(entry.second, it->second))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool do_write_diff(const S &current, const S &baseline, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        if (do_equals(current, baseline))
+        {
+            return false;
+        }
+
+        auto &obj = ptr.Create(root, allocator);
+        if (!obj.IsObject())
+        {
+            obj.SetObject();
+        }
+
+        // Unlike lists, entries are patched individually, removed ones are written as null
+        const auto &items = current.*field;
+        const auto &baseline_items = baseline.*field;
+        for (const auto &entry : items)
+        {
+            auto it = baseline_items.find(entry.first);
+            if (it == baseline_items.end())
+            {
+                element->write(entry.second, add_member(obj, entry.first, allocator), allocator);
+            }
+            else if (!element->equals(entry.second, it->second))
+            {
+                element->write_diff(entry.second, it->second, add_member(obj, entry.first, allocator), allocator);
+            }
+        }
+        for (const auto &entry : baseline_items)
+        {
+            if (items.find(entry.first) == items.end())
+            {
+                add_member(obj, entry.first, allocator);
+            }
+        }
+        return true;
+    }
+
+    bool do_reset(S &inst) const final
+    {
+        const S &defaults = config_state_defaults<S>();
+        if (do_equals(inst, defaults))
+        {
+            return false;
+        }
+
+        inst.*field = defaults.*field;
+        return true;
+    }
+
+    void do_notify_changes(S &inst, const S &previous) const final
+    {
+        const auto &previous_items = previous.*field;
+        for (auto &entry : inst.*field)
+        {
+            auto it = previous_items.find(entry.first);
+            element->notify_changes(entry.second, it != previous_items.end() ? it->second : config_state_defaults<T>());
+        }
+    }
+
+    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        auto &obj = ptr.Create(root, allocator);
+        if (!obj.IsObject())
+        {
+            obj.SetObject();
+        }
+        else
+        {
+            obj.RemoveAllMembers();
+        }
+
+        auto &items = inst.*field;
+        obj.MemberReserve(static_cast<rapidjson::SizeType>(items.size()), allocator);
+        for (const auto &entry : items)
+        {
+            element->write(entry.second, add_member(obj, entry.first, allocator), allocator);
+        }
+    }
+
+    bool do_serialize_resolved(const S &inst, config_state_stream_handler &out) const final
+    {
+        auto &items = inst.*field;
+        if (!out.StartObject())
+        {
+            return false;
+        }
+
+        char buffer[24];
+        for (const auto &entry : items)
+        {
+            size_t length = 0;
+            const char *name = key_helper::format(entry.first, buffer, length);
+            if (!out.Key(name, static_cast<rapidjson::SizeType>(length), true) || !element->serialize(entry.second, out))
+            {
+                return false;
+            }
+        }
+        return out.EndObject(static_cast<rapidjson::SizeType>(items.size()));
+    }
+
+    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        char entry_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        auto &items = inst.*field;
+
+        // Read stored keys, missing ones mean empty map
+        std::vector<char> names;
+        load_names(handle, prefix, names); // Ignore error
+
+        // Read entries, existing ones in place
+        std::vector<K> loaded;
+        esp_err_t last_err = ESP_OK;
+        for (const char *name = names.data(), *end = names.data() + names.size(); name < end; name += std::strlen(name) + 1)
+        {
+            size_t length = std::strlen(name);
+            K entry_key;
+            if (!parse_name(prefix, name, length, entry_key))
+            {
+                continue;
+            }
+
+            auto it = items.find(entry_key);
+            if (it == items.end())
+            {
+                it = items.emplace(entry_key, T()).first;
+            }
+            loaded.push_back(std::move(entry_key));
+
+            const char *entry_nvs_key = entry_key_of(entry_prefix, prefix, name, length);
+            esp_err_t err = element->load(it->second, handle, entry_nvs_key);
+            if (err != ESP_OK && (err != ESP_ERR_NVS_NOT_FOUND || last_err == ESP_OK)) // Don't overwrite more important error with NOT_FOUND
+            {
+                last_err = err;
+            }
+        }
+
+        retain(items, loaded);
+        return last_err;
+    }
+
+    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        char entry_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        auto &items = inst.*field;
+
+        // Previous keys are needed to erase entries, which are no longer part of the map
+        std::vector<char> stored_names;
+        load_names(handle, prefix, stored_names); // Ignore error
+
+        esp_err_t last_err = store_names(handle, prefix, items);
+
+        // Store entries
+        char buffer[24];
+        for (const auto &entry : items)
+        {
+            size_t length = 0;
+            const char *name = key_helper::format(entry.first, buffer, length);
+            if (!valid_name(prefix, name, length))
+            {
+                last_err = invalid_name(name, length);
+                continue;
+            }
+
+            const char *entry_nvs_key = entry_key_of(entry_prefix, prefix, name, length);
+            esp_err_t err = element->store(entry.second, handle, entry_nvs_key);
+            if (err != ESP_OK)
+            {
+                last_err = err;
+            }
+        }
+
+        // Erase removed entries
+        for (const char *name = stored_names.data(), *end = stored_names.data() + stored_names.size(); name < end; name += std::strlen(name) + 1)
+        {
+            size_t length = std::strlen(name);
+            K entry_key;
+            if (parse_name(prefix, name, length, entry_key) && items.find(entry_key) == items.end())
+            {
+                esp_err_t err = element->erase(handle, entry_key_of(entry_prefix, prefix, name, length));
+                if (err != ESP_OK)
+                {
+                    last_err = err;
+                }
+            }
+        }
+        return last_err;
+    }
+
+    esp_err_t do_store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        char entry_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        auto &items = inst.*field;
+        auto &persisted_items = persisted.*field;
+
+        // Store keys, only if any entry has been inserted or removed
+        bool keys_changed = items.size() != persisted_items.size();
+        for (auto it = items.begin(); !keys_changed && it != items.end(); ++it)
+        {
+            keys_changed = persisted_items.find(it->first) == persisted_items.end();
+        }
+
+        esp_err_t last_err = keys_changed ? store_names(handle, prefix, items) : ESP_OK;
+        bool keys_stored = last_err == ESP_OK;
+
+        // Store changed entries, new ones are stored whole, since NVS might contain anything under their keys
+        char buffer[24];
+        for (const auto &entry : items)
+        {
+            size_t length = 0;
+            const char *name = key_helper::format(entry.first, buffer, length);
+            if (!valid_name(prefix, name, length))
+            {
+                last_err = invalid_name(name, length);
+                continue;
+            }
+
+            const char *entry_nvs_key = entry_key_of(entry_prefix, prefix, name, length);
+
+            auto it = persisted_items.find(entry.first);
+            if (it != persisted_items.end())
+            {
+                esp_err_t err = element->store_changed(entry.second, it->second, handle, entry_nvs_key);
+                if (err != ESP_OK)
+                {
+                    last_err = err;
+                }
+                continue;
+            }
+
+            esp_err_t err = element->store(entry.second, handle, entry_nvs_key);
+            if (err != ESP_OK)
+            {
+                last_err = err;
+            }
+            else if (keys_stored)
+            {
+                persisted_items.emplace(entry.first, entry.second);
+            }
+        }
+
+        // Erase removed entries, persisted keys must match stored keys, otherwise they are stored again next time
+        if (keys_stored)
+        {
+            for (auto it = persisted_items.begin(); it != persisted_items.end();)
+            {
+                if (items.find(it->first) != items.end())
+                {
+                    ++it;
+                    continue;
+                }
+
+                size_t length = 0;
+                const char *name = key_helper::format(it->first, buffer, length);
+                esp_err_t err = element->erase(handle, entry_key_of(entry_prefix, prefix, name, length));
+                if (err != ESP_OK)
+                {
+                    last_err = err;
+                }
+                it = persisted_items.erase(it);
+            }
+        }
+        return last_err;
+    }
+
+    esp_err_t do_erase(nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        char entry_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        std::vector<char> names;
+        load_names(handle, prefix, names); // Ignore error
+
+        esp_err_t last_err = ESP_OK;
+        for (const char *name = names.data(), *end = names.data() + names.size(); name < end; name += std::strlen(name) + 1)
+        {
+            size_t length = std::strlen(name);
+            if (!valid_name(prefix, name, length))
+            {
+                continue;
+            }
+
+            esp_err_t err = element->erase(handle, entry_key_of(entry_prefix, prefix, name, length));
+            if (err != ESP_OK)
+            {
+                last_err = err;
+            }
+        }
+
+        esp_err_t err = config_state_nvs_erase(handle, names_key(entry_prefix, prefix));
+        return err != ESP_OK ? err : last_err;
+    }
+
+    bool do_owns_key(const S &inst, const char *nvs_key, const char *prefix) const final
+    {
+        char entry_prefix[16] = {};
+        if (!prefix) prefix = "";
+
+        // Keys are "key/keys" and "key/<map key>..."
+        std::snprintf(entry_prefix, sizeof(entry_prefix) - 1, "%s%s/", prefix, key.c_str());
+        const char *base = config_state_nvs_key(entry_prefix);
+        size_t base_length = std::strlen(base);
+        if (std::strncmp(nvs_key, base, base_length) != 0)
+        {
+            return false;
+        }
+
+        const char *rest = nvs_key + base_length;
+        if (std::strcmp(rest, "keys") == 0)
+        {
+            return true;
+        }
+
+        const char *separator = std::strchr(rest, '/');
+        size_t length = separator ? separator - rest : std::strlen(rest);
+        K entry_key;
+        if (!parse_name(prefix, rest, length, entry_key))
+        {
+            return false;
+        }
+
+        auto &items = inst.*field;
+        auto it = items.find(entry_key);
+        if (it == items.end())
+        {
+            return false;
+        }
+
+        const char *entry_nvs_key = entry_key_of(entry_prefix, prefix, rest, length);
+        return element->owns_key(it->second, nvs_key, entry_nvs_key);
+    }
+
+    uint32_t blob_tag() const final
+    {
+        return tag;
+    }
+
+    bool blob_supported() const final
+    {
+        return element->blob_supported();
+    }
+
+    void do_pack(const S &inst, config_state_blob_writer &out) const final
+    {
+        auto &items = inst.*field;
+
+        size_t record = out.begin_record(tag);
+
+        // Each entry is a record, containing record of its key, tagged 0, followed by records of the entry itself
+        char buffer[24];
+        for (const auto &entry : items)
+        {
+            size_t entry_record = out.begin_record(0);
+
+            size_t length = 0;
+            const char *name = key_helper::format(entry.first, buffer, length);
+            size_t key_record = out.begin_record(0);
+            out.put(name, length);
+            out.end_record(key_record);
+
+            element->pack(entry.second, out);
+            out.end_record(entry_record);
+        }
+        out.end_record(record);
+    }
+
+    bool do_unpack(S &inst, uint32_t record_tag, config_state_blob_reader &record) const final
+    {
+        if (record_tag != tag)
+        {
+            return false;
+        }
+
+        auto &items = inst.*field;
+
+        std::vector<K> unpacked;
+        uint32_t entry_tag = 0;
+        config_state_blob_reader entry;
+        while (record.next_record(entry_tag, entry))
+        {
+            uint32_t member_tag = 0;
+            config_state_blob_reader member;
+            K entry_key;
+            if (!entry.next_record(member_tag, member) || member_tag != 0
+                || !parse_name("", reinterpret_cast<const char *>(member.data()), member.remaining(), entry_key))
+            {
+                continue;
+            }
+
+            auto it = items.find(entry_key);
+            if (it == items.end())
+            {
+                it = items.emplace(entry_key, T()).first;
+            }
+            unpacked.push_back(std::move(entry_key));
+
+            while (entry.next_record(member_tag, member))
+            {
+                element->unpack(it->second, member_tag, member);
+            }
+        }
+
+        retain(items, unpacked);
+        return true;
+    }
+
+ protected:
+    /**
+     * Adds a member for given entry, with null value.
+     */
+    static rapidjson::Value &add_member(rapidjson::Value &obj, const K &entry_key, rapidjson::Value::AllocatorType &allocator)
+    {
+        char buffer[24];
+        size_t length = 0;
+        const char *name = key_helper::format(entry_key, buffer, length);
+        obj.AddMember(rapidjson::Value(name, static_cast<rapidjson::SizeType>(length), allocator), rapidjson::Value(), allocator);
+        return (obj.MemberEnd() - 1)->value;
+    }
+
+    /**
+     * Removes entries, which are not in given keys, e.g. those not found in NVS.
+     */
+    static void retain(Map &items, std::vector<K> &keys)
+    {
+        if (items.size() <= keys.size())
+        {
+            return; // Every entry has been found
+        }
+
+        std::sort(keys.begin(), keys.end());
+        for (auto it = items.begin(); it != items.end();)
+        {
+            if (std::binary_search(keys.begin(), keys.end(), it->first))
+            {
+                ++it;
+            }
+            else
+            {
+                it = items.erase(it);
+            }
+        }
+    }
+
+    /**
+     * Reads stored map keys, zero terminated, one after another.
+     */
+    esp_err_t load_names(nvs::NVSHandle &handle, const char *prefix, std::vector<char> &names) const
+    {
+        char names_prefix[16] = {};
+        const char *names_nvs_key = names_key(names_prefix, prefix);
+
+        size_t size = 0;
+        esp_err_t err = handle.get_item_size(nvs::ItemType::BLOB, names_nvs_key, size);
+        if (err == ESP_OK)
+        {
+            names.resize(size);
+            err = handle.get_blob(names_nvs_key, names.data(), size);
+        }
+
+        if (err != ESP_OK)
+        {
+            names.clear();
+        }
+        else if (!names.empty() && names.back() != '\0')
+        {
+            names.push_back('\0'); // Malformed, don't read past the end
+        }
+        return err;
+    }
+
+    /**
+     * Stores keys of all entries, or erases them when the map is empty.
+     */
+    esp_err_t store_names(nvs::NVSHandle &handle, const char *prefix, const Map &items) const
+    {
+        char names_prefix[16] = {};
+        const char *names_nvs_key = names_key(names_prefix, prefix);
+        if (items.empty())
+        {
+            return config_state_nvs_erase(handle, names_nvs_key);
+        }
+
+        std::vector<char> names;
+        char buffer[24];
+        for (const auto &entry : items)
+        {
+            size_t length = 0;
+            const char *name = key_helper::format(entry.first, buffer, length);
+            if (valid_name(prefix, name, length))
+            {
+                names.insert(names.end(), name, name + length);
+                names.push_back('\0');
+            }
+        }
+
+        esp_err_t err = handle.set_blob(names_nvs_key, names.data(), names.size());
+        if (err != ESP_OK)
+        {
+            config_state_logw("failed to set_blob %s: %d %s", names_nvs_key, err, esp_err_to_name(err));
+        }
+        return err;
+    }
+
+    const char *names_key(char (&buffer)[16], const char *prefix) const
+    {
+        std::snprintf(buffer, sizeof(buffer) - 1, "%s%s/keys", prefix, key.c_str());
+        return config_state_nvs_key(buffer);
+    }
+
+    /**
+     * Checks map key, as JSON member name or stored name, it becomes part of NVS keys of its entry.
+     * Entry prefix must fit entry_key_of buffer, without being cut.
+     */
+    bool valid_name(const char *prefix, const char *name, size_t length) const
+    {
+        return length > 0
+            && !std::memchr(name, '/', length)
+            && !std::memchr(name, '\0', length)
+            && !(length == 4 && std::strncmp(name, "keys", 4) == 0)
+            && std::strlen(prefix) + key.size() + 1 + length <= max_entry_key_length;
+    }
+
+    bool parse_name(const char *prefix, const char *name, size_t length, K &entry_key) const
+    {
+        return valid_name(prefix, name, length) && key_helper::parse(name, length, entry_key);
+    }
+
+    static esp_err_t invalid_name(const char *name, size_t length)
+    {
+        config_state_logw("invalid map key %.*s", static_cast<int>(length), name);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /**
+     * NVS key prefix of given entry, composed in given buffer.
+     */
+    const char *entry_key_of(char (&buffer)[16], const char *prefix, const char *name, size_t length) const
+    {
+        std::snprintf(buffer, sizeof(buffer) - 1, "%s%s/%.*s", prefix, key.c_str(), static_cast<int>(length), name);
+        return config_state_nvs_key(buffer);
+    }
+};
+
+template<typename S>
+struct config_state_set : config_state<S>
+{
+    explicit config_state_set(config_state_flags flags = config_state_no_flags)
+        : config_state<S>(flags)
+    {
+    }
+
+    // disable copy
+    config_state_set(const config_state_set &) = delete;
+
+    ~config_state_set() override
+    {
+        for (auto state : states_)
+        {
+            delete state;
+        }
+    }
+
+    /**
+     * Adds a state, which is then owned by this set.
+     * Nested sets must be complete when added, their members are merged with members of this set, see serialize.
+     */
+    config_state_set &add(const config_state<S> *state)
+    {
+        assert(state);
+        states_.push_back(state);
+        compile(state, states_.size() - 1);
+        compile_writers(state);
+        compile_blob(state);
+        return *this;
+    }
+
+    /**
+     * Loads and stores this set as a single NVS blob under given key, instead of one NVS entry per value.
+     *
+     * Blob is versioned and CRC protected, values are tagged by their NVS keys and unknown tags are skipped, so
+     * stored snapshot survives adding and removing fields. States, which can't be packed (custom config_state
+     * implementations), are still stored under their own keys.
+     *
+     * Tags are hashes of NVS keys, two keys of one set with the same hash are reported when the second one is added.
+     */
+    config_state_set &store_as_blob(const char *nvs_key)
+    {
+        assert(nvs_key);
+        blob_key_ = nvs_key;
+        return *this;
+    }
+
+    /**
+     * Adds a field, optionally with a callback called whenever read changes its value, see config_state_field.
+     */
+    template<typename T>
+    config_state_set &add_field(T S::*field, const char *json_ptr, const char *nvs_key = nullptr, config_state_flags field_flags = config_state_no_flags,
+                                std::function<void(S &)> on_change = nullptr)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_field<S, T>(field, json_ptr, nvs_key, field_flags, std::move(on_change)));
+    }
+
+    /**
+     * Number of states, ordinal of the next added state, see config_state_changes.
+     */
+    size_t size() const
+    {
+        return states_.size();
+    }
+
+    /**
+     * Heap bytes of the schema, including all states and compiled pointers, see config_state::footprint.
+     */
+    size_t footprint() const final
+    {
+        size_t total = sizeof(*this) + states_.capacity() * sizeof(states_[0])
+                       + read_node_footprint(read_root_) + write_node_footprint(write_root_)
+                       + read_unresolved_.capacity() * sizeof(read_unresolved_[0])
+                       + config_state_string_footprint(blob_key_)
+                       + blob_index_.capacity() * sizeof(blob_index_[0])
+                       + blob_untagged_.capacity() * sizeof(blob_untagged_[0]);
+        for (auto state : states_)
+        {
+            total += state->footprint();
+        }
+        return total;
+    }
+
+    /**
+     * Adds a nested object, read and written by given state relative to json_ptr, see config_state_object.
+     */
+    template<typename T>
+    config_state_set &add_object(T S::*field, const char *json_ptr, const config_state<T> *state, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(state);
+        return add(new config_state_object<S, T>(field, json_ptr, state, field_flags));
+    }
+
+    template<typename T>
+    config_state_set &add_object(T S::*field, const char *json_ptr, std::unique_ptr<config_state<T>> state, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_object<S, T>(field, json_ptr, state.release(), field_flags));
+    }
+
+    template<typename T>
+    config_state_set &add_object(T S::*field, const char *json_ptr, const char *nvs_key, const config_state<T> *state, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(state);
+        return add(new config_state_object<S, T>(field, json_ptr, nvs_key, state, field_flags));
+    }
+
+    template<typename T>
+    config_state_set &add_object(T S::*field, const char *json_ptr, const char *nvs_key, std::unique_ptr<config_state<T>> state, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_object<S, T>(field, json_ptr, nvs_key, state.release(), field_flags));
+    }
+
+    /**
+     * Adds a map, read and written as JSON object, with entries stored under their own NVS keys, see config_state_map.
+     */
+    template<typename Map>
+    config_state_set &add_map(Map S::*field, const char *json_ptr, const config_state<typename Map::mapped_type> *element, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(element);
+        return add(new config_state_map<S, Map>(field, json_ptr, element, field_flags));
+    }
+
+    template<typename Map>
+    config_state_set &add_map(Map S::*field, const char *json_ptr, std::unique_ptr<config_state<typename Map::mapped_type>> element, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_map<S, Map>(field, json_ptr, element.release(), field_flags));
+    }
+
+    template<typename Map>
+    config_state_set &add_map(Map S::*field, const char *json_ptr, const char *nvs_key, const config_state<typename Map::mapped_type> *element, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(element);
+        return add(new config_state_map<S, Map>(field, json_ptr, nvs_key, element, field_flags));
+    }
+
+    template<typename Map>
+    config_state_set &add_map(Map S::*field, const char *json_ptr, const char *nvs_key, std::unique_ptr<config_state<typename Map::mapped_type>> element, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_map<S, Map>(field, json_ptr, nvs_key, element.release(), field_flags));
+    }
+
+    template<typename Map>
+    config_state_set &add_value_map(Map S::*field, const char *json_ptr, const char *nvs_key = nullptr, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_map<S, Map>(field, json_ptr, nvs_key, new config_state_value<typename Map::mapped_type>(field_flags)));
+    }
+
+    template<typename T>
+    config_state_set &add_list(std::vector<T> S::*field, const char *json_ptr, const config_state<T> *element, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(element);
+        return add(new config_state_list<S, T>(field, json_ptr, element, field_flags));
+    }
+
+    template<typename T>
+    config_state_set &add_list(std::vector<T> S::*field, const char *json_ptr, std::unique_ptr<config_state<T>> element, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_list<S, T>(field, json_ptr, element.release(), field_flags));
+    }
+
+    template<typename T>
+    config_state_set &add_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, const config_state<T> *element, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(element);
+        return add(new config_state_list<S, T>(field, json_ptr, nvs_key, element, field_flags));
+    }
+
+    template<typename T>
+    config_state_set &add_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, std::unique_ptr<config_state<T>> element, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_list<S, T>(field, json_ptr, nvs_key, element.release(), field_flags));
+    }
+
+    /**
+     * Adds a list of objects, which are matched by their id on read, instead of their index, see config_state_keyed_list.
+     */
+    template<typename T, typename K>
+    config_state_set &add_keyed_list(std::vector<T> S::*field, const char *json_ptr, K T::*id, const char *id_json_ptr, const config_state<T> *element,
+                                     config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(id_json_ptr);
+        assert(element);
+        return add(new config_state_keyed_list<S, T, K>(field, json_ptr, nullptr, id, id_json_ptr, element, field_flags));
+    }
+
+    template<typename T, typename K>
+    config_state_set &add_keyed_list(std::vector<T> S::*field, const char *json_ptr, K T::*id, const char *id_json_ptr, std::unique_ptr<config_state<T>> element,
+                                     config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(id_json_ptr);
+        return add(new config_state_keyed_list<S, T, K>(field, json_ptr, nullptr, id, id_json_ptr, element.release(), field_flags));
+    }
+
+    template<typename T, typename K>
+    config_state_set &add_keyed_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, K T::*id, const char *id_json_ptr, const config_state<T> *element,
+                                     config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(id_json_ptr);
+        assert(element);
+        return add(new config_state_keyed_list<S, T, K>(field, json_ptr, nvs_key, id, id_json_ptr, element, field_flags));
+    }
+
+    template<typename T, typename K>
+    config_state_set &add_keyed_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, K T::*id, const char *id_json_ptr, std::unique_ptr<config_state<T>> element,
+                                     config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        assert(id_json_ptr);
+        return add(new config_state_keyed_list<S, T, K>(field, json_ptr, nvs_key, id, id_json_ptr, element.release(), field_flags));
+    }
+
+    template<typename T>
+    config_state_set &add_value_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key = nullptr, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_value_list<S, T>(field, json_ptr, nvs_key, new config_state_value<T>(field_flags)));
+    }
+
+    /**
+     * Same as add_value_list, but the list is stored in NVS as a single blob, see config_state_packed_list.
+     */
+    template<typename T>
+    config_state_set &add_packed_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key = nullptr, config_state_flags field_flags = config_state_no_flags)
+    {
+        assert(field);
+        assert(json_ptr);
+        return add(new config_state_packed_list<S, T>(field, json_ptr, nvs_key, field_flags));
+    }
+
+    using config_state<S>::read;
+
+    /**
+     * Same as read, but also reports ordinals of changed states.
+     * Changes of nested sets and lists are reported as a change of the whole set or list.
+     *
+     * @param changes Changed states are added to it, it is not cleared
+     */
+    bool read(S &inst, const rapidjson::Value &root, config_state_changes &changes) const
+    {
+        if ((this->flags & config_state_disable_read) == 0)
+        {
+            return read_root(inst, root, &changes);
+        }
+        return false;
+    }
+
+    bool do_read(S &inst, const rapidjson::Value &root) const final
+    {
+        return read_root(inst, root, nullptr);
+    }
+
+    using config_state<S>::apply_patch;
+
+    /**
+     * Same as apply_patch, but also reports ordinals of changed states, see read.
+     */
+    bool apply_patch(S &inst, const rapidjson::Value &patch, config_state_changes &changes) const
+    {
+        if ((this->flags & config_state_disable_read) == 0)
+        {
+            return patch_root(inst, patch, &changes);
+        }
+        return false;
+    }
+
+    bool do_apply_patch(S &inst, const rapidjson::Value &patch) const final
+    {
+        return patch_root(inst, patch, nullptr);
+    }
+
+    bool do_reset(S &inst) const final
+    {
+        bool changed = false;
+        for (auto state : states_)
+        {
+            changed |= state->reset(inst);
+        }
+        return changed;
+    }
+
+    bool do_equals(const S &a, const S &b) const final
+    {
+        return std::all_of(states_.begin(), states_.end(), [&](const config_state<S> *state) { return state->equals(a, b); });
+    }
+
+    void do_notify_changes(S &inst, const S &previous) const final
+    {
+        for (auto state : states_)
+        {
+            state->notify_changes(inst, previous);
+        }
+    }
+
+    bool do_write_diff(const S &current, const S &baseline, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        bool written = false;
+        for (auto state : states_)
+        {
+            written |= state->write_diff(current, baseline, root, allocator);
+        }
+        return written;
+    }
+
+    void do_read_stream(S &inst, config_state_stream_consumers &out) const final
+    {
+        stream_node(inst, read_root_, out);
+
+        for (const auto &entry : read_unresolved_)
+        {
+            entry.state->read_stream(inst, out);
+        }
+    }
+
+    config_state_stream_mode stream_begin(config_state_stream_consumer &consumer, bool array) const final
+    {
+        return config_state_stream_members;
+    }
+
+    bool stream_scalar(const config_state_stream_consumer &consumer, const rapidjson::Value &value) const final
+    {
+        return false;
+    }
+
+    void stream_member(const config_state_stream_consumer &consumer, const char *name, rapidjson::SizeType length, config_state_stream_consumers &out) const final
+    {
+        const read_node *child = find_child(*static_cast<const read_node *>(consumer.cursor), name, length);
+        if (child)
+        {
+            stream_node(*static_cast<S *>(consumer.inst), *child, out);
+        }
+    }
+
+    void stream_element(const config_state_stream_consumer &consumer, rapidjson::SizeType index, config_state_stream_consumers &out) const final
+    {
+        char name[12] = {};
+        std::snprintf(name, sizeof(name), "%u", static_cast<unsigned>(index));
+
+        const read_node *child = find_child(*static_cast<const read_node *>(consumer.cursor), name, std::strlen(name));
+        if (child && child->index == index)
+        {
+            stream_node(*static_cast<S *>(consumer.inst), *child, out);
+        }
+    }
+
+    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        for (auto state : states_)
+        {
+            state->write(inst, root, allocator);
+        }
+    }
+
+    void collect_writers(std::vector<const config_state<S> *> &out) const final
+    {
+        if ((this->flags & config_state_disable_write) == 0)
+        {
+            for (auto state : states_)
+            {
+                state->collect_writers(out);
+            }
+        }
+    }
+
+    bool do_serialize(const S &inst, config_state_stream_handler &out) const final
+    {
+        if (write_fallback_)
+        {
+            // Some state writes directly into the root, its output is known only after write
+            rapidjson::Document doc;
+            do_write(inst, doc, doc.GetAllocator());
+            return doc.Accept(out);
+        }
+
+        return serialize_node(inst, write_root_, out);
+    }
+
+    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        if (!blob_key_.empty())
+        {
+            return load_blob(inst, handle, prefix);
+        }
+
+        esp_err_t last_err = ESP_OK;
+        for (auto state : states_)
+        {
+            esp_err_t err = state->load(inst, handle, prefix);
+            if (err != ESP_OK && (err != ESP_ERR_NVS_NOT_FOUND || last_err == ESP_OK)) // Don't overwrite more important error with NOT_FOUND
+            {
+                last_err = err;
+            }
+        }
+        return last_err;
+    }
+
+    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        if (!blob_key_.empty())
+        {
+            return store_blob(inst, handle, prefix);
+        }
+
+        esp_err_t last_err = ESP_OK;
+        for (auto state : states_)
+        {
+            esp_err_t err = state->store(inst, handle, prefix);
+            if (err != ESP_OK)
+            {
+                last_err = err;
+            }
+        }
+        return last_err;
+    }
+
+    bool do_load_step(S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const final
+    {
+        if (!blob_key_.empty())
+        {
+            return config_state<S>::do_load_step(inst, handle, prefix, cursor, depth, budget); // Single read anyway
+        }
+
+        for (size_t i = cursor.position(depth); i < states_.size(); i = cursor.advance(depth))
+        {
+            if (!states_[i]->load_step(inst, handle, cursor, budget, prefix, depth + 1))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool do_store_step(const S &inst, nvs::NVSHandle &handle, const char *prefix, config_state_cursor &cursor, size_t depth, config_state_budget &budget) const final
+    {
+        if (!blob_key_.empty())
+        {
+            return config_state<S>::do_store_step(inst, handle, prefix, cursor, depth, budget); // Single write anyway
+        }
+
+        for (size_t i = cursor.position(depth); i < states_.size(); i = cursor.advance(depth))
+        {
+            if (!states_[i]->store_step(inst, handle, cursor, budget, prefix, depth + 1))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    esp_err_t do_store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        if (!blob_key_.empty())
+        {
+            return store_blob(inst, handle, prefix); // Single write anyway, NVS skips it when unchanged
+        }
+
+        esp_err_t last_err = ESP_OK;
+        for (auto state : states_)
+        {
+            esp_err_t err = state->store_changed(inst, persisted, handle, prefix);
+            if (err != ESP_OK)
+            {
+                last_err = err;
+            }
+        }
+        return last_err;
+    }
+
+    esp_err_t do_erase(nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        esp_err_t last_err = ESP_OK;
+        if (!blob_key_.empty())
+        {
+            last_err = config_state_nvs_erase(handle, prefix, blob_key_);
+        }
+
+        for (auto state : states_)
+        {
+            if (blob_key_.empty() || !state->blob_supported())
+            {
+                esp_err_t err = state->erase(handle, prefix);
+                if (err != ESP_OK)
+                {
+                    last_err = err;
+                }
+            }
+        }
+        return last_err;
+    }
+
+    bool do_owns_key(const S &inst, const char *nvs_key, const char *prefix) const final
+    {
+        if (!blob_key_.empty() && config_state_nvs_key_equals(nvs_key, prefix, blob_key_))
+        {
+            return true;
+        }
+
+        return std::any_of(states_.begin(), states_.end(), [&](const config_state<S> *state) {
+            return (blob_key_.empty() || !state->blob_supported()) && state->owns_key(inst, nvs_key, prefix);
+        });
+    }
+
+    bool blob_supported() const final
+    {
+        return blob_supported_;
+    }
+
+    void do_pack(const S &inst, config_state_blob_writer &out) const final
+    {
+        for (auto state : states_)
+        {
+            state->pack(inst, out);
+        }
+    }
+
+    bool do_unpack(S &inst, uint32_t record_tag, config_state_blob_reader &record) const final
+    {
+        auto it = std::lower_bound(blob_index_.begin(), blob_index_.end(), record_tag, blob_index_less);
+        if (it != blob_index_.end() && it->first == record_tag)
+        {
+            return it->second->unpack(inst, record_tag, record);
+        }
+
+        // Nested sets
+        for (auto state : blob_untagged_)
+        {
+            if (state->unpack(inst, record_tag, record))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+ private:
+    struct read_entry
+    {
+        const config_state<S> *state;
+        size_t ordinal;
+    };
+
+    /**
+     * Node of compiled JSON pointers of all states, one per pointer token.
+     * States sharing common prefix share nodes, so their parent value is resolved only once.
+     */
+    struct read_node
+    {
+        const char *name = nullptr; // Token name of the pointer, which created the node
+        rapidjson::SizeType length = 0;
+        rapidjson::SizeType index = rapidjson::kPointerInvalidIndex;
+        std::vector<read_entry> states; // States, whose pointer ends at this node
+        std::vector<read_node> children; // Sorted by name
+    };
+
+    /**
+     * Node of compiled JSON pointers of all writers, including members of nested sets, in order of creation.
+     * Emitted values are grouped the same way as rapidjson::Pointer::Create groups them in the DOM.
+     */
+    struct write_node
+    {
+        const char *name = nullptr;
+        rapidjson::SizeType length = 0;
+        rapidjson::SizeType index = rapidjson::kPointerInvalidIndex;
+        const config_state<S> *state = nullptr; // Writer of whole value, overrides children
+        std::vector<write_node> children;       // In order of creation
+    };
 
-    bool do_read(T &inst, const rapidjson::Value &root) const final
+    std::vector<const config_state<S> *> states_;
+    read_node read_root_;
+    std::vector<read_entry> read_unresolved_;
+    write_node write_root_;
+    bool write_fallback_ = false;
+    std::string blob_key_;
+    std::vector<std::pair<uint32_t, const config_state<S> *>> blob_index_; // Sorted by tag
+    std::vector<const config_state<S> *> blob_untagged_;
+    bool blob_supported_ = true;
+
+    static size_t read_node_footprint(const read_node &node)
     {
-        return config_state_helper<T>::read(ptr, root, inst);
+        size_t total = node.states.capacity() * sizeof(node.states[0]) + node.children.capacity() * sizeof(node.children[0]);
+        for (const auto &child : node.children)
+        {
+            total += read_node_footprint(child);
+        }
+        return total;
     }
 
-    void do_write(const T &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    static size_t write_node_footprint(const write_node &node)
     {
-        config_state_helper<T>::write(ptr, root, allocator, inst);
+        size_t total = node.children.capacity() * sizeof(node.children[0]);
+        for (const auto &child : node.children)
+        {
+            total += write_node_footprint(child);
+        }
+        return total;
     }
 
-    esp_err_t do_load(T &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    /**
+     * Orders node names, same as std::string::compare.
+     */
+    static int compare_name(const char *a, rapidjson::SizeType a_length, const char *b, rapidjson::SizeType b_length)
     {
-        return config_state_helper<T>::load(key, handle, prefix, inst);
+        int result = std::memcmp(a, b, std::min(a_length, b_length));
+        return result != 0 ? result : (a_length < b_length ? -1 : (a_length > b_length ? 1 : 0));
     }
 
-    esp_err_t do_store(const T &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    void compile(const config_state<S> *state, size_t ordinal)
     {
-        return config_state_helper<T>::store(key, handle, prefix, inst);
-    }
-};
+        const rapidjson::Pointer *ptr = state->pointer();
+        if (!ptr || !ptr->IsValid())
+        {
+            read_unresolved_.push_back({state, ordinal});
+            return;
+        }
 
-template<typename S, typename T>
-struct config_state_list : config_state<S>
-{
-    const rapidjson::Pointer ptr;
-    const std::string key;
-    std::vector<T> S::*const field;
-    const std::unique_ptr<const config_state<T>> element;
+        read_node *node = &read_root_;
+        for (size_t i = 0; i < ptr->GetTokenCount(); i++)
+        {
+            const auto &token = ptr->GetTokens()[i];
 
-    config_state_list(std::vector<T> S::*field, const char *json_ptr, const config_state<T> *element, config_state_flags flags = config_state_no_flags)
-        : config_state_list(field, json_ptr, nullptr, element, flags)
-    {
+            // Names point into tokens, which live as long as their states
+            auto it = std::lower_bound(node->children.begin(), node->children.end(), token, [](const read_node &child, const rapidjson::Pointer::Token &key) {
+                return compare_name(child.name, child.length, key.name, key.length) < 0;
+            });
+            if (it == node->children.end() || compare_name(it->name, it->length, token.name, token.length) != 0)
+            {
+                read_node child;
+                child.name = token.name;
+                child.length = token.length;
+                child.index = token.index;
+                it = node->children.insert(it, std::move(child));
+            }
+            node = &*it;
+        }
+        node->states.push_back({state, ordinal});
     }
 
-    config_state_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, const config_state<T> *element, config_state_flags flags = config_state_no_flags)
-        : config_state<S>(flags),
-          ptr(json_ptr),
-          key(nvs_key ? nvs_key : json_ptr),
-          field(field),
-          element(element)
+    static bool blob_index_less(const std::pair<uint32_t, const config_state<S> *> &entry, uint32_t tag)
     {
-        assert(field);
-        assert(element);
+        return entry.first < tag;
     }
 
-    bool do_read(S &inst, const rapidjson::Value &root) const final
+    void compile_blob(const config_state<S> *state)
     {
-        const rapidjson::Value *list = ptr.Get(root);
-        if (!list || !list->IsArray())
+        blob_supported_ &= state->blob_supported();
+
+        uint32_t tag = state->blob_tag();
+        if (tag == 0)
         {
-            return false;
+            blob_untagged_.push_back(state);
+            return;
         }
 
-        auto &items = inst.*field;
-
-        // Resize
-        auto array = list->GetArray();
-        size_t length = array.Size();
-
-        items.resize(length);
-
-        // Get each
-        bool changed = false;
-        for (size_t i = 0; i < length; i++)
+        auto it = std::lower_bound(blob_index_.begin(), blob_index_.end(), tag, blob_index_less);
+        if (it != blob_index_.end() && it->first == tag)
         {
-            changed |= element->read(items[i], array[i]);
+            // Records of both states would be unpacked by the first one, rename either NVS key
+            config_state_logw("blob tag %08x clash, state %u has the same tag as a previous state", static_cast<unsigned>(tag), static_cast<unsigned>(states_.size() - 1));
+            assert(false && "blob tag clash, rename NVS key");
         }
-        return changed;
+        blob_index_.insert(it, std::make_pair(tag, state));
     }
 
-    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    esp_err_t load_blob(S &inst, nvs::NVSHandle &handle, const char *prefix) const
     {
-        auto &array = ptr.Create(root, allocator);
-        if (!array.IsArray())
+        const config_state_nvs_full_key full_key(prefix, blob_key_.c_str());
+
+        // Single read of the whole snapshot
+        std::vector<uint8_t> buffer;
+        size_t length = 0;
+        esp_err_t err = handle.get_item_size(nvs::ItemType::BLOB, full_key.c_str(), length);
+        if (err == ESP_OK)
         {
-            array.SetArray();
+            buffer.resize(length);
+            err = handle.get_blob(full_key.c_str(), buffer.data(), length);
         }
 
-        auto &items = inst.*field;
-        size_t len = items.size();
-
-        // Resize array
-        array.Reserve(len, allocator);
+        config_state_blob_reader records;
+        if (err == ESP_OK)
+        {
+            err = config_state_blob_reader::open_snapshot(buffer.data(), buffer.size(), records);
+        }
 
-        while (array.Size() < len)
+        if (err == ESP_OK)
         {
-            array.PushBack(rapidjson::Value(), allocator);
+            uint32_t tag = 0;
+            config_state_blob_reader record;
+            while (records.next_record(tag, record))
+            {
+                do_unpack(inst, tag, record); // Unknown tags are skipped
+            }
         }
-        while (array.Size() > len)
+        else
         {
-            array.PopBack();
+            config_state_log_load_error("get_blob", full_key.c_str(), err);
         }
 
-        // Set each
-        for (size_t i = 0; i < len; i++)
+        // States, which are not in the snapshot
+        esp_err_t last_err = err;
+        for (auto state : states_)
         {
-            element->write(items[i], array[i], allocator);
+            if (!state->blob_supported())
+            {
+                esp_err_t state_err = state->load(inst, handle, prefix);
+                if (state_err != ESP_OK && (state_err != ESP_ERR_NVS_NOT_FOUND || last_err == ESP_OK)) // Don't overwrite more important error with NOT_FOUND
+                {
+                    last_err = state_err;
+                }
+            }
         }
+        return last_err;
     }
 
-    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    esp_err_t store_blob(const S &inst, nvs::NVSHandle &handle, const char *prefix) const
     {
-        char item_prefix[16] = {};
-        if (!prefix) prefix = "";
-
-        auto &items = inst.*field;
+        const config_state_nvs_full_key full_key(prefix, blob_key_.c_str());
 
-        // Read length
-        std::snprintf(item_prefix, sizeof(item_prefix) - 1, "%s%s/len", prefix, key.c_str());
-        uint16_t length = 0;
-        handle.get_item(config_state_nvs_key(item_prefix), length); // Ignore error
+        std::vector<uint8_t> buffer;
+        config_state_blob_writer out(buffer);
+        out.begin_snapshot();
+        for (auto state : states_)
+        {
+            if (state->blob_supported())
+            {
+                state->pack(inst, out);
+            }
+        }
+        out.end_snapshot();
 
-        // Resize
-        items.resize(length);
+        esp_err_t last_err = handle.set_blob(full_key.c_str(), buffer.data(), buffer.size());
+        if (last_err != ESP_OK)
+        {
+            config_state_logw("failed to set_blob %s: %d %s", full_key.c_str(), last_err, esp_err_to_name(last_err));
+        }
 
-        // Read items
-        esp_err_t last_err = ESP_OK;
-        for (size_t i = 0; i < items.size(); i++)
+        // States, which are not in the snapshot
+        for (auto state : states_)
         {
-            std::snprintf(item_prefix, sizeof(item_prefix) - 1, "%s%s/%zu", prefix, key.c_str(), i);
-            esp_err_t err = element->load(items[i], handle, config_state_nvs_key(item_prefix));
-            if (err != ESP_OK && (err != ESP_ERR_NVS_NOT_FOUND || last_err == ESP_OK)) // Don't overwrite more important error with NOT_FOUND
+            if (!state->blob_supported())
             {
-                last_err = err;
+                esp_err_t err = state->store(inst, handle, prefix);
+                if (err != ESP_OK)
+                {
+                    last_err = err;
+                }
             }
         }
         return last_err;
     }
 
-    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    void compile_writers(const config_state<S> *state)
     {
-        char item_prefix[16] = {};
-        if (!prefix) prefix = "";
-
-        auto &items = inst.*field;
-
-        // Store length
-        std::snprintf(item_prefix, sizeof(item_prefix) - 1, "%s%s/len", prefix, key.c_str());
-        handle.set_item(config_state_nvs_key(item_prefix), static_cast<uint16_t>(items.size())); // No need to store all 32 bytes, that would never fit in memory
+        std::vector<const config_state<S> *> writers;
+        state->collect_writers(writers);
 
-        // Store items
-        esp_err_t last_err = ESP_OK;
-        for (size_t i = 0; i < items.size(); i++)
+        for (auto writer : writers)
         {
-            std::snprintf(item_prefix, sizeof(item_prefix) - 1, "%s%s/%zu", prefix, key.c_str(), i);
-            esp_err_t err = element->store(items[i], handle, config_state_nvs_key(item_prefix));
-            if (err != ESP_OK)
+            const rapidjson::Pointer *ptr = writer->pointer();
+            if (!ptr || !ptr->IsValid())
             {
-                last_err = err;
+                write_fallback_ = true;
+                continue;
+            }
+
+            write_node *node = &write_root_;
+            for (size_t i = 0; i < ptr->GetTokenCount(); i++)
+            {
+                const auto &token = ptr->GetTokens()[i];
+                node->state = nullptr; // Create replaces any value, which is not an object or array
+
+                auto it = std::find_if(node->children.begin(), node->children.end(), [&token](const write_node &child) {
+                    return compare_name(child.name, child.length, token.name, token.length) == 0;
+                });
+                if (it == node->children.end())
+                {
+                    write_node child;
+                    child.name = token.name;
+                    child.length = token.length;
+                    child.index = token.index;
+                    it = node->children.insert(it, std::move(child));
+                }
+                node = &*it;
             }
+
+            // Set replaces whole value
+            node->state = writer;
+            node->children.clear();
         }
-        return last_err;
     }
-};
 
-template<typename S>
-struct config_state_set : config_state<S>
-{
-    explicit config_state_set(config_state_flags flags = config_state_no_flags)
-        : config_state<S>(flags)
+    bool serialize_node(const S &inst, const write_node &node, config_state_stream_handler &out) const
     {
-    }
+        if (node.state)
+        {
+            return node.state->serialize_resolved(inst, out);
+        }
+        if (node.children.empty())
+        {
+            return out.Null();
+        }
 
-    // disable copy
-    config_state_set(const config_state_set &) = delete;
+        bool array = std::all_of(node.children.begin(), node.children.end(), [](const write_node &child) {
+            return child.index != rapidjson::kPointerInvalidIndex;
+        });
+        return array ? serialize_array(inst, node, out) : serialize_object(inst, node, out);
+    }
 
-    ~config_state_set() override
+    bool serialize_object(const S &inst, const write_node &node, config_state_stream_handler &out) const
     {
-        for (auto state : states_)
+        if (!out.StartObject())
         {
-            delete state;
+            return false;
+        }
+        for (const auto &child : node.children)
+        {
+            if (!out.Key(child.name, child.length, false)
+                || !serialize_node(inst, child, out))
+            {
+                return false;
+            }
         }
+        return out.EndObject(static_cast<rapidjson::SizeType>(node.children.size()));
     }
 
-    config_state_set &add(const config_state<S> *state)
+    bool serialize_array(const S &inst, const write_node &node, config_state_stream_handler &out) const
     {
-        assert(state);
-        states_.push_back(state);
-        return *this;
-    }
+        rapidjson::SizeType length = 0;
+        for (const auto &child : node.children)
+        {
+            length = std::max(length, child.index + 1);
+        }
 
-    template<typename T>
-    config_state_set &add_field(T S::*field, const char *json_ptr, const char *nvs_key = nullptr, config_state_flags field_flags = config_state_no_flags)
-    {
-        assert(field);
-        assert(json_ptr);
-        return add(new config_state_field<S, T>(field, json_ptr, nvs_key, field_flags));
+        if (!out.StartArray())
+        {
+            return false;
+        }
+
+        // Elements without a writer are null, same as padding by rapidjson::Pointer::Create
+        for (rapidjson::SizeType i = 0; i < length; i++)
+        {
+            auto it = std::find_if(node.children.begin(), node.children.end(), [i](const write_node &child) {
+                return child.index == i;
+            });
+            if (!(it != node.children.end() ? serialize_node(inst, *it, out) : out.Null()))
+            {
+                return false;
+            }
+        }
+        return out.EndArray(length);
     }
 
-    template<typename T>
-    config_state_set &add_list(std::vector<T> S::*field, const char *json_ptr, const config_state<T> *element, config_state_flags field_flags = config_state_no_flags)
+    const read_node *find_child(const read_node &node, const char *name, rapidjson::SizeType length) const
     {
-        assert(field);
-        assert(json_ptr);
-        assert(element);
-        return add(new config_state_list<S, T>(field, json_ptr, element, field_flags));
+        auto it = std::lower_bound(node.children.begin(), node.children.end(), std::make_pair(name, length), [](const read_node &child, const std::pair<const char *, rapidjson::SizeType> &key) {
+            return compare_name(child.name, child.length, key.first, key.second) < 0;
+        });
+        if (it != node.children.end() && compare_name(it->name, it->length, name, length) == 0)
+        {
+            return &*it;
+        }
+        return nullptr;
     }
 
-    template<typename T>
-    config_state_set &add_list(std::vector<T> S::*field, const char *json_ptr, std::unique_ptr<config_state<T>> element, config_state_flags field_flags = config_state_no_flags)
+    void stream_node(S &inst, const read_node &node, config_state_stream_consumers &out) const
     {
-        assert(field);
-        assert(json_ptr);
-        return add(new config_state_list<S, T>(field, json_ptr, element.release(), field_flags));
+        for (const auto &entry : node.states)
+        {
+            entry.state->read_stream_resolved(inst, out);
+        }
+
+        if (!node.children.empty())
+        {
+            out.push_back({this, &inst, &node, 0});
+        }
     }
 
-    template<typename T>
-    config_state_set &add_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, const config_state<T> *element, config_state_flags field_flags = config_state_no_flags)
+    bool read_root(S &inst, const rapidjson::Value &root, config_state_changes *changes) const
     {
-        assert(field);
-        assert(json_ptr);
-        assert(element);
-        return add(new config_state_list<S, T>(field, json_ptr, nvs_key, element, field_flags));
+        // Single pass over the document, for all states with a pointer
+        bool changed = read_node_value(inst, read_root_, root, changes);
+
+        // Rest needs to resolve its values on its own
+        for (const auto &entry : read_unresolved_)
+        {
+            changed |= track(entry, entry.state->read(inst, root), changes);
+        }
+        return changed;
     }
 
-    template<typename T>
-    config_state_set &add_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key, std::unique_ptr<config_state<T>> element, config_state_flags field_flags = config_state_no_flags)
+    static bool track(const read_entry &entry, bool changed, config_state_changes *changes)
     {
-        assert(field);
-        assert(json_ptr);
-        return add(new config_state_list<S, T>(field, json_ptr, nvs_key, element.release(), field_flags));
+        if (changed && changes)
+        {
+            changes->set(entry.ordinal);
+        }
+        return changed;
     }
 
-    template<typename T>
-    config_state_set &add_value_list(std::vector<T> S::*field, const char *json_ptr, const char *nvs_key = nullptr, config_state_flags field_flags = config_state_no_flags)
+    bool patch_root(S &inst, const rapidjson::Value &patch, config_state_changes *changes) const
     {
-        assert(field);
-        assert(json_ptr);
-        return add(new config_state_list<S, T>(field, json_ptr, nvs_key, new config_state_value<T>(field_flags)));
+        // Walks only the patch, dispatching its members to compiled pointers
+        bool changed = patch_node(inst, read_root_, patch, changes);
+
+        for (const auto &entry : read_unresolved_)
+        {
+            changed |= track(entry, entry.state->apply_patch(inst, patch), changes);
+        }
+        return changed;
     }
 
-    bool do_read(S &inst, const rapidjson::Value &root) const final
+    bool patch_node(S &inst, const read_node &node, const rapidjson::Value &value, config_state_changes *changes) const
     {
         bool changed = false;
-        for (auto state : states_)
+        for (const auto &entry : node.states)
         {
-            changed |= state->read(inst, root);
+            changed |= track(entry, entry.state->apply_patch_resolved(inst, value), changes);
+        }
+
+        if (value.IsNull())
+        {
+            // Removed object, reset everything below
+            for (const auto &child : node.children)
+            {
+                changed |= reset_node(inst, child, changes);
+            }
+        }
+        else if (value.IsObject())
+        {
+            for (auto member = value.MemberBegin(); member != value.MemberEnd(); ++member)
+            {
+                const read_node *child = find_child(node, member->name.GetString(), member->name.GetStringLength());
+                if (child)
+                {
+                    changed |= patch_node(inst, *child, member->value, changes);
+                }
+            }
+        }
+        else if (value.IsArray())
+        {
+            for (const auto &child : node.children)
+            {
+                if (child.index < value.Size())
+                {
+                    changed |= patch_node(inst, child, value[child.index], changes);
+                }
+            }
         }
         return changed;
     }
 
-    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    bool reset_node(S &inst, const read_node &node, config_state_changes *changes) const
     {
-        for (auto state : states_)
+        bool changed = false;
+        for (const auto &entry : node.states)
         {
-            state->write(inst, root, allocator);
+            changed |= track(entry, entry.state->reset(inst), changes);
+        }
+        for (const auto &child : node.children)
+        {
+            changed |= reset_node(inst, child, changes);
         }
+        return changed;
     }
 
-    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    bool read_node_value(S &inst, const read_node &node, const rapidjson::Value &value, config_state_changes *changes) const
     {
-        esp_err_t last_err = ESP_OK;
-        for (auto state : states_)
+        bool changed = false;
+        for (const auto &entry : node.states)
         {
-            esp_err_t err = state->load(inst, handle, prefix);
-            if (err != ESP_OK && (err != ESP_ERR_NVS_NOT_FOUND || last_err == ESP_OK)) // Don't overwrite more important error with NOT_FOUND
+            changed |= track(entry, entry.state->read_resolved(inst, value), changes);
+        }
+
+        if (node.children.empty())
+        {
+            return changed;
+        }
+
+        if (value.IsObject())
+        {
+            // Walk the object once, and dispatch each member to the matching node
+            for (auto member = value.MemberBegin(); member != value.MemberEnd(); ++member)
             {
-                last_err = err;
+                const read_node *child = find_child(node, member->name.GetString(), member->name.GetStringLength());
+                if (child)
+                {
+                    changed |= read_node_value(inst, *child, member->value, changes);
+                }
             }
         }
-        return last_err;
-    }
-
-    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const final
-    {
-        esp_err_t last_err = ESP_OK;
-        for (auto state : states_)
+        else if (value.IsArray())
         {
-            esp_err_t err = state->store(inst, handle, prefix);
-            if (err != ESP_OK)
+            for (const auto &child : node.children)
             {
-                last_err = err;
+                if (child.index < value.Size())
+                {
+                    changed |= read_node_value(inst, child, value[child.index], changes);
+                }
             }
         }
-        return last_err;
+        return changed;
     }
-
- private:
-    std::vector<const config_state<S> *> states_;
 };
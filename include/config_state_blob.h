@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+#include <vector>
+
+// Binary snapshot format, see config_state_set::store_as_blob
+//
+// Snapshot is a header, a sequence of tagged records and a CRC32 of everything before it:
+//   [u8 'C'][u8 'S'][u8 version][u8 reserved] [record]... [u32 crc]
+// Each record is
+//   [u32 tag][u32 length][length bytes]
+// All numbers are little-endian. Readers skip records with unknown tags, so fields can be added and removed freely.
+
+/**
+ * Current snapshot format version. Snapshots with different version are rejected.
+ */
+static constexpr uint8_t CONFIG_STATE_BLOB_VERSION = 1;
+
+/**
+ * Tag of a value in the snapshot, derived from its NVS key (leading '/' is ignored). Never 0.
+ */
+uint32_t config_state_blob_tag(const char *key);
+
+uint32_t config_state_crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+/**
+ * Appends snapshot data into a buffer.
+ */
+class config_state_blob_writer
+{
+ public:
+    explicit config_state_blob_writer(std::vector<uint8_t> &buffer)
+        : buffer_(buffer)
+    {
+    }
+
+    /**
+     * Writes snapshot header, must be called first.
+     */
+    void begin_snapshot();
+
+    /**
+     * Appends CRC of the whole snapshot, must be called last.
+     */
+    void end_snapshot();
+
+    /**
+     * Begins a record, its content is appended until end_record.
+     *
+     * @return Position of the record, to be passed to end_record
+     */
+    size_t begin_record(uint32_t tag);
+
+    void end_record(size_t record);
+
+    void put(const void *data, size_t length);
+
+    template<typename T>
+    void put_value(T value)
+    {
+        put(&value, sizeof(value));
+    }
+
+ private:
+    std::vector<uint8_t> &buffer_;
+};
+
+/**
+ * Reads records of a snapshot, or content of a single record.
+ */
+class config_state_blob_reader
+{
+ public:
+    config_state_blob_reader() = default;
+
+    config_state_blob_reader(const uint8_t *data, size_t length)
+        : data_(data),
+          length_(length)
+    {
+    }
+
+    /**
+     * Validates snapshot header and CRC, and returns reader of its records.
+     *
+     * @return ESP_OK, ESP_ERR_INVALID_SIZE, ESP_ERR_INVALID_VERSION or ESP_ERR_INVALID_CRC
+     */
+    static esp_err_t open_snapshot(const uint8_t *data, size_t length, config_state_blob_reader &records);
+
+    /**
+     * Reads next record.
+     *
+     * @return false at the end, or if remaining data are malformed
+     */
+    bool next_record(uint32_t &tag, config_state_blob_reader &record);
+
+    bool get(void *data, size_t length);
+
+    template<typename T>
+    bool get_value(T &value)
+    {
+        return get(&value, sizeof(value));
+    }
+
+    const uint8_t *data() const
+    {
+        return data_ + pos_;
+    }
+
+    size_t remaining() const
+    {
+        return length_ - pos_;
+    }
+
+ private:
+    const uint8_t *data_ = nullptr;
+    size_t length_ = 0;
+    size_t pos_ = 0;
+};
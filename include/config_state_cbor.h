@@ -0,0 +1,125 @@
+#pragma once
+
+#include "config_state_reader.h"
+#include <cstddef>
+#include <cstdint>
+#include <esp_err.h>
+
+// CBOR (RFC 8949) codec, with the same data model and paths as JSON, see config_state_cbor_encode
+//
+// Objects and arrays are encoded as indefinite-length maps and arrays, since their size is not known in advance
+// while streaming. Integers use the shortest encoding, doubles are encoded as single precision when it is lossless.
+// Decoder accepts definite and indefinite-length containers, text map keys, half/single/double precision floats,
+// and ignores tags. Byte strings and chunked text strings are not supported.
+
+#ifndef CONFIG_STATE_CBOR_MAX_DEPTH
+/**
+ * Max nesting of decoded CBOR containers, decoder is recursive.
+ */
+#define CONFIG_STATE_CBOR_MAX_DEPTH 32
+#endif
+
+/**
+ * SAX handler, which encodes events as CBOR into a caller-supplied buffer, see config_state::serialize.
+ */
+class config_state_cbor_writer final : public config_state_stream_handler
+{
+ public:
+    config_state_cbor_writer(uint8_t *buffer, size_t size)
+        : buffer_(buffer),
+          size_(size)
+    {
+    }
+
+    /**
+     * Number of bytes written so far.
+     */
+    size_t length() const
+    {
+        return length_;
+    }
+
+    /**
+     * Buffer was too small, all following events were rejected.
+     */
+    bool overflow() const
+    {
+        return overflow_;
+    }
+
+    bool Null() final;
+    bool Bool(bool b) final;
+    bool Int(int i) final;
+    bool Uint(unsigned i) final;
+    bool Int64(int64_t i) final;
+    bool Uint64(uint64_t i) final;
+    bool Double(double d) final;
+    bool String(const char *str, rapidjson::SizeType length, bool copy) final;
+    bool StartObject() final;
+    bool Key(const char *str, rapidjson::SizeType length, bool copy) final;
+    bool EndObject(rapidjson::SizeType count) final;
+    bool StartArray() final;
+    bool EndArray(rapidjson::SizeType count) final;
+
+ private:
+    uint8_t *buffer_;
+    size_t size_;
+    size_t length_ = 0;
+    bool overflow_ = false;
+
+    bool put(const void *data, size_t length);
+    bool put_head(uint8_t major, uint64_t value);
+};
+
+/**
+ * Decodes single CBOR item and emits it as SAX events into given handler.
+ *
+ * @return ESP_OK on success,
+ *         ESP_ERR_INVALID_SIZE if data are truncated or followed by anything else,
+ *         ESP_ERR_INVALID_ARG if data are malformed,
+ *         ESP_ERR_NOT_SUPPORTED if data contain unsupported items or are nested too deep,
+ *         ESP_FAIL if handler rejected an event
+ */
+esp_err_t config_state_cbor_parse(const uint8_t *data, size_t length, config_state_stream_handler &handler);
+
+/**
+ * Encodes instance as CBOR, without building a Document.
+ *
+ * @param length Number of bytes written, on success
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if buffer is too small
+ */
+template<typename S>
+esp_err_t config_state_cbor_encode(const config_state<S> &state, const S &inst, uint8_t *buffer, size_t size, size_t *length)
+{
+    config_state_cbor_writer writer(buffer, size);
+    if (!state.serialize(inst, static_cast<config_state_stream_handler &>(writer)))
+    {
+        return writer.overflow() ? ESP_ERR_INVALID_SIZE : ESP_FAIL;
+    }
+
+    if (length)
+    {
+        *length = writer.length();
+    }
+    return ESP_OK;
+}
+
+/**
+ * Applies CBOR encoded configuration to an instance, with the same rules as config_state_reader.
+ *
+ * @param changed Optional, set to true if value has changed
+ * @return See config_state_cbor_parse
+ */
+template<typename S>
+esp_err_t config_state_cbor_decode(const config_state<S> &state, S &inst, const uint8_t *data, size_t length, bool *changed = nullptr)
+{
+    config_state_reader<S> reader(state, inst);
+    config_state_stream_handler_of<config_state_reader<S>> handler(reader);
+    esp_err_t err = config_state_cbor_parse(data, length, handler);
+
+    if (changed)
+    {
+        *changed = reader.changed();
+    }
+    return err;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "config_state.h"
+#include <cstring>
+
+/**
+ * String of at most N characters, stored inline, zero terminated. Never allocates, neither on read nor on load.
+ *
+ * Values longer than N are invalid, read and load ignore them, same as out of range numbers.
+ *
+ * Usage:
+ * @code
+ * struct mqtt_config
+ * {
+ *     config_state_fixed_string<63> host;
+ * };
+ * state.add_field(&mqtt_config::host, "/host");
+ * @endcode
+ */
+template<size_t N>
+class config_state_fixed_string
+{
+ public:
+    config_state_fixed_string() = default;
+
+    config_state_fixed_string(const char *str) // NOLINT(google-explicit-constructor)
+    {
+        assign(str, std::strlen(str));
+    }
+
+    /**
+     * @return false if value is too long, it is then left unchanged
+     */
+    bool assign(const char *str, size_t length)
+    {
+        if (length > N)
+        {
+            return false;
+        }
+
+        std::memmove(data_, str, length);
+        data_[length] = '\0';
+        length_ = length;
+        return true;
+    }
+
+    bool equals(const char *str, size_t length) const
+    {
+        return length == length_ && std::memcmp(data_, str, length) == 0;
+    }
+
+    const char *c_str() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return length_;
+    }
+
+    bool empty() const
+    {
+        return length_ == 0;
+    }
+
+    static constexpr size_t capacity()
+    {
+        return N;
+    }
+
+    bool operator==(const config_state_fixed_string &other) const
+    {
+        return equals(other.data_, other.length_);
+    }
+
+    bool operator!=(const config_state_fixed_string &other) const
+    {
+        return !(*this == other);
+    }
+
+ private:
+    char data_[N + 1] = {};
+    size_t length_ = 0;
+};
+
+template<size_t N>
+struct config_state_helper<config_state_fixed_string<N>>
+{
+    using T = config_state_fixed_string<N>;
+
+    static bool read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, T &value)
+    {
+        const rapidjson::Value *obj = ptr.Get(root);
+        return obj && read(*obj, value);
+    }
+
+    static bool read(const rapidjson::Value &obj, T &value)
+    {
+        if (!obj.IsString() || value.equals(obj.GetString(), obj.GetStringLength()))
+        {
+            return false;
+        }
+        return value.assign(obj.GetString(), obj.GetStringLength());
+    }
+
+    static bool equals(const T &a, const T &b)
+    {
+        return a == b;
+    }
+
+    static void write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const T &value)
+    {
+        write(ptr.Create(root, allocator), allocator, value);
+    }
+
+    static void write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const T &value)
+    {
+        obj.SetString(value.c_str(), static_cast<rapidjson::SizeType>(value.size()), allocator);
+    }
+
+    static bool serialize(config_state_stream_handler &out, const T &value)
+    {
+        return out.String(value.c_str(), static_cast<rapidjson::SizeType>(value.size()), true); // Same as copied string in DOM
+    }
+
+    static void pack(config_state_blob_writer &out, const T &value)
+    {
+        out.put(value.c_str(), value.size());
+    }
+
+    static void unpack(config_state_blob_reader &in, T &value)
+    {
+        value.assign(reinterpret_cast<const char *>(in.data()), in.remaining());
+    }
+
+    static esp_err_t load(const std::string &key, nvs::NVSHandle &handle, const char *prefix, T &value)
+    {
+        const config_state_nvs_full_key full_key(prefix, key.c_str());
+
+        // Read into a buffer of the same capacity, NVS fails when it is too short
+        char buffer[N + 1];
+        esp_err_t err = handle.get_string(full_key.c_str(), buffer, sizeof(buffer));
+        if (err == ESP_OK)
+        {
+            value.assign(buffer, std::strlen(buffer));
+        }
+        else
+        {
+            config_state_log_load_error("get_string", full_key.c_str(), err);
+        }
+        return err;
+    }
+
+    static esp_err_t store(const std::string &key, nvs::NVSHandle &handle, const char *prefix, const T &value)
+    {
+        const config_state_nvs_full_key full_key(prefix, key.c_str());
+        esp_err_t err = handle.set_string(full_key.c_str(), value.c_str());
+        if (err != ESP_OK)
+        {
+            config_state_logw("failed to set_string %s: %d %s", full_key.c_str(), err, esp_err_to_name(err));
+        }
+        return err;
+    }
+};
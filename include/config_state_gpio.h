@@ -4,7 +4,7 @@
 #include <hal/gpio_types.h>
 
 template<>
-bool config_state_helper<gpio_num_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, gpio_num_t &value);
+bool config_state_helper<gpio_num_t>::read(const rapidjson::Value &obj, gpio_num_t &value);
 
 template<>
 esp_err_t config_state_helper<gpio_num_t>::load(const std::string &key, nvs::NVSHandle &handle, const char *prefix, gpio_num_t &value);
@@ -1,14 +1,220 @@
 #pragma once
 
+#include "config_state_blob.h"
+#include "config_state_stream.h"
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <nvs_handle.hpp>
 #include <rapidjson/pointer.h>
 #include <string>
+#include <type_traits>
+
+#ifndef CONFIG_STATE_STRING_STACK_SIZE
+/**
+ * Strings up to this size (including zero terminator) are loaded from NVS via a stack buffer, and don't allocate
+ * when unchanged.
+ */
+#define CONFIG_STATE_STRING_STACK_SIZE 64
+#endif
+
+#ifndef CONFIG_STATE_POINTER_POOL_CHUNK_SIZE
+/**
+ * Size of a chunk of the shared JSON pointer pool, see config_state_pointer.
+ */
+#define CONFIG_STATE_POINTER_POOL_CHUNK_SIZE 512
+#endif
 
 // internal helper functions
 __attribute__((format(printf, 1, 2))) void config_state_logw(const char *format, ...);
 
 std::string config_state_nvs_key(const std::string &s);
 const char *config_state_nvs_key(const char *s);
+esp_err_t config_state_nvs_erase(nvs::NVSHandle &handle, const char *prefix, const std::string &key);
+esp_err_t config_state_nvs_erase(nvs::NVSHandle &handle, const char *nvs_key);
+bool config_state_nvs_key_equals(const char *nvs_key, const char *prefix, const std::string &key);
+void config_state_log_load_error(const char *operation, const char *nvs_key, esp_err_t err);
+bool config_state_parse_integer(const char *str, size_t length, long long &value);
+bool config_state_parse_integer(const char *str, size_t length, unsigned long long &value);
+void config_state_nvs_list(const char *partition_name, const char *namespace_name, const std::function<void(const char *key)> &callback);
+
+/**
+ * JSON pointer with tokens in a shared pool, instead of its own heap allocations. Pool is filled in chunks, and each
+ * distinct pointer is stored only once, e.g. "/pin" of every list element schema. Pool is never released, the set of
+ * distinct pointers of an application is fixed. Invalid pointers are returned as parsed, with their error.
+ */
+rapidjson::Pointer config_state_pointer(const char *json_ptr);
+
+/**
+ * Heap bytes of the shared pool of JSON pointers, see config_state_pointer.
+ */
+size_t config_state_pointer_pool_footprint();
+
+/**
+ * Heap bytes of given pointer, 0 if its tokens are in the shared pool, otherwise estimated from its tokens.
+ */
+size_t config_state_pointer_footprint(const rapidjson::Pointer &ptr);
+
+/**
+ * Heap bytes of given string, 0 if it is stored inline (short string optimization).
+ */
+inline size_t config_state_string_footprint(const std::string &s)
+{
+    const char *self = reinterpret_cast<const char *>(&s);
+    return s.data() >= self && s.data() < self + sizeof(s) ? 0 : s.capacity() + 1;
+}
+
+/**
+ * While alive, missing NVS keys are not logged by load on this thread, see config_state::load_bulk.
+ */
+class config_state_quiet_missing
+{
+ public:
+    config_state_quiet_missing();
+    ~config_state_quiet_missing();
+
+    // disable copy
+    config_state_quiet_missing(const config_state_quiet_missing &) = delete;
+
+    static bool active();
+
+ private:
+    const bool previous_;
+};
+
+/**
+ * While alive, change callbacks are not called on this thread, e.g. while a replacement is built aside,
+ * see config_state::notify_changes.
+ */
+class config_state_quiet_changes
+{
+ public:
+    config_state_quiet_changes();
+    ~config_state_quiet_changes();
+
+    // disable copy
+    config_state_quiet_changes(const config_state_quiet_changes &) = delete;
+
+    static bool active();
+
+ private:
+    const bool previous_;
+};
+
+/**
+ * Full NVS key, prefix followed by key, without leading '/', see config_state_nvs_key.
+ * Composed in place, without heap allocation. Without prefix, it points directly to the key.
+ * Keys longer than the buffer are cut, but they are still longer than NVS allows, so NVS rejects them the same way.
+ */
+class config_state_nvs_full_key
+{
+ public:
+    config_state_nvs_full_key(const char *prefix, const char *key);
+
+    // disable copy, it might point into itself
+    config_state_nvs_full_key(const config_state_nvs_full_key &) = delete;
+
+    const char *c_str() const
+    {
+        return str_;
+    }
+
+ private:
+    char buffer_[2 * NVS_KEY_NAME_MAX_SIZE];
+    const char *str_;
+};
+
+/**
+ * NVS keys of a list without prefix, "key/len" and "key/0" up to "key/<capacity - 1>", composed once into single
+ * buffer of fixed-size slots. Lists with a prefix, e.g. elements of other lists, compose their keys on the stack.
+ */
+class config_state_list_keys
+{
+ public:
+    config_state_list_keys(const std::string &key, size_t capacity);
+
+    /**
+     * @return Key of the length, or nullptr if not interned
+     */
+    const char *len() const
+    {
+        return count_ > 0 ? &slots_[0] : nullptr;
+    }
+
+    /**
+     * @return Key of given element, or nullptr if not interned
+     */
+    const char *item(size_t index) const
+    {
+        return index + 1 < count_ ? &slots_[(index + 1) * NVS_KEY_NAME_MAX_SIZE] : nullptr;
+    }
+
+    /**
+     * Heap used by the table.
+     */
+    size_t size() const
+    {
+        return count_ * NVS_KEY_NAME_MAX_SIZE;
+    }
+
+ private:
+    std::unique_ptr<char[]> slots_;
+    size_t count_ = 0;
+};
+
+/**
+ * Conversion of map keys from and to JSON member names, which are also part of their NVS keys, see config_state_map.
+ * Implemented for std::string and integer keys.
+ */
+template<typename K, typename Enable = void>
+struct config_state_map_key;
+
+template<>
+struct config_state_map_key<std::string>
+{
+    static bool parse(const char *str, size_t length, std::string &key)
+    {
+        key.assign(str, length);
+        return true;
+    }
+
+    static const char *format(const std::string &key, char (&buffer)[24], size_t &length)
+    {
+        length = key.size();
+        return key.c_str();
+    }
+};
+
+template<typename K>
+struct config_state_map_key<K, typename std::enable_if<std::is_integral<K>::value && !std::is_same<K, bool>::value>::type>
+{
+    using parsed_type = typename std::conditional<std::is_signed<K>::value, long long, unsigned long long>::type;
+
+    /**
+     * @return false if not a decimal number, or out of range of K
+     */
+    static bool parse(const char *str, size_t length, K &key)
+    {
+        parsed_type value = 0;
+        if (!config_state_parse_integer(str, length, value)
+            || value < static_cast<parsed_type>(std::numeric_limits<K>::min())
+            || value > static_cast<parsed_type>(std::numeric_limits<K>::max()))
+        {
+            return false;
+        }
+        key = static_cast<K>(value);
+        return true;
+    }
+
+    static const char *format(const K &key, char (&buffer)[24], size_t &length)
+    {
+        int written = std::is_signed<K>::value ? std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(key))
+                                               : std::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(key));
+        length = written > 0 ? static_cast<size_t>(written) : 0;
+        return buffer;
+    }
+};
 
 /**
  * Serialization and deserialization logic, with custom implementations for standard types.
@@ -33,12 +239,24 @@ struct config_state_helper
     {
         // Find object
         const rapidjson::Value *obj = ptr.Get(root);
+        return obj && read(*obj, value);
+    }
+
+    /**
+     * Same as above, but with JSON value already resolved.
+     *
+     * @param obj JSON value
+     * @param value Value reference
+     * @return true if value has changed, false otherwise
+     */
+    static bool read(const rapidjson::Value &obj, T &value)
+    {
         // Check its type
-        if (obj && obj->Is<T>())
+        if (obj.Is<T>())
         {
             // Get new value
-            T new_value = obj->Get<T>();
-            if (new_value != value)
+            T new_value = obj.Get<T>();
+            if (!equals(new_value, value))
             {
                 // If it is different, update
                 value = new_value;
@@ -48,25 +266,74 @@ struct config_state_helper
         return false;
     }
 
+    /**
+     * Compares two values, the same way read decides whether the value has changed.
+     */
+    static bool equals(const T &a, const T &b)
+    {
+        return a == b;
+    }
+
     static void write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const T &value)
     {
-        ptr.Set<T>(root, value, allocator);
+        write(ptr.Create(root, allocator), allocator, value);
+    }
+
+    /**
+     * Same as above, but with JSON value already resolved.
+     *
+     * @param obj JSON value to be replaced
+     */
+    static void write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const T &value)
+    {
+        obj = rapidjson::Value(value).Move();
+    }
+
+    /**
+     * Emits the value into SAX handler, with the same events as write followed by Accept.
+     *
+     * @return false if handler failed
+     */
+    static bool serialize(config_state_stream_handler &out, const T &value)
+    {
+        return rapidjson::Value(value).Accept(out);
+    }
+
+    /**
+     * Appends value bytes into a blob snapshot record.
+     */
+    static void pack(config_state_blob_writer &out, const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "type needs pack specialization");
+        out.put_value(value);
+    }
+
+    /**
+     * Gets value from a blob snapshot record.
+     * Ignores record of different size, the type has changed.
+     */
+    static void unpack(config_state_blob_reader &in, T &value)
+    {
+        if (in.remaining() == sizeof(T))
+        {
+            in.get_value(value);
+        }
     }
 
     static esp_err_t load(const std::string &key, nvs::NVSHandle &handle, const char *prefix, T &value)
     {
-        const std::string full_key = config_state_nvs_key(prefix && prefix[0] != '\0' ? prefix + key : key);
+        const config_state_nvs_full_key full_key(prefix, key.c_str());
         esp_err_t err = handle.get_item<T>(full_key.c_str(), value);
         if (err != ESP_OK)
         {
-            config_state_logw("failed to get_item %s: %d %s", full_key.c_str(), err, esp_err_to_name(err));
+            config_state_log_load_error("get_item", full_key.c_str(), err);
         }
         return err;
     }
 
     static esp_err_t store(const std::string &key, nvs::NVSHandle &handle, const char *prefix, const T &value)
     {
-        const std::string full_key = config_state_nvs_key(prefix && prefix[0] != '\0' ? prefix + key : key);
+        const config_state_nvs_full_key full_key(prefix, key.c_str());
         esp_err_t err = handle.set_item<T>(full_key.c_str(), value);
         if (err != ESP_OK)
         {
@@ -77,34 +344,55 @@ struct config_state_helper
 };
 
 template<>
-bool config_state_helper<std::string>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, std::string &value);
+bool config_state_helper<std::string>::read(const rapidjson::Value &obj, std::string &value);
+
+template<>
+void config_state_helper<std::string>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const std::string &value);
+
+template<>
+bool config_state_helper<std::string>::serialize(config_state_stream_handler &out, const std::string &value);
+
+template<>
+bool config_state_helper<uint8_t>::read(const rapidjson::Value &obj, uint8_t &value);
+
+template<>
+void config_state_helper<uint8_t>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const uint8_t &value);
+
+template<>
+bool config_state_helper<uint8_t>::serialize(config_state_stream_handler &out, const uint8_t &value);
+
+template<>
+bool config_state_helper<int8_t>::read(const rapidjson::Value &obj, int8_t &value);
+
+template<>
+void config_state_helper<int8_t>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const int8_t &value);
 
 template<>
-void config_state_helper<std::string>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const std::string &value);
+bool config_state_helper<int8_t>::serialize(config_state_stream_handler &out, const int8_t &value);
 
 template<>
-bool config_state_helper<uint8_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, uint8_t &value);
+bool config_state_helper<uint16_t>::read(const rapidjson::Value &obj, uint16_t &value);
 
 template<>
-void config_state_helper<uint8_t>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const uint8_t &value);
+void config_state_helper<uint16_t>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const uint16_t &value);
 
 template<>
-bool config_state_helper<int8_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, int8_t &value);
+bool config_state_helper<uint16_t>::serialize(config_state_stream_handler &out, const uint16_t &value);
 
 template<>
-void config_state_helper<int8_t>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const int8_t &value);
+bool config_state_helper<int16_t>::read(const rapidjson::Value &obj, int16_t &value);
 
 template<>
-bool config_state_helper<uint16_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, uint16_t &value);
+void config_state_helper<int16_t>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const int16_t &value);
 
 template<>
-void config_state_helper<uint16_t>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const uint16_t &value);
+bool config_state_helper<int16_t>::serialize(config_state_stream_handler &out, const int16_t &value);
 
 template<>
-bool config_state_helper<int16_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, int16_t &value);
+void config_state_helper<std::string>::pack(config_state_blob_writer &out, const std::string &value);
 
 template<>
-void config_state_helper<int16_t>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const int16_t &value);
+void config_state_helper<std::string>::unpack(config_state_blob_reader &in, std::string &value);
 
 template<>
 esp_err_t config_state_helper<std::string>::load(const std::string &key, nvs::NVSHandle &handle, const char *prefix, std::string &value);
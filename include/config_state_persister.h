@@ -0,0 +1,188 @@
+#pragma once
+
+#include "config_state.h"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * Stores instances asynchronously, on a dedicated worker thread.
+ *
+ * store() only copies the instance and returns. Requests arriving within the debounce window are coalesced, only the
+ * latest snapshot is written, followed by single commit. Values, which did not change since the previous write,
+ * are skipped, see config_state::store_changed.
+ *
+ * Uses std::thread, on ESP-IDF the worker is a pthread, its stack size is configured by esp_pthread_set_cfg.
+ *
+ * Usage:
+ * @code
+ * config_state_persister<app_config> persister(*APP_CONFIG_STATE, *handle);
+ * persister.store(config); // any task, any time
+ * // ...
+ * persister.flush(); // before OTA restart
+ * @endcode
+ *
+ * @tparam S Type of the root instance, must be copyable
+ */
+template<typename S>
+class config_state_persister
+{
+ public:
+    /**
+     * @param state Schema, must outlive the persister
+     * @param handle Storage, must outlive the persister, and must not be used by anything else meanwhile
+     * @param debounce Delay between first pending request and the write
+     */
+    config_state_persister(const config_state<S> &state, nvs::NVSHandle &handle, std::chrono::milliseconds debounce = std::chrono::milliseconds(500), const char *prefix = nullptr)
+        : state_(state),
+          handle_(handle),
+          debounce_(debounce),
+          prefix_(prefix ? prefix : "")
+    {
+        worker_ = std::thread(&config_state_persister::run, this);
+    }
+
+    // disable copy
+    config_state_persister(const config_state_persister &) = delete;
+
+    /**
+     * Writes pending snapshot and stops the worker.
+     */
+    ~config_state_persister()
+    {
+        flush();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        worker_.join();
+    }
+
+    /**
+     * Schedules store of a snapshot of given instance, replacing any pending one.
+     */
+    void store(const S &inst)
+    {
+        std::unique_ptr<S> snapshot(new S(inst)); // Copy outside of the lock
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!pending_)
+            {
+                // Window starts with the first request, so a stream of requests can't postpone the write forever
+                deadline_ = std::chrono::steady_clock::now() + debounce_;
+            }
+            pending_ = std::move(snapshot);
+            requested_++;
+        }
+        cond_.notify_all();
+    }
+
+    /**
+     * Writes pending snapshot immediately, and waits until it is committed.
+     *
+     * @return Result of the last write
+     */
+    esp_err_t flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint32_t target = requested_;
+        flush_ |= pending_ != nullptr; // Otherwise it is already being written, or there is nothing to write
+        cond_.notify_all();
+        // Requests arriving meanwhile might be written together with the target, so written_ can pass it
+        cond_.wait(lock, [&]() { return static_cast<int32_t>(written_ - target) >= 0; });
+        return last_err_;
+    }
+
+    /**
+     * Whether there is a snapshot waiting to be written, or being written.
+     */
+    bool pending() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return written_ != requested_;
+    }
+
+    /**
+     * Result of the last write.
+     */
+    esp_err_t last_error() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return last_err_;
+    }
+
+ private:
+    const config_state<S> &state_;
+    nvs::NVSHandle &handle_;
+    const std::chrono::milliseconds debounce_;
+    const std::string prefix_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread worker_;
+    std::unique_ptr<S> pending_;
+    std::chrono::steady_clock::time_point deadline_;
+    uint32_t requested_ = 0; // Generation of the latest request
+    uint32_t written_ = 0;   // Generation of the latest write
+    bool flush_ = false;
+    bool stop_ = false;
+    esp_err_t last_err_ = ESP_OK;
+
+    std::unique_ptr<S> persisted_; // Last written snapshot, owned by the worker
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_)
+        {
+            if (!pending_)
+            {
+                cond_.wait(lock);
+                continue;
+            }
+
+            if (!flush_ && cond_.wait_until(lock, deadline_) != std::cv_status::timeout)
+            {
+                continue; // Woken up early, e.g. flush, re-evaluate
+            }
+
+            // Take the snapshot, write it without holding the lock
+            std::unique_ptr<S> snapshot = std::move(pending_);
+            uint32_t generation = requested_;
+            flush_ = false;
+            lock.unlock();
+
+            esp_err_t err = write(*snapshot);
+
+            lock.lock();
+            last_err_ = err;
+            written_ = generation;
+            cond_.notify_all();
+        }
+    }
+
+    esp_err_t write(const S &snapshot)
+    {
+        esp_err_t err;
+        if (persisted_)
+        {
+            err = state_.store_changed(snapshot, *persisted_, handle_, prefix_.c_str());
+        }
+        else
+        {
+            err = state_.store(snapshot, handle_, prefix_.c_str());
+            if (err == ESP_OK)
+            {
+                persisted_.reset(new S(snapshot));
+            }
+        }
+
+        esp_err_t commit_err = handle_.commit();
+        return err != ESP_OK ? err : commit_err;
+    }
+};
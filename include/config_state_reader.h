@@ -0,0 +1,284 @@
+#pragma once
+
+#include "config_state.h"
+#include <memory>
+#include <rapidjson/reader.h>
+#include <vector>
+
+/**
+ * SAX handler, which applies parsed JSON directly to an instance, without building a Document.
+ *
+ * Values are read with the same rules as config_state::read, e.g. values of invalid type are ignored. Whole document is
+ * never held in memory, only states reading an object or array as a whole (custom config_state implementations without
+ * streaming support) get that value built as DOM.
+ *
+ * Usage:
+ * @code
+ * config_state_reader<app_config> handler(*APP_CONFIG_STATE, config);
+ * rapidjson::Reader reader;
+ * rapidjson::StringStream stream(json);
+ * reader.Parse(stream, handler);
+ * bool changed = handler.changed();
+ * @endcode
+ *
+ * @tparam S Type of the root instance
+ */
+template<typename S>
+class config_state_reader : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, config_state_reader<S>>
+{
+ public:
+    config_state_reader(const config_state<S> &state, S &inst)
+        : state_(state),
+          inst_(inst)
+    {
+        reset();
+    }
+
+    // disable copy
+    config_state_reader(const config_state_reader &) = delete;
+
+    /**
+     * Prepares handler for another document.
+     */
+    void reset()
+    {
+        consumers_.clear();
+        frames_.clear();
+        captures_.clear();
+        pending_.clear();
+        changed_ = false;
+
+        state_.read_stream(inst_, pending_);
+    }
+
+    /**
+     * @return true if any value has changed, false otherwise
+     */
+    bool changed() const
+    {
+        return changed_;
+    }
+
+    bool Null()
+    {
+        return scalar(rapidjson::Value());
+    }
+
+    bool Bool(bool b)
+    {
+        return scalar(rapidjson::Value(b));
+    }
+
+    bool Int(int i)
+    {
+        return scalar(rapidjson::Value(i));
+    }
+
+    bool Uint(unsigned i)
+    {
+        return scalar(rapidjson::Value(i));
+    }
+
+    bool Int64(int64_t i)
+    {
+        return scalar(rapidjson::Value(i));
+    }
+
+    bool Uint64(uint64_t i)
+    {
+        return scalar(rapidjson::Value(i));
+    }
+
+    bool Double(double d)
+    {
+        return scalar(rapidjson::Value(d));
+    }
+
+    bool String(const char *str, rapidjson::SizeType length, bool copy)
+    {
+        return scalar(rapidjson::Value(str, length)); // NOTE const string, it does not copy
+    }
+
+    bool StartObject()
+    {
+        return begin(false);
+    }
+
+    bool Key(const char *str, rapidjson::SizeType length, bool copy)
+    {
+        for (auto &capture : captures_)
+        {
+            capture->stack.emplace_back(str, length, capture->doc.GetAllocator());
+        }
+
+        pending_.clear();
+        for (size_t i = frames_.back().begin; i < consumers_.size(); i++)
+        {
+            consumers_[i].target->stream_member(consumers_[i], str, length, pending_);
+        }
+        return true;
+    }
+
+    bool EndObject(rapidjson::SizeType count)
+    {
+        return end(count);
+    }
+
+    bool StartArray()
+    {
+        return begin(true);
+    }
+
+    bool EndArray(rapidjson::SizeType count)
+    {
+        return end(count);
+    }
+
+ private:
+    struct frame
+    {
+        size_t begin;              // Index of first consumer of this object or array
+        rapidjson::SizeType index; // Index of next array element
+        bool array;
+    };
+
+    struct capture
+    {
+        config_state_stream_consumer consumer;
+        size_t depth;
+        rapidjson::Document doc;
+        std::vector<rapidjson::Value> stack;
+    };
+
+    const config_state<S> &state_;
+    S &inst_;
+    config_state_stream_consumers consumers_; // Consumers of all open objects and arrays, see frame::begin
+    config_state_stream_consumers pending_;   // Consumers of next value
+    std::vector<frame> frames_;
+    std::vector<std::unique_ptr<capture>> captures_;
+    bool changed_ = false;
+
+    void next_element()
+    {
+        if (frames_.empty() || !frames_.back().array)
+        {
+            return; // Root or object member, already prepared
+        }
+
+        frame &top = frames_.back();
+        pending_.clear();
+        for (size_t i = top.begin; i < consumers_.size(); i++)
+        {
+            consumers_[i].target->stream_element(consumers_[i], top.index, pending_);
+        }
+        top.index++;
+    }
+
+    bool scalar(const rapidjson::Value &value)
+    {
+        next_element();
+
+        for (const auto &consumer : pending_)
+        {
+            changed_ |= consumer.target->stream_scalar(consumer, value);
+        }
+        pending_.clear();
+
+        for (auto &capture : captures_)
+        {
+            capture->stack.emplace_back(value, capture->doc.GetAllocator(), true); // Strings are valid only during this call
+        }
+        return true;
+    }
+
+    bool begin(bool array)
+    {
+        next_element();
+
+        for (auto &capture : captures_)
+        {
+            capture->stack.emplace_back(array ? rapidjson::kArrayType : rapidjson::kObjectType);
+        }
+
+        frame f = {consumers_.size(), 0, array};
+        for (auto &consumer : pending_)
+        {
+            switch (consumer.target->stream_begin(consumer, array))
+            {
+            case config_state_stream_members:
+                consumers_.push_back(consumer);
+                break;
+            case config_state_stream_capture:
+            {
+                std::unique_ptr<capture> c(new capture());
+                c->consumer = consumer;
+                c->depth = frames_.size();
+                c->stack.emplace_back(array ? rapidjson::kArrayType : rapidjson::kObjectType);
+                captures_.push_back(std::move(c));
+                break;
+            }
+            case config_state_stream_ignore:
+                break;
+            }
+        }
+        pending_.clear();
+        frames_.push_back(f);
+        return true;
+    }
+
+    bool end(rapidjson::SizeType count)
+    {
+        frame top = frames_.back();
+        frames_.pop_back();
+
+        for (size_t i = top.begin; i < consumers_.size(); i++)
+        {
+            changed_ |= consumers_[i].target->stream_end(consumers_[i], count);
+        }
+        consumers_.resize(top.begin);
+
+        // Finish values being captured
+        for (auto it = captures_.begin(); it != captures_.end();)
+        {
+            capture &c = **it;
+            end_captured(c, top.array, count);
+
+            if (c.depth == frames_.size())
+            {
+                changed_ |= c.consumer.target->stream_captured(c.consumer, c.stack.back());
+                it = captures_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        pending_.clear();
+        return true;
+    }
+
+    static void end_captured(capture &c, bool array, rapidjson::SizeType count)
+    {
+        auto &allocator = c.doc.GetAllocator();
+        size_t base = c.stack.size() - (array ? count : count * 2);
+        rapidjson::Value &container = c.stack[base - 1];
+
+        if (array)
+        {
+            container.Reserve(count, allocator);
+            for (size_t i = base; i < c.stack.size(); i++)
+            {
+                container.PushBack(c.stack[i], allocator);
+            }
+        }
+        else
+        {
+            for (size_t i = base; i < c.stack.size(); i += 2)
+            {
+                container.AddMember(c.stack[i], c.stack[i + 1], allocator);
+            }
+        }
+        c.stack.resize(base);
+    }
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "config_state.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+/**
+ * Published immutable versions of an instance, for readers on other tasks or cores, without locks on the read side.
+ *
+ * Versions live in a fixed pool of N slots. Readers pin the current slot by a reader counter, writers copy the current
+ * version into a slot, which is neither current nor pinned, modify the copy and publish it by single atomic store.
+ * A slot is reused only after its last reader released it. Writers are serialized by a mutex, readers never block.
+ *
+ * Readers should hold their handle briefly, when all spare slots are pinned, writer waits until one is released.
+ *
+ * Usage:
+ * @code
+ * config_state_snapshot<app_config> config;
+ * config.read(*APP_CONFIG_STATE, doc); // writer
+ * auto current = config.acquire();     // reader
+ * use(current->pin);
+ * @endcode
+ *
+ * @tparam S Type of the root instance, must be default constructible and copyable
+ * @tparam N Number of slots, at least 2
+ */
+template<typename S, size_t N = 3>
+class config_state_snapshot
+{
+    static_assert(N >= 2, "at least one spare slot is needed");
+
+    struct slot
+    {
+        S value;
+        std::atomic<uint32_t> readers{0};
+    };
+
+ public:
+    /**
+     * Pinned version, released when destroyed.
+     */
+    class handle
+    {
+     public:
+        handle(handle &&other) noexcept
+            : slot_(other.slot_)
+        {
+            other.slot_ = nullptr;
+        }
+
+        handle(const handle &) = delete;
+        handle &operator=(const handle &) = delete;
+
+        ~handle()
+        {
+            if (slot_)
+            {
+                slot_->readers.fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        const S &operator*() const
+        {
+            return slot_->value;
+        }
+
+        const S *operator->() const
+        {
+            return &slot_->value;
+        }
+
+     private:
+        friend class config_state_snapshot;
+
+        explicit handle(slot *s)
+            : slot_(s)
+        {
+        }
+
+        slot *slot_;
+    };
+
+    explicit config_state_snapshot(const S &initial = S())
+    {
+        slots_[0].value = initial;
+    }
+
+    // disable copy
+    config_state_snapshot(const config_state_snapshot &) = delete;
+
+    /**
+     * Pins current version, never blocks.
+     */
+    handle acquire() const
+    {
+        while (true)
+        {
+            size_t index = current_.load();
+            slot &s = slots_[index];
+            s.readers.fetch_add(1);
+
+            // Slot is safe to read only if it is still current after pinning, otherwise a writer might reuse it
+            if (current_.load() == index)
+            {
+                return handle(&s);
+            }
+            s.readers.fetch_sub(1);
+        }
+    }
+
+    /**
+     * Number of published versions, including the initial one.
+     */
+    uint32_t version() const
+    {
+        return version_.load();
+    }
+
+    /**
+     * Applies given function to a copy of current version, and publishes it if the function returns true.
+     *
+     * @param fn Callable with signature bool(S &)
+     * @return Result of the function
+     */
+    template<typename F>
+    bool update(F &&fn)
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+
+        size_t current = current_.load();
+        slot &target = slots_[acquire_spare(current)];
+        target.value = slots_[current].value;
+
+        if (!fn(target.value))
+        {
+            return false;
+        }
+
+        current_.store(static_cast<size_t>(&target - slots_));
+        version_.fetch_add(1);
+        return true;
+    }
+
+    /**
+     * Reads JSON into a new version, published only if anything has changed, see config_state::read.
+     */
+    bool read(const config_state<S> &state, const rapidjson::Value &root)
+    {
+        return update([&](S &inst) { return state.read(inst, root); });
+    }
+
+    /**
+     * Loads a new version from the storage and publishes it, see config_state::load.
+     */
+    esp_err_t load(const config_state<S> &state, nvs::NVSHandle &handle, const char *prefix = nullptr)
+    {
+        esp_err_t err = ESP_OK;
+        update([&](S &inst) {
+            err = state.load(inst, handle, prefix);
+            return true; // Partially loaded values are applied as well
+        });
+        return err;
+    }
+
+ private:
+    mutable slot slots_[N];
+    std::atomic<size_t> current_{0};
+    std::atomic<uint32_t> version_{1};
+    std::mutex writer_mutex_;
+
+    size_t acquire_spare(size_t current)
+    {
+        while (true)
+        {
+            for (size_t i = 0; i < N; i++)
+            {
+                // Reader pinning this slot after the check will see it is not current, and retry
+                if (i != current && slots_[i].readers.load() == 0)
+                {
+                    return i;
+                }
+            }
+            std::this_thread::yield(); // All spare slots are pinned by long-lived handles
+        }
+    }
+};
@@ -0,0 +1,364 @@
+#pragma once
+
+#include "config_state.h"
+#include <tuple>
+#include <utility>
+
+// internal helper functions, resolving JSON pointer strings in place, without rapidjson::Pointer tokens
+const rapidjson::Value *config_state_pointer_get(const rapidjson::Value &root, const char *json_ptr);
+const rapidjson::Value *config_state_pointer_get_patch(const rapidjson::Value &patch, const char *json_ptr);
+rapidjson::Value &config_state_pointer_create(rapidjson::Value &root, const char *json_ptr, rapidjson::Value::AllocatorType &allocator);
+
+/**
+ * Single field of config_state_schema, see config_state_static_field_of.
+ *
+ * Unlike config_state_field, it does not own anything, pointer and key must be string literals
+ * (created JSON member names reference them directly).
+ */
+template<typename S, typename T>
+struct config_state_static_field
+{
+    T S::*field;
+    const char *json_ptr;
+    const char *nvs_key;
+    config_state_flags flags;
+
+    bool read(S &inst, const rapidjson::Value &root) const
+    {
+        if ((flags & config_state_disable_read) == 0)
+        {
+            const rapidjson::Value *value = config_state_pointer_get(root, json_ptr);
+            return value && config_state_helper<T>::read(*value, inst.*field);
+        }
+        return false;
+    }
+
+    void write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const
+    {
+        if ((flags & config_state_disable_write) == 0)
+        {
+            config_state_helper<T>::write(config_state_pointer_create(root, json_ptr, allocator), allocator, inst.*field);
+        }
+    }
+
+    bool write_diff(const S &current, const S &baseline, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const
+    {
+        if ((flags & config_state_disable_write) != 0 || equals(current, baseline))
+        {
+            return false;
+        }
+
+        config_state_helper<T>::write(config_state_pointer_create(root, json_ptr, allocator), allocator, current.*field);
+        return true;
+    }
+
+    bool apply_patch(S &inst, const rapidjson::Value &patch) const
+    {
+        if ((flags & config_state_disable_read) == 0)
+        {
+            const rapidjson::Value *value = config_state_pointer_get_patch(patch, json_ptr);
+            return value && (value->IsNull() ? reset(inst) : config_state_helper<T>::read(*value, inst.*field));
+        }
+        return false;
+    }
+
+    bool equals(const S &a, const S &b) const
+    {
+        return config_state_helper<T>::equals(a.*field, b.*field);
+    }
+
+    bool reset(S &inst) const
+    {
+        const T &value = config_state_defaults<S>().*field;
+        if ((flags & config_state_disable_read) != 0 || inst.*field == value)
+        {
+            return false;
+        }
+
+        inst.*field = value;
+        return true;
+    }
+
+    esp_err_t load(S &inst, nvs::NVSHandle &handle, const char *prefix) const
+    {
+        if ((flags & config_state_disable_load) == 0)
+        {
+            return config_state_helper<T>::load(key(), handle, prefix, inst.*field);
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const
+    {
+        if ((flags & config_state_disable_store) == 0)
+        {
+            return config_state_helper<T>::store(key(), handle, prefix, inst.*field);
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix) const
+    {
+        if ((flags & config_state_disable_store) != 0 || inst.*field == persisted.*field)
+        {
+            return ESP_OK;
+        }
+
+        esp_err_t err = config_state_helper<T>::store(key(), handle, prefix, inst.*field);
+        if (err == ESP_OK)
+        {
+            persisted.*field = inst.*field;
+        }
+        return err;
+    }
+
+    esp_err_t erase(nvs::NVSHandle &handle, const char *prefix) const
+    {
+        if ((flags & config_state_disable_store) == 0)
+        {
+            return config_state_nvs_erase(handle, prefix, key());
+        }
+        return ESP_OK;
+    }
+
+    bool owns_key(const char *key_name, const char *prefix) const
+    {
+        return (flags & config_state_disable_store) == 0 && config_state_nvs_key_equals(key_name, prefix, key());
+    }
+
+ private:
+    std::string key() const
+    {
+        return nvs_key ? nvs_key : json_ptr; // NVS keys are short, fits into small string buffer
+    }
+};
+
+/**
+ * Creates field descriptor, with the same arguments as config_state_field constructor.
+ */
+template<typename S, typename T>
+constexpr config_state_static_field<S, T> config_state_static_field_of(T S::*field, const char *json_ptr, const char *nvs_key = nullptr,
+                                                                       config_state_flags flags = config_state_no_flags)
+{
+    return {field, json_ptr, nvs_key, flags};
+}
+
+/**
+ * Compile-time schema, alternative to config_state_set for structures with plain fields.
+ *
+ * All fields are known to the compiler, so every operation is unrolled into a sequence of calls,
+ * without virtual dispatch, heap allocated states or parsed JSON pointers.
+ * Declare it constexpr, so it lives in read-only memory:
+ *
+ *   static constexpr auto APP_SCHEMA = config_state_schema_of<app_config>(
+ *       config_state_static_field_of(&app_config::name, "/name"),
+ *       config_state_static_field_of(&app_config::port, "/port", "p"));
+ *
+ * Lists and nested structures are not supported, use config_state_static adapter to combine it with config_state_set.
+ */
+template<typename S, typename... Fields>
+struct config_state_schema
+{
+    std::tuple<Fields...> fields;
+
+    /**
+     * See config_state::read.
+     */
+    bool read(S &inst, const rapidjson::Value &root) const
+    {
+        return std::apply([&](const Fields &...f) { return (false | ... | f.read(inst, root)); }, fields);
+    }
+
+    /**
+     * See config_state::write.
+     */
+    void write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const
+    {
+        std::apply([&](const Fields &...f) { (f.write(inst, root, allocator), ...); }, fields);
+    }
+
+    /**
+     * See config_state::write_diff.
+     */
+    bool write_diff(const S &current, const S &baseline, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const
+    {
+        return std::apply([&](const Fields &...f) { return (false | ... | f.write_diff(current, baseline, root, allocator)); }, fields);
+    }
+
+    /**
+     * See config_state::apply_patch.
+     */
+    bool apply_patch(S &inst, const rapidjson::Value &patch) const
+    {
+        return std::apply([&](const Fields &...f) { return (false | ... | f.apply_patch(inst, patch)); }, fields);
+    }
+
+    /**
+     * See config_state::equals.
+     */
+    bool equals(const S &a, const S &b) const
+    {
+        return std::apply([&](const Fields &...f) { return (true && ... && f.equals(a, b)); }, fields);
+    }
+
+    /**
+     * See config_state::reset.
+     */
+    bool reset(S &inst) const
+    {
+        return std::apply([&](const Fields &...f) { return (false | ... | f.reset(inst)); }, fields);
+    }
+
+    /**
+     * See config_state::load.
+     */
+    esp_err_t load(S &inst, nvs::NVSHandle &handle, const char *prefix = nullptr) const
+    {
+        esp_err_t last_err = ESP_OK;
+        auto merge = [&last_err](esp_err_t err)
+        {
+            if (err != ESP_OK && (err != ESP_ERR_NVS_NOT_FOUND || last_err == ESP_OK)) // Don't overwrite more important error with NOT_FOUND
+            {
+                last_err = err;
+            }
+        };
+        std::apply([&](const Fields &...f) { (merge(f.load(inst, handle, prefix)), ...); }, fields);
+        return last_err;
+    }
+
+    /**
+     * See config_state::store.
+     */
+    esp_err_t store(const S &inst, nvs::NVSHandle &handle, const char *prefix = nullptr) const
+    {
+        esp_err_t last_err = ESP_OK;
+        std::apply([&](const Fields &...f) { (store_err(last_err, f.store(inst, handle, prefix)), ...); }, fields);
+        return last_err;
+    }
+
+    /**
+     * See config_state::store_changed.
+     */
+    esp_err_t store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix = nullptr) const
+    {
+        esp_err_t last_err = ESP_OK;
+        std::apply([&](const Fields &...f) { (store_err(last_err, f.store_changed(inst, persisted, handle, prefix)), ...); }, fields);
+        return last_err;
+    }
+
+    /**
+     * See config_state::erase.
+     */
+    esp_err_t erase(nvs::NVSHandle &handle, const char *prefix = nullptr) const
+    {
+        esp_err_t last_err = ESP_OK;
+        std::apply([&](const Fields &...f) { (store_err(last_err, f.erase(handle, prefix)), ...); }, fields);
+        return last_err;
+    }
+
+    /**
+     * See config_state::owns_key.
+     */
+    bool owns_key(const char *nvs_key, const char *prefix = nullptr) const
+    {
+        return std::apply([&](const Fields &...f) { return (false || ... || f.owns_key(nvs_key, prefix)); }, fields);
+    }
+
+ private:
+    static void store_err(esp_err_t &last_err, esp_err_t err)
+    {
+        if (err != ESP_OK)
+        {
+            last_err = err;
+        }
+    }
+};
+
+/**
+ * Creates schema of given fields, see config_state_static_field_of.
+ */
+template<typename S, typename... Fields>
+constexpr config_state_schema<S, Fields...> config_state_schema_of(Fields... fields)
+{
+    return {std::tuple<Fields...>(fields...)};
+}
+
+/**
+ * Thin config_state adapter of compile-time schema, so it can be used anywhere config_state is expected,
+ * including config_state_set::add.
+ *
+ * Schema is referenced, not copied, it must outlive the adapter:
+ *
+ *   state.add(new config_state_static<app_config, decltype(APP_SCHEMA)>(APP_SCHEMA));
+ */
+template<typename S, typename Schema>
+struct config_state_static : config_state<S>
+{
+    const Schema &schema;
+
+    explicit config_state_static(const Schema &schema, config_state_flags flags = config_state_no_flags)
+        : config_state<S>(flags),
+          schema(schema)
+    {
+    }
+
+    size_t footprint() const final
+    {
+        return sizeof(*this); // Schema itself is not on heap
+    }
+
+    bool do_read(S &inst, const rapidjson::Value &root) const final
+    {
+        return schema.read(inst, root);
+    }
+
+    void do_write(const S &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        schema.write(inst, root, allocator);
+    }
+
+    bool do_write_diff(const S &current, const S &baseline, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+        return schema.write_diff(current, baseline, root, allocator);
+    }
+
+    bool do_apply_patch(S &inst, const rapidjson::Value &patch) const final
+    {
+        return schema.apply_patch(inst, patch);
+    }
+
+    bool do_equals(const S &a, const S &b) const final
+    {
+        return schema.equals(a, b);
+    }
+
+    bool do_reset(S &inst) const final
+    {
+        return schema.reset(inst);
+    }
+
+    esp_err_t do_load(S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return schema.load(inst, handle, prefix);
+    }
+
+    esp_err_t do_store(const S &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return schema.store(inst, handle, prefix);
+    }
+
+    esp_err_t do_store_changed(const S &inst, S &persisted, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return schema.store_changed(inst, persisted, handle, prefix);
+    }
+
+    esp_err_t do_erase(nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return schema.erase(handle, prefix);
+    }
+
+    bool do_owns_key(const S &inst, const char *nvs_key, const char *prefix) const final
+    {
+        return schema.owns_key(nvs_key, prefix);
+    }
+};
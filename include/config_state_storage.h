@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <nvs_handle.hpp>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Storage backends besides NVS. All of them implement nvs::NVSHandle, so they can be passed anywhere an NVS handle is
+// expected, e.g. config_state::load and config_state::store.
+
+/**
+ * Key-value storage in memory, with the same rules as NVS: key length, typed lookups and size checks.
+ *
+ * Writes are batched, they only modify the map, and commit flushes them at once, see config_state_file_storage.
+ * Not thread-safe.
+ */
+class config_state_memory_storage : public nvs::NVSHandle
+{
+ public:
+    esp_err_t set_string(const char *key, const char *value) override;
+    esp_err_t get_string(const char *key, char *out_str, size_t len) override;
+    esp_err_t get_item_size(nvs::ItemType datatype, const char *key, size_t &size) override;
+    esp_err_t set_blob(const char *key, const void *blob, size_t len) override;
+    esp_err_t get_blob(const char *key, void *blob, size_t len) override;
+    esp_err_t erase_item(const char *key) override;
+    esp_err_t erase_all() override;
+    esp_err_t commit() override;
+    esp_err_t get_used_entry_count(size_t &usedEntries) override;
+
+    /**
+     * All stored keys, in sorted order.
+     */
+    std::vector<std::string> keys() const;
+
+    /**
+     * Whether there are modifications since last commit.
+     */
+    bool dirty() const
+    {
+        return dirty_;
+    }
+
+ protected:
+    struct item
+    {
+        nvs::ItemType type = nvs::ItemType::ANY;
+        std::vector<uint8_t> data;
+    };
+
+    std::map<std::string, item> items_;
+    bool dirty_ = false;
+
+    esp_err_t set_typed_item(nvs::ItemType datatype, const char *key, const void *data, size_t dataSize) override;
+    esp_err_t get_typed_item(nvs::ItemType datatype, const char *key, void *data, size_t dataSize) override;
+
+    /**
+     * Persists all items, called by commit when dirty.
+     */
+    virtual esp_err_t flush()
+    {
+        return ESP_OK;
+    }
+
+ private:
+    esp_err_t write(nvs::ItemType datatype, const char *key, const void *data, size_t size);
+    esp_err_t read(nvs::ItemType datatype, const char *key, void *data, size_t size, bool exact_size) const;
+    esp_err_t find(nvs::ItemType datatype, const char *key, const item *&out) const;
+};
+
+/**
+ * Key-value storage in a single POSIX file, e.g. on LittleFS or SPIFFS.
+ *
+ * Whole file is read by open, all writes are kept in memory, and commit writes the whole file once,
+ * via a temporary file and rename, so the file is never left half-written.
+ *
+ * File is a header, a sequence of items and a CRC32 of everything before it:
+ *   [u8 'C'][u8 'K'][u8 version][u8 reserved] [item]... [u32 crc]
+ * Each item is
+ *   [u8 type][u8 key length][key][u32 length][length bytes]
+ * All numbers are little-endian.
+ */
+class config_state_file_storage : public config_state_memory_storage
+{
+ public:
+    explicit config_state_file_storage(std::string path)
+        : path_(std::move(path))
+    {
+    }
+
+    /**
+     * Reads the file. Missing file is an empty storage.
+     *
+     * @return ESP_OK on success, ESP_FAIL if file can't be read,
+     *         ESP_ERR_INVALID_SIZE, ESP_ERR_INVALID_VERSION or ESP_ERR_INVALID_CRC if file is corrupted (storage is then empty)
+     */
+    esp_err_t open();
+
+    const std::string &path() const
+    {
+        return path_;
+    }
+
+ protected:
+    esp_err_t flush() override;
+
+ private:
+    const std::string path_;
+};
+
+/**
+ * Wrapper of an NVS handle, which lists its namespace once, and then reads only keys which exist. Reads of missing keys
+ * don't reach NVS, they are only counted, see config_state::load_bulk.
+ *
+ * Writes are passed through, and keep the index up to date.
+ */
+class config_state_indexed_handle : public nvs::NVSHandle
+{
+ public:
+    explicit config_state_indexed_handle(nvs::NVSHandle &handle)
+        : handle_(handle)
+    {
+    }
+
+    /**
+     * Lists all keys of given namespace, it must be the one the handle has been opened with.
+     *
+     * @return Number of keys
+     */
+    size_t index(const char *namespace_name, const char *partition_name = NVS_DEFAULT_PART_NAME);
+
+    bool contains(const char *key) const
+    {
+        return key && keys_.count(key) > 0;
+    }
+
+    /**
+     * Number of reads of keys, which don't exist.
+     */
+    size_t missing() const
+    {
+        return missing_;
+    }
+
+    esp_err_t set_string(const char *key, const char *value) override;
+    esp_err_t get_string(const char *key, char *out_str, size_t len) override;
+    esp_err_t get_item_size(nvs::ItemType datatype, const char *key, size_t &size) override;
+    esp_err_t set_blob(const char *key, const void *blob, size_t len) override;
+    esp_err_t get_blob(const char *key, void *blob, size_t len) override;
+    esp_err_t erase_item(const char *key) override;
+    esp_err_t erase_all() override;
+    esp_err_t commit() override;
+    esp_err_t get_used_entry_count(size_t &usedEntries) override;
+
+ protected:
+    esp_err_t set_typed_item(nvs::ItemType datatype, const char *key, const void *data, size_t dataSize) override;
+    esp_err_t get_typed_item(nvs::ItemType datatype, const char *key, void *data, size_t dataSize) override;
+
+ private:
+    nvs::NVSHandle &handle_;
+    std::unordered_set<std::string> keys_;
+    size_t missing_ = 0;
+
+    bool check(const char *key);
+    esp_err_t written(const char *key, esp_err_t err);
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <rapidjson/document.h>
+#include <vector>
+
+// Internal types of streaming (SAX) read and write, see config_state_reader.h and config_state::serialize
+
+struct config_state_stream_target;
+
+/**
+ * How a consumer handles an object or array at its position.
+ */
+enum config_state_stream_mode
+{
+    config_state_stream_ignore,  ///< Skip whole value
+    config_state_stream_members, ///< Receive members or elements, via stream_member and stream_element
+    config_state_stream_capture, ///< Build the value as DOM and receive it, via stream_captured
+};
+
+/**
+ * Receiver of single JSON value, at a position within the document being parsed.
+ */
+struct config_state_stream_consumer
+{
+    const config_state_stream_target *target;
+    void *inst;         ///< Instance, the target reads into
+    const void *cursor; ///< Target specific position, e.g. node of compiled pointers
+    size_t data;        ///< Target specific data
+};
+
+typedef std::vector<config_state_stream_consumer> config_state_stream_consumers;
+
+/**
+ * Part of a schema, which is able to consume streamed JSON values.
+ *
+ * Should not be used directly, it is used by config_state_reader.
+ */
+struct config_state_stream_target
+{
+    virtual ~config_state_stream_target() = default;
+
+    /**
+     * Object or array begins at consumer position.
+     * Consumer is passed to stream_end, with the same data.
+     */
+    virtual config_state_stream_mode stream_begin(config_state_stream_consumer &consumer, bool array) const
+    {
+        return config_state_stream_ignore;
+    }
+
+    /**
+     * Any other value at consumer position.
+     *
+     * @return true if value has changed, false otherwise
+     */
+    virtual bool stream_scalar(const config_state_stream_consumer &consumer, const rapidjson::Value &value) const
+    {
+        return false;
+    }
+
+    /**
+     * Object member begins, appends consumers of its value to out.
+     */
+    virtual void stream_member(const config_state_stream_consumer &consumer, const char *name, rapidjson::SizeType length, config_state_stream_consumers &out) const
+    {
+    }
+
+    /**
+     * Array element begins, appends consumers of its value to out.
+     */
+    virtual void stream_element(const config_state_stream_consumer &consumer, rapidjson::SizeType index, config_state_stream_consumers &out) const
+    {
+    }
+
+    /**
+     * Object or array, which was streamed by members, has ended.
+     *
+     * @param count Number of members or elements
+     * @return true if value has changed, false otherwise
+     */
+    virtual bool stream_end(const config_state_stream_consumer &consumer, rapidjson::SizeType count) const
+    {
+        return false;
+    }
+
+    /**
+     * Object or array, which was captured, has ended.
+     *
+     * @return true if value has changed, false otherwise
+     */
+    virtual bool stream_captured(const config_state_stream_consumer &consumer, const rapidjson::Value &value) const
+    {
+        return false;
+    }
+};
+
+/**
+ * Type-erased rapidjson SAX handler, e.g. rapidjson::Writer, see config_state::serialize.
+ */
+struct config_state_stream_handler
+{
+    virtual ~config_state_stream_handler() = default;
+
+    virtual bool Null() = 0;
+    virtual bool Bool(bool b) = 0;
+    virtual bool Int(int i) = 0;
+    virtual bool Uint(unsigned i) = 0;
+    virtual bool Int64(int64_t i) = 0;
+    virtual bool Uint64(uint64_t i) = 0;
+    virtual bool Double(double d) = 0;
+    virtual bool String(const char *str, rapidjson::SizeType length, bool copy) = 0;
+    virtual bool StartObject() = 0;
+    virtual bool Key(const char *str, rapidjson::SizeType length, bool copy) = 0;
+    virtual bool EndObject(rapidjson::SizeType count) = 0;
+    virtual bool StartArray() = 0;
+    virtual bool EndArray(rapidjson::SizeType count) = 0;
+};
+
+/**
+ * Forwards all events to given handler.
+ *
+ * @tparam Handler Any rapidjson SAX handler
+ */
+template<typename Handler>
+struct config_state_stream_handler_of final : config_state_stream_handler
+{
+    Handler &handler;
+
+    explicit config_state_stream_handler_of(Handler &handler)
+        : handler(handler)
+    {
+    }
+
+    bool Null() final
+    {
+        return handler.Null();
+    }
+
+    bool Bool(bool b) final
+    {
+        return handler.Bool(b);
+    }
+
+    bool Int(int i) final
+    {
+        return handler.Int(i);
+    }
+
+    bool Uint(unsigned i) final
+    {
+        return handler.Uint(i);
+    }
+
+    bool Int64(int64_t i) final
+    {
+        return handler.Int64(i);
+    }
+
+    bool Uint64(uint64_t i) final
+    {
+        return handler.Uint64(i);
+    }
+
+    bool Double(double d) final
+    {
+        return handler.Double(d);
+    }
+
+    bool String(const char *str, rapidjson::SizeType length, bool copy) final
+    {
+        return handler.String(str, length, copy);
+    }
+
+    bool StartObject() final
+    {
+        return handler.StartObject();
+    }
+
+    bool Key(const char *str, rapidjson::SizeType length, bool copy) final
+    {
+        return handler.Key(str, length, copy);
+    }
+
+    bool EndObject(rapidjson::SizeType count) final
+    {
+        return handler.EndObject(count);
+    }
+
+    bool StartArray() final
+    {
+        return handler.StartArray();
+    }
+
+    bool EndArray(rapidjson::SizeType count) final
+    {
+        return handler.EndArray(count);
+    }
+};
@@ -0,0 +1,116 @@
+#include "config_state_blob.h"
+#include <cstring>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "snapshot format is little-endian, values are copied as they are");
+
+static constexpr size_t HEADER_SIZE = 4;
+static constexpr size_t CRC_SIZE = sizeof(uint32_t);
+static constexpr size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+uint32_t config_state_blob_tag(const char *key)
+{
+    if (*key == '/') key++; // Same key as in NVS
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *key; key++)
+    {
+        hash ^= static_cast<uint8_t>(*key);
+        hash *= 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+uint32_t config_state_crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    // Bitwise, snapshots are small and the table would cost 1KB
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+void config_state_blob_writer::begin_snapshot()
+{
+    const uint8_t header[HEADER_SIZE] = {'C', 'S', CONFIG_STATE_BLOB_VERSION, 0};
+    put(header, sizeof(header));
+}
+
+void config_state_blob_writer::end_snapshot()
+{
+    put_value(config_state_crc32(0, buffer_.data(), buffer_.size()));
+}
+
+size_t config_state_blob_writer::begin_record(uint32_t tag)
+{
+    size_t record = buffer_.size();
+    put_value(tag);
+    put_value<uint32_t>(0); // Patched by end_record
+    return record;
+}
+
+void config_state_blob_writer::end_record(size_t record)
+{
+    auto length = static_cast<uint32_t>(buffer_.size() - record - RECORD_HEADER_SIZE);
+    std::memcpy(&buffer_[record + sizeof(uint32_t)], &length, sizeof(length));
+}
+
+void config_state_blob_writer::put(const void *data, size_t length)
+{
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    buffer_.insert(buffer_.end(), bytes, bytes + length);
+}
+
+esp_err_t config_state_blob_reader::open_snapshot(const uint8_t *data, size_t length, config_state_blob_reader &records)
+{
+    if (length < HEADER_SIZE + CRC_SIZE || data[0] != 'C' || data[1] != 'S')
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (data[2] != CONFIG_STATE_BLOB_VERSION)
+    {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    uint32_t crc = 0;
+    std::memcpy(&crc, data + length - CRC_SIZE, CRC_SIZE);
+    if (crc != config_state_crc32(0, data, length - CRC_SIZE))
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    records = config_state_blob_reader(data + HEADER_SIZE, length - HEADER_SIZE - CRC_SIZE);
+    return ESP_OK;
+}
+
+bool config_state_blob_reader::next_record(uint32_t &tag, config_state_blob_reader &record)
+{
+    uint32_t length = 0;
+    if (remaining() < RECORD_HEADER_SIZE || !get_value(tag) || !get_value(length) || remaining() < length)
+    {
+        pos_ = length_; // Malformed, stop reading
+        return false;
+    }
+
+    record = config_state_blob_reader(data(), length);
+    pos_ += length;
+    return true;
+}
+
+bool config_state_blob_reader::get(void *data, size_t length)
+{
+    if (remaining() < length)
+    {
+        return false;
+    }
+
+    std::memcpy(data, this->data(), length);
+    pos_ += length;
+    return true;
+}
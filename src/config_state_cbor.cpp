@@ -0,0 +1,450 @@
+#include "config_state_cbor.h"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+// Major types
+static constexpr uint8_t CBOR_UINT = 0;
+static constexpr uint8_t CBOR_NEGINT = 1;
+static constexpr uint8_t CBOR_BYTES = 2;
+static constexpr uint8_t CBOR_TEXT = 3;
+static constexpr uint8_t CBOR_ARRAY = 4;
+static constexpr uint8_t CBOR_MAP = 5;
+static constexpr uint8_t CBOR_TAG = 6;
+
+// Additional information
+static constexpr uint8_t CBOR_INDEFINITE = 31;
+static constexpr uint8_t CBOR_ARRAY_START = CBOR_ARRAY << 5 | CBOR_INDEFINITE;
+static constexpr uint8_t CBOR_MAP_START = CBOR_MAP << 5 | CBOR_INDEFINITE;
+static constexpr uint8_t CBOR_FALSE = 0xf4;
+static constexpr uint8_t CBOR_TRUE = 0xf5;
+static constexpr uint8_t CBOR_NULL = 0xf6;
+static constexpr uint8_t CBOR_FLOAT32 = 0xfa;
+static constexpr uint8_t CBOR_FLOAT64 = 0xfb;
+static constexpr uint8_t CBOR_BREAK = 0xff;
+
+bool config_state_cbor_writer::put(const void *data, size_t length)
+{
+    if (overflow_ || size_ - length_ < length)
+    {
+        overflow_ = true;
+        return false;
+    }
+
+    std::memcpy(buffer_ + length_, data, length);
+    length_ += length;
+    return true;
+}
+
+bool config_state_cbor_writer::put_head(uint8_t major, uint64_t value)
+{
+    uint8_t head[9] = {};
+    size_t bytes = 0;
+
+    if (value < 24)
+    {
+        head[0] = static_cast<uint8_t>(major << 5 | value);
+    }
+    else
+    {
+        // Shortest of 1, 2, 4 or 8 bytes, big-endian
+        bytes = value <= UINT8_MAX ? 1 : value <= UINT16_MAX ? 2 : value <= UINT32_MAX ? 4 : 8;
+        head[0] = static_cast<uint8_t>(major << 5 | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27));
+        for (size_t i = 0; i < bytes; i++)
+        {
+            head[bytes - i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+    return put(head, bytes + 1);
+}
+
+bool config_state_cbor_writer::Null()
+{
+    return put(&CBOR_NULL, 1);
+}
+
+bool config_state_cbor_writer::Bool(bool b)
+{
+    return put(b ? &CBOR_TRUE : &CBOR_FALSE, 1);
+}
+
+bool config_state_cbor_writer::Int(int i)
+{
+    return Int64(i);
+}
+
+bool config_state_cbor_writer::Uint(unsigned i)
+{
+    return put_head(CBOR_UINT, i);
+}
+
+bool config_state_cbor_writer::Int64(int64_t i)
+{
+    // Negative integer n is encoded as -1 - n
+    return i >= 0 ? put_head(CBOR_UINT, static_cast<uint64_t>(i)) : put_head(CBOR_NEGINT, ~static_cast<uint64_t>(i));
+}
+
+bool config_state_cbor_writer::Uint64(uint64_t i)
+{
+    return put_head(CBOR_UINT, i);
+}
+
+bool config_state_cbor_writer::Double(double d)
+{
+    uint8_t data[9] = {};
+    size_t bytes;
+    uint64_t bits;
+
+    auto f = static_cast<float>(d);
+    if (static_cast<double>(f) == d || std::isnan(d))
+    {
+        // Lossless as single precision, e.g. float fields
+        uint32_t bits32;
+        std::memcpy(&bits32, &f, sizeof(bits32));
+        data[0] = CBOR_FLOAT32;
+        bits = bits32;
+        bytes = 4;
+    }
+    else
+    {
+        std::memcpy(&bits, &d, sizeof(bits));
+        data[0] = CBOR_FLOAT64;
+        bytes = 8;
+    }
+
+    for (size_t i = 0; i < bytes; i++)
+    {
+        data[bytes - i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+    return put(data, bytes + 1);
+}
+
+bool config_state_cbor_writer::String(const char *str, rapidjson::SizeType length, bool copy)
+{
+    return put_head(CBOR_TEXT, length) && put(str, length);
+}
+
+bool config_state_cbor_writer::StartObject()
+{
+    return put(&CBOR_MAP_START, 1);
+}
+
+bool config_state_cbor_writer::Key(const char *str, rapidjson::SizeType length, bool copy)
+{
+    return String(str, length, copy);
+}
+
+bool config_state_cbor_writer::EndObject(rapidjson::SizeType count)
+{
+    return put(&CBOR_BREAK, 1);
+}
+
+bool config_state_cbor_writer::StartArray()
+{
+    return put(&CBOR_ARRAY_START, 1);
+}
+
+bool config_state_cbor_writer::EndArray(rapidjson::SizeType count)
+{
+    return put(&CBOR_BREAK, 1);
+}
+
+namespace
+{
+class cbor_parser
+{
+ public:
+    cbor_parser(const uint8_t *data, size_t length, config_state_stream_handler &handler)
+        : pos_(data),
+          end_(data + length),
+          handler_(handler)
+    {
+    }
+
+    esp_err_t parse()
+    {
+        esp_err_t err = parse_item(0);
+        if (err == ESP_OK && pos_ != end_)
+        {
+            return ESP_ERR_INVALID_SIZE; // Trailing data
+        }
+        return err;
+    }
+
+ private:
+    const uint8_t *pos_;
+    const uint8_t *end_;
+    config_state_stream_handler &handler_;
+
+    esp_err_t get_uint(size_t bytes, uint64_t &value)
+    {
+        if (static_cast<size_t>(end_ - pos_) < bytes)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        value = 0;
+        for (size_t i = 0; i < bytes; i++)
+        {
+            value = value << 8 | *pos_++;
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t get_argument(uint8_t info, uint64_t &value)
+    {
+        if (info < 24)
+        {
+            value = info;
+            return ESP_OK;
+        }
+        if (info <= 27)
+        {
+            return get_uint(size_t(1) << (info - 24), value);
+        }
+        return ESP_ERR_INVALID_ARG; // Reserved, or indefinite where not allowed
+    }
+
+    bool at_break()
+    {
+        if (pos_ < end_ && *pos_ == CBOR_BREAK)
+        {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    static double half_to_double(uint16_t half)
+    {
+        int exponent = (half >> 10) & 0x1f;
+        int mantissa = half & 0x3ff;
+        double value;
+        if (exponent == 0)
+        {
+            value = std::ldexp(mantissa, -24);
+        }
+        else if (exponent != 31)
+        {
+            value = std::ldexp(mantissa + 1024, exponent - 25);
+        }
+        else
+        {
+            value = mantissa == 0 ? INFINITY : NAN;
+        }
+        return half & 0x8000 ? -value : value;
+    }
+
+    esp_err_t check(bool accepted)
+    {
+        return accepted ? ESP_OK : ESP_FAIL;
+    }
+
+    esp_err_t parse_text(uint8_t info, const char *&str, rapidjson::SizeType &length)
+    {
+        if (info == CBOR_INDEFINITE)
+        {
+            return ESP_ERR_NOT_SUPPORTED; // Chunked text
+        }
+
+        uint64_t value = 0;
+        esp_err_t err = get_argument(info, value);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        if (value > static_cast<uint64_t>(end_ - pos_))
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        str = reinterpret_cast<const char *>(pos_);
+        length = static_cast<rapidjson::SizeType>(value);
+        pos_ += value;
+        return ESP_OK;
+    }
+
+    esp_err_t parse_item(size_t depth)
+    {
+        if (pos_ >= end_)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        uint8_t initial = *pos_++;
+        uint8_t major = initial >> 5;
+        uint8_t info = initial & 0x1f;
+        uint64_t value = 0;
+        esp_err_t err;
+
+        switch (major)
+        {
+        case CBOR_UINT:
+            err = get_argument(info, value);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            return check(value <= UINT32_MAX ? handler_.Uint(static_cast<unsigned>(value)) : handler_.Uint64(value));
+
+        case CBOR_NEGINT:
+            err = get_argument(info, value);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            if (value > INT64_MAX)
+            {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            return check(value <= INT32_MAX ? handler_.Int(-1 - static_cast<int>(value)) : handler_.Int64(-1 - static_cast<int64_t>(value)));
+
+        case CBOR_BYTES:
+            return ESP_ERR_NOT_SUPPORTED;
+
+        case CBOR_TEXT:
+        {
+            const char *str = nullptr;
+            rapidjson::SizeType length = 0;
+            err = parse_text(info, str, length);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            return check(handler_.String(str, length, true));
+        }
+
+        case CBOR_ARRAY:
+        case CBOR_MAP:
+            return parse_container(major == CBOR_MAP, info, depth);
+
+        case CBOR_TAG:
+            // Semantic tags are ignored, tagged item is decoded as it is
+            err = get_argument(info, value);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            return depth < CONFIG_STATE_CBOR_MAX_DEPTH ? parse_item(depth + 1) : ESP_ERR_NOT_SUPPORTED;
+
+        default:
+            return parse_simple(initial, info);
+        }
+    }
+
+    esp_err_t parse_simple(uint8_t initial, uint8_t info)
+    {
+        uint64_t bits = 0;
+        esp_err_t err;
+
+        switch (initial)
+        {
+        case CBOR_FALSE:
+            return check(handler_.Bool(false));
+        case CBOR_TRUE:
+            return check(handler_.Bool(true));
+        case CBOR_NULL:
+        case CBOR_NULL + 1: // undefined
+            return check(handler_.Null());
+        case CBOR_FLOAT32 - 1:
+            err = get_uint(2, bits);
+            return err != ESP_OK ? err : check(handler_.Double(half_to_double(static_cast<uint16_t>(bits))));
+        case CBOR_FLOAT32:
+        {
+            err = get_uint(4, bits);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            auto bits32 = static_cast<uint32_t>(bits);
+            float f;
+            std::memcpy(&f, &bits32, sizeof(f));
+            return check(handler_.Double(f));
+        }
+        case CBOR_FLOAT64:
+        {
+            err = get_uint(8, bits);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return check(handler_.Double(d));
+        }
+        case CBOR_BREAK:
+            return ESP_ERR_INVALID_ARG; // Outside of indefinite container
+        default:
+            return info <= 24 ? ESP_ERR_NOT_SUPPORTED : ESP_ERR_INVALID_ARG; // Other simple values, or reserved
+        }
+    }
+
+    esp_err_t parse_container(bool map, uint8_t info, size_t depth)
+    {
+        if (depth >= CONFIG_STATE_CBOR_MAX_DEPTH)
+        {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+
+        bool indefinite = info == CBOR_INDEFINITE;
+        uint64_t count = 0;
+        if (!indefinite)
+        {
+            esp_err_t err = get_argument(info, count);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            if (count > static_cast<uint64_t>(end_ - pos_))
+            {
+                return ESP_ERR_INVALID_SIZE; // Every item takes at least one byte
+            }
+        }
+
+        esp_err_t err = check(map ? handler_.StartObject() : handler_.StartArray());
+
+        rapidjson::SizeType n = 0;
+        while (err == ESP_OK && (indefinite ? !at_break() : n < count))
+        {
+            if (map)
+            {
+                // Keys must be text, same as JSON
+                if (pos_ >= end_)
+                {
+                    return ESP_ERR_INVALID_SIZE;
+                }
+                uint8_t initial = *pos_++;
+                if (initial >> 5 != CBOR_TEXT)
+                {
+                    return ESP_ERR_NOT_SUPPORTED;
+                }
+
+                const char *key = nullptr;
+                rapidjson::SizeType length = 0;
+                err = parse_text(initial & 0x1f, key, length);
+                if (err == ESP_OK)
+                {
+                    err = check(handler_.Key(key, length, true));
+                }
+            }
+            if (err == ESP_OK)
+            {
+                err = parse_item(depth + 1);
+            }
+            n++;
+        }
+
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        return check(map ? handler_.EndObject(n) : handler_.EndArray(n));
+    }
+};
+} // namespace
+
+esp_err_t config_state_cbor_parse(const uint8_t *data, size_t length, config_state_stream_handler &handler)
+{
+    assert(data || length == 0);
+    return cbor_parser(data, length, handler).parse();
+}
@@ -6,10 +6,10 @@ static inline bool is_valid_gpio(int gpio_num)
 }
 
 template<>
-bool config_state_helper<gpio_num_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, gpio_num_t &value)
+bool config_state_helper<gpio_num_t>::read(const rapidjson::Value &obj, gpio_num_t &value)
 {
     int num = value;
-    bool changed = config_state_helper<int>::read(ptr, root, num);
+    bool changed = config_state_helper<int>::read(obj, num);
     if (changed && is_valid_gpio(num))
     {
         value = static_cast<gpio_num_t>(num);
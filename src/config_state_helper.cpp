@@ -1,6 +1,14 @@
 #include "config_state_helper.h"
+#include <algorithm>
+#include <cerrno>
 #include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <esp_idf_version.h>
 #include <esp_log.h>
+#include <mutex>
+#include <vector>
 
 static const char TAG[] = "config_state";
 
@@ -15,6 +23,267 @@ void config_state_logw(const char *format, ...)
     }
 }
 
+static thread_local bool quiet_missing = false;
+
+config_state_quiet_missing::config_state_quiet_missing()
+    : previous_(quiet_missing)
+{
+    quiet_missing = true;
+}
+
+config_state_quiet_missing::~config_state_quiet_missing()
+{
+    quiet_missing = previous_;
+}
+
+bool config_state_quiet_missing::active()
+{
+    return quiet_missing;
+}
+
+static thread_local bool quiet_changes = false;
+
+config_state_quiet_changes::config_state_quiet_changes()
+    : previous_(quiet_changes)
+{
+    quiet_changes = true;
+}
+
+config_state_quiet_changes::~config_state_quiet_changes()
+{
+    quiet_changes = previous_;
+}
+
+bool config_state_quiet_changes::active()
+{
+    return quiet_changes;
+}
+
+void config_state_log_load_error(const char *operation, const char *nvs_key, esp_err_t err)
+{
+    if (err != ESP_ERR_NVS_NOT_FOUND || !quiet_missing)
+    {
+        config_state_logw("failed to %s %s: %d %s", operation, nvs_key, err, esp_err_to_name(err));
+    }
+}
+
+/**
+ * Copies a number into zero terminated buffer, for strtoll and strtoull. Only plain decimal digits are accepted,
+ * optionally with leading minus, so there is a single member name for each number.
+ */
+static bool integer_buffer(const char *str, size_t length, bool negative_allowed, char (&buffer)[24])
+{
+    if (length == 0 || length >= sizeof(buffer))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        if ((str[i] < '0' || str[i] > '9') && !(i == 0 && negative_allowed && str[i] == '-' && length > 1))
+        {
+            return false;
+        }
+    }
+    std::memcpy(buffer, str, length);
+    buffer[length] = '\0';
+    return true;
+}
+
+bool config_state_parse_integer(const char *str, size_t length, long long &value)
+{
+    char buffer[24];
+    if (!integer_buffer(str, length, true, buffer))
+    {
+        return false;
+    }
+    errno = 0;
+    value = std::strtoll(buffer, nullptr, 10);
+    return errno == 0;
+}
+
+bool config_state_parse_integer(const char *str, size_t length, unsigned long long &value)
+{
+    char buffer[24];
+    if (!integer_buffer(str, length, false, buffer))
+    {
+        return false;
+    }
+    errno = 0;
+    value = std::strtoull(buffer, nullptr, 10);
+    return errno == 0;
+}
+
+/**
+ * Shared JSON pointer tokens, see config_state_pointer. Entries are sorted by hash of their source text.
+ */
+struct pointer_pool
+{
+    struct entry
+    {
+        uint32_t hash;
+        size_t length;
+        const char *text;
+        const rapidjson::Pointer::Token *tokens;
+        size_t count;
+    };
+
+    struct chunk
+    {
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+    };
+
+    std::mutex mutex;
+    std::vector<chunk> chunks;
+    size_t chunk_used = 0;
+    size_t allocated = 0;
+    std::vector<entry> entries;
+
+    void *allocate(size_t size, size_t alignment)
+    {
+        chunk_used = (chunk_used + alignment - 1) / alignment * alignment;
+        if (chunks.empty() || chunk_used + size > chunks.back().capacity)
+        {
+            size_t capacity = std::max<size_t>(size, CONFIG_STATE_POINTER_POOL_CHUNK_SIZE);
+            chunks.push_back({std::unique_ptr<char[]>(new char[capacity]), capacity});
+            chunk_used = 0;
+            allocated += capacity;
+        }
+
+        void *data = chunks.back().data.get() + chunk_used;
+        chunk_used += size;
+        return data;
+    }
+
+    bool owns(const void *data) const
+    {
+        for (const auto &c : chunks)
+        {
+            if (data >= c.data.get() && data < c.data.get() + c.capacity)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+static pointer_pool &shared_pointer_pool()
+{
+    // Never destroyed, static schemas might outlive it otherwise
+    static auto *pool = new pointer_pool();
+    return *pool;
+}
+
+static bool pointer_pool_entry_less(const pointer_pool::entry &entry, uint32_t hash)
+{
+    return entry.hash < hash;
+}
+
+rapidjson::Pointer config_state_pointer(const char *json_ptr)
+{
+    assert(json_ptr);
+    size_t length = std::strlen(json_ptr);
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ static_cast<uint8_t>(json_ptr[i])) * 16777619u;
+    }
+
+    auto &pool = shared_pointer_pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    auto it = std::lower_bound(pool.entries.begin(), pool.entries.end(), hash, pointer_pool_entry_less);
+    for (auto match = it; match != pool.entries.end() && match->hash == hash; ++match)
+    {
+        if (match->length == length && std::memcmp(match->text, json_ptr, length) == 0)
+        {
+            return rapidjson::Pointer(match->tokens, match->count);
+        }
+    }
+
+    // Parse once, and copy tokens, their names and source text into single block of the pool
+    rapidjson::Pointer parsed(json_ptr, length);
+    if (!parsed.IsValid())
+    {
+        return parsed;
+    }
+
+    size_t count = parsed.GetTokenCount();
+    size_t size = count * sizeof(rapidjson::Pointer::Token) + length + 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        size += parsed.GetTokens()[i].length + 1;
+    }
+
+    auto *tokens = static_cast<rapidjson::Pointer::Token *>(pool.allocate(size, alignof(rapidjson::Pointer::Token)));
+    char *names = reinterpret_cast<char *>(tokens + count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const auto &token = parsed.GetTokens()[i];
+        std::memcpy(names, token.name, token.length);
+        names[token.length] = '\0';
+        tokens[i] = {names, token.length, token.index};
+        names += token.length + 1;
+    }
+    std::memcpy(names, json_ptr, length + 1);
+
+    pool.entries.insert(it, {hash, length, names, tokens, count});
+    return rapidjson::Pointer(tokens, count);
+}
+
+size_t config_state_pointer_pool_footprint()
+{
+    auto &pool = shared_pointer_pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    return sizeof(pool) + pool.allocated + pool.chunks.capacity() * sizeof(pool.chunks[0]) + pool.entries.capacity() * sizeof(pool.entries[0]);
+}
+
+size_t config_state_pointer_footprint(const rapidjson::Pointer &ptr)
+{
+    auto &pool = shared_pointer_pool();
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (ptr.GetTokens() && pool.owns(ptr.GetTokens()))
+        {
+            return 0;
+        }
+    }
+
+    // Parsed pointer allocates its allocator, and single block of tokens followed by their names
+    size_t size = sizeof(rapidjson::CrtAllocator);
+    for (size_t i = 0; i < ptr.GetTokenCount(); i++)
+    {
+        size += sizeof(rapidjson::Pointer::Token) + ptr.GetTokens()[i].length + 1;
+    }
+    return size;
+}
+
+/**
+ * Calls callback with each key in the namespace, iterator API has changed in ESP-IDF 5.0.
+ */
+void config_state_nvs_list(const char *partition_name, const char *namespace_name, const std::function<void(const char *key)> &callback)
+{
+    nvs_entry_info_t info = {};
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    nvs_iterator_t it = nullptr;
+    for (esp_err_t err = nvs_entry_find(partition_name, namespace_name, NVS_TYPE_ANY, &it); err == ESP_OK; err = nvs_entry_next(&it))
+    {
+        nvs_entry_info(it, &info);
+        callback(info.key);
+    }
+    nvs_release_iterator(it); // Released at the end already, but not when iteration failed
+#else
+    for (nvs_iterator_t it = nvs_entry_find(partition_name, namespace_name, NVS_TYPE_ANY); it; it = nvs_entry_next(it))
+    {
+        nvs_entry_info(it, &info);
+        callback(info.key);
+    }
+#endif
+}
+
 std::string config_state_nvs_key(const std::string &s)
 {
     return !s.empty() && s[0] == '/' ? s.substr(1, std::string::npos) : s; // Skip leading '/' char
@@ -26,21 +295,96 @@ const char *config_state_nvs_key(const char *s)
     return *s == '/' ? s + 1 : s; // Skip leading '/' char
 }
 
+config_state_nvs_full_key::config_state_nvs_full_key(const char *prefix, const char *key)
+{
+    assert(key);
+    if (!prefix || prefix[0] == '\0')
+    {
+        str_ = config_state_nvs_key(key);
+        return;
+    }
+
+    size_t prefix_length = std::min(std::strlen(prefix), sizeof(buffer_) - 1);
+    size_t key_length = std::min(std::strlen(key), sizeof(buffer_) - 1 - prefix_length);
+    std::memcpy(buffer_, prefix, prefix_length);
+    std::memcpy(buffer_ + prefix_length, key, key_length);
+    buffer_[prefix_length + key_length] = '\0';
+    str_ = config_state_nvs_key(buffer_);
+}
+
+config_state_list_keys::config_state_list_keys(const std::string &key, size_t capacity)
+{
+    char slot[NVS_KEY_NAME_MAX_SIZE + 1] = {};
+
+    // Count keys first, up to the first one config_state_list would cut when composing it on the stack
+    size_t count = 0;
+    for (; count <= capacity; count++)
+    {
+        int length = count == 0 ? std::snprintf(slot, sizeof(slot), "%s/len", key.c_str())
+                                : std::snprintf(slot, sizeof(slot), "%s/%zu", key.c_str(), count - 1);
+        if (length < 0 || length >= NVS_KEY_NAME_MAX_SIZE - 1)
+        {
+            break;
+        }
+    }
+    if (count == 0)
+    {
+        return;
+    }
+
+    slots_.reset(new char[count * NVS_KEY_NAME_MAX_SIZE]);
+    for (count_ = 0; count_ < count; count_++)
+    {
+        if (count_ == 0)
+        {
+            std::snprintf(slot, sizeof(slot), "%s/len", key.c_str());
+        }
+        else
+        {
+            std::snprintf(slot, sizeof(slot), "%s/%zu", key.c_str(), count_ - 1);
+        }
+        std::strncpy(&slots_[count_ * NVS_KEY_NAME_MAX_SIZE], config_state_nvs_key(slot), NVS_KEY_NAME_MAX_SIZE);
+    }
+}
+
+esp_err_t config_state_nvs_erase(nvs::NVSHandle &handle, const char *prefix, const std::string &key)
+{
+    const config_state_nvs_full_key full_key(prefix, key.c_str());
+    return config_state_nvs_erase(handle, full_key.c_str());
+}
+
+esp_err_t config_state_nvs_erase(nvs::NVSHandle &handle, const char *nvs_key)
+{
+    esp_err_t err = handle.erase_item(nvs_key);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        return ESP_OK; // Already gone
+    }
+    if (err != ESP_OK)
+    {
+        config_state_logw("failed to erase_item %s: %d %s", nvs_key, err, esp_err_to_name(err));
+    }
+    return err;
+}
+
+bool config_state_nvs_key_equals(const char *nvs_key, const char *prefix, const std::string &key)
+{
+    return std::strcmp(config_state_nvs_full_key(prefix, key.c_str()).c_str(), nvs_key) == 0;
+}
+
 // std::string
 template<>
-bool config_state_helper<std::string>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, std::string &value)
+bool config_state_helper<std::string>::read(const rapidjson::Value &obj, std::string &value)
 {
-    // Find object
-    const rapidjson::Value *obj = ptr.Get(root);
     // Check its type
-    if (obj && obj->IsString())
+    if (obj.IsString())
     {
-        // Get new value
-        std::string newValue(obj->GetString(), obj->GetStringLength());
-        if (newValue != value)
+        // Compare in place, unchanged value is not copied at all
+        size_t length = obj.GetStringLength();
+        if (length != value.size() || std::memcmp(value.data(), obj.GetString(), length) != 0)
         {
-            // If it is different, update
-            value = newValue;
+            // If it is different, update, reusing existing capacity
+            value.assign(obj.GetString(), length);
             return true;
         }
     }
@@ -49,17 +393,24 @@ bool config_state_helper<std::string>::read(const rapidjson::Pointer &ptr, const
 
 // std::string
 template<>
-void config_state_helper<std::string>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const std::string &value)
+void config_state_helper<std::string>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const std::string &value)
 {
-    ptr.Create(root, allocator, nullptr).SetString(value, allocator);
+    obj.SetString(value, allocator);
+}
+
+// std::string
+template<>
+bool config_state_helper<std::string>::serialize(config_state_stream_handler &out, const std::string &value)
+{
+    return out.String(value.c_str(), static_cast<rapidjson::SizeType>(value.size()), true); // Same as copied string in DOM
 }
 
 // uint8_t
 template<>
-bool config_state_helper<uint8_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, uint8_t &value)
+bool config_state_helper<uint8_t>::read(const rapidjson::Value &obj, uint8_t &value)
 {
     unsigned num = value;
-    if (!config_state_helper<unsigned>::read(ptr, root, num))
+    if (!config_state_helper<unsigned>::read(obj, num))
     {
         // Invalid or unchanged value
         return false;
@@ -76,17 +427,24 @@ bool config_state_helper<uint8_t>::read(const rapidjson::Pointer &ptr, const rap
 
 // uint8_t
 template<>
-void config_state_helper<uint8_t>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const uint8_t &value)
+void config_state_helper<uint8_t>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const uint8_t &value)
 {
-    ptr.Create(root, allocator, nullptr).Set(static_cast<unsigned>(value), allocator);
+    obj.Set(static_cast<unsigned>(value), allocator);
+}
+
+// uint8_t
+template<>
+bool config_state_helper<uint8_t>::serialize(config_state_stream_handler &out, const uint8_t &value)
+{
+    return rapidjson::Value(static_cast<unsigned>(value)).Accept(out);
 }
 
 // int8_t
 template<>
-bool config_state_helper<int8_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, int8_t &value)
+bool config_state_helper<int8_t>::read(const rapidjson::Value &obj, int8_t &value)
 {
     int num = value; // NOLINT(cert-str34-c)
-    if (!config_state_helper<int>::read(ptr, root, num))
+    if (!config_state_helper<int>::read(obj, num))
     {
         // Invalid or unchanged value
         return false;
@@ -103,17 +461,24 @@ bool config_state_helper<int8_t>::read(const rapidjson::Pointer &ptr, const rapi
 
 // int8_t
 template<>
-void config_state_helper<int8_t>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const int8_t &value)
+void config_state_helper<int8_t>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const int8_t &value)
+{
+    obj.Set(static_cast<int>(value), allocator);
+}
+
+// int8_t
+template<>
+bool config_state_helper<int8_t>::serialize(config_state_stream_handler &out, const int8_t &value)
 {
-    ptr.Create(root, allocator, nullptr).Set(static_cast<int>(value), allocator);
+    return rapidjson::Value(static_cast<int>(value)).Accept(out);
 }
 
 // uint16_t
 template<>
-bool config_state_helper<uint16_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, uint16_t &value)
+bool config_state_helper<uint16_t>::read(const rapidjson::Value &obj, uint16_t &value)
 {
     unsigned num = value;
-    if (!config_state_helper<unsigned>::read(ptr, root, num))
+    if (!config_state_helper<unsigned>::read(obj, num))
     {
         // Invalid or unchanged value
         return false;
@@ -130,17 +495,24 @@ bool config_state_helper<uint16_t>::read(const rapidjson::Pointer &ptr, const ra
 
 // uint16_t
 template<>
-void config_state_helper<uint16_t>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const uint16_t &value)
+void config_state_helper<uint16_t>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const uint16_t &value)
+{
+    obj.Set(static_cast<unsigned>(value), allocator);
+}
+
+// uint16_t
+template<>
+bool config_state_helper<uint16_t>::serialize(config_state_stream_handler &out, const uint16_t &value)
 {
-    ptr.Create(root, allocator, nullptr).Set(static_cast<unsigned>(value), allocator);
+    return rapidjson::Value(static_cast<unsigned>(value)).Accept(out);
 }
 
 // int16_t
 template<>
-bool config_state_helper<int16_t>::read(const rapidjson::Pointer &ptr, const rapidjson::Value &root, int16_t &value)
+bool config_state_helper<int16_t>::read(const rapidjson::Value &obj, int16_t &value)
 {
     int num = value;
-    if (!config_state_helper<int>::read(ptr, root, num))
+    if (!config_state_helper<int>::read(obj, num))
     {
         // Invalid or unchanged value
         return false;
@@ -157,16 +529,37 @@ bool config_state_helper<int16_t>::read(const rapidjson::Pointer &ptr, const rap
 
 // int16_t
 template<>
-void config_state_helper<int16_t>::write(const rapidjson::Pointer &ptr, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator, const int16_t &value)
+void config_state_helper<int16_t>::write(rapidjson::Value &obj, rapidjson::Value::AllocatorType &allocator, const int16_t &value)
 {
-    ptr.Create(root, allocator, nullptr).Set(static_cast<int>(value), allocator);
+    obj.Set(static_cast<int>(value), allocator);
+}
+
+// int16_t
+template<>
+bool config_state_helper<int16_t>::serialize(config_state_stream_handler &out, const int16_t &value)
+{
+    return rapidjson::Value(static_cast<int>(value)).Accept(out);
+}
+
+// std::string
+template<>
+void config_state_helper<std::string>::pack(config_state_blob_writer &out, const std::string &value)
+{
+    out.put(value.data(), value.size());
+}
+
+// std::string
+template<>
+void config_state_helper<std::string>::unpack(config_state_blob_reader &in, std::string &value)
+{
+    value.assign(reinterpret_cast<const char *>(in.data()), in.remaining());
 }
 
 // std::string
 template<>
 esp_err_t config_state_helper<std::string>::load(const std::string &key, nvs::NVSHandle &handle, const char *prefix, std::string &value)
 {
-    const std::string full_key = config_state_nvs_key(prefix && prefix[0] != '\0' ? prefix + key : key);
+    const config_state_nvs_full_key full_key(prefix, key.c_str());
 
     // First we need to know stored string length
     size_t len = 0;
@@ -180,19 +573,32 @@ esp_err_t config_state_helper<std::string>::load(const std::string &key, nvs::NV
             return ESP_OK;
         }
 
-        // Read and store string
-        std::string tmp(len - 1, '\0'); // len includes zero terminator
-        err = handle.get_string(full_key.c_str(), &tmp[0], len);
-        if (err == ESP_OK)
+        if (len <= CONFIG_STATE_STRING_STACK_SIZE)
+        {
+            // Short string is read on the stack, and assigned into existing capacity only if it differs
+            char buffer[CONFIG_STATE_STRING_STACK_SIZE];
+            err = handle.get_string(full_key.c_str(), buffer, len);
+            if (err == ESP_OK && (value.size() != len - 1 || std::memcmp(value.data(), buffer, len - 1) != 0))
+            {
+                value.assign(buffer, len - 1);
+            }
+        }
+        else
         {
-            value.swap(tmp); // NOTE this is faster than assign, since it does not copy the bytes
+            // Read and store string
+            std::string tmp(len - 1, '\0'); // len includes zero terminator
+            err = handle.get_string(full_key.c_str(), &tmp[0], len);
+            if (err == ESP_OK)
+            {
+                value.swap(tmp); // NOTE this is faster than assign, since it does not copy the bytes
+            }
         }
     }
 
     // For both branches
     if (err != ESP_OK)
     {
-        ESP_LOGW(TAG, "failed to get_string %s: %d %s", full_key.c_str(), err, esp_err_to_name(err));
+        config_state_log_load_error("get_string", full_key.c_str(), err);
     }
     return err;
 }
@@ -201,7 +607,7 @@ template<>
 esp_err_t config_state_helper<std::string>::store(const std::string &key, nvs::NVSHandle &handle, const char *prefix, const std::string &value)
 {
     // NOTE this will strip string if it contains \0 character
-    const std::string full_key = config_state_nvs_key(prefix && prefix[0] != '\0' ? prefix + key : key);
+    const config_state_nvs_full_key full_key(prefix, key.c_str());
     esp_err_t err = handle.set_string(full_key.c_str(), value.c_str());
 
     if (err != ESP_OK)
@@ -214,7 +620,7 @@ esp_err_t config_state_helper<std::string>::store(const std::string &key, nvs::N
 template<>
 esp_err_t config_state_helper<float>::load(const std::string &key, nvs::NVSHandle &handle, const char *prefix, float &value)
 {
-    const std::string full_key = config_state_nvs_key(prefix && prefix[0] != '\0' ? prefix + key : key);
+    const config_state_nvs_full_key full_key(prefix, key.c_str());
 
     // NVS does not support floating point, so store it under u32, bit-wise
     uint32_t value_bits = 0;
@@ -225,7 +631,7 @@ esp_err_t config_state_helper<float>::load(const std::string &key, nvs::NVSHandl
     }
     else
     {
-        ESP_LOGW(TAG, "failed to get_item %s: %d %s", full_key.c_str(), err, esp_err_to_name(err));
+        config_state_log_load_error("get_item", full_key.c_str(), err);
     }
     return err;
 }
@@ -235,7 +641,7 @@ esp_err_t config_state_helper<float>::store(const std::string &key, nvs::NVSHand
 {
     static_assert(sizeof(uint32_t) >= sizeof(float));
 
-    const std::string full_key = config_state_nvs_key(prefix && prefix[0] != '\0' ? prefix + key : key);
+    const config_state_nvs_full_key full_key(prefix, key.c_str());
 
     // NVS does not support floating point, so store it under u32, bit-wise
     uint32_t value_bits = *reinterpret_cast<const uint32_t *>(&value);
@@ -251,7 +657,7 @@ esp_err_t config_state_helper<float>::store(const std::string &key, nvs::NVSHand
 template<>
 esp_err_t config_state_helper<double>::load(const std::string &key, nvs::NVSHandle &handle, const char *prefix, double &value)
 {
-    const std::string full_key = config_state_nvs_key(prefix && prefix[0] != '\0' ? prefix + key : key);
+    const config_state_nvs_full_key full_key(prefix, key.c_str());
 
     // NVS does not support floating point, so store it under u64, bit-wise
     uint64_t value_bits = 0;
@@ -262,7 +668,7 @@ esp_err_t config_state_helper<double>::load(const std::string &key, nvs::NVSHand
     }
     else
     {
-        ESP_LOGW(TAG, "failed to get_item %s: %d %s", full_key.c_str(), err, esp_err_to_name(err));
+        config_state_log_load_error("get_item", full_key.c_str(), err);
     }
     return err;
 }
@@ -272,7 +678,7 @@ esp_err_t config_state_helper<double>::store(const std::string &key, nvs::NVSHan
 {
     static_assert(sizeof(uint64_t) >= sizeof(double));
 
-    const std::string full_key = config_state_nvs_key(prefix && prefix[0] != '\0' ? prefix + key : key);
+    const config_state_nvs_full_key full_key(prefix, key.c_str());
 
     // NVS does not support floating point, so store it under u64, bit-wise
     uint64_t value_bits = *reinterpret_cast<const uint64_t *>(&value);
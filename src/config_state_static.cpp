@@ -0,0 +1,182 @@
+#include "config_state_static.h"
+#include <cstring>
+
+// Compares escaped JSON pointer token with member name, "~0" stands for "~" and "~1" for "/"
+static bool token_equals(const char *token, size_t length, const rapidjson::Value &name)
+{
+    const char *str = name.GetString();
+    size_t str_length = name.GetStringLength();
+
+    size_t n = 0;
+    for (size_t i = 0; i < length; i++, n++)
+    {
+        char c = token[i];
+        if (c == '~' && i + 1 < length)
+        {
+            c = token[++i] == '0' ? '~' : '/';
+        }
+        if (n >= str_length || str[n] != c)
+        {
+            return false;
+        }
+    }
+    return n == str_length;
+}
+
+// Parses array index token, same rules as rapidjson::Pointer
+static bool token_index(const char *token, size_t length, rapidjson::SizeType &index)
+{
+    if (length == 0 || length > 9 || (length > 1 && token[0] == '0'))
+    {
+        return false;
+    }
+
+    index = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (token[i] < '0' || token[i] > '9')
+        {
+            return false;
+        }
+        index = index * 10 + (token[i] - '0');
+    }
+    return true;
+}
+
+// Finds next token in the pointer, returns its end
+static const char *token_end(const char *token)
+{
+    const char *end = std::strchr(token, '/');
+    return end ? end : token + std::strlen(token);
+}
+
+// Resolves the pointer, optionally stopping at null on the way, which is a reset in merge patch
+static const rapidjson::Value *pointer_get(const rapidjson::Value &root, const char *json_ptr, bool null_stops)
+{
+    const rapidjson::Value *value = &root;
+    while (*json_ptr == '/')
+    {
+        if (null_stops && value->IsNull())
+        {
+            return value;
+        }
+
+        const char *token = json_ptr + 1;
+        json_ptr = token_end(token);
+        size_t length = json_ptr - token;
+
+        if (value->IsObject())
+        {
+            auto member = value->MemberBegin();
+            while (member != value->MemberEnd() && !token_equals(token, length, member->name))
+            {
+                ++member;
+            }
+            if (member == value->MemberEnd())
+            {
+                return nullptr;
+            }
+            value = &member->value;
+        }
+        else if (value->IsArray())
+        {
+            rapidjson::SizeType index;
+            if (!token_index(token, length, index) || index >= value->Size())
+            {
+                return nullptr;
+            }
+            value = &(*value)[index];
+        }
+        else
+        {
+            return nullptr;
+        }
+    }
+
+    // Anything else than end of string is invalid pointer
+    return *json_ptr ? nullptr : value;
+}
+
+const rapidjson::Value *config_state_pointer_get(const rapidjson::Value &root, const char *json_ptr)
+{
+    return pointer_get(root, json_ptr, false);
+}
+
+const rapidjson::Value *config_state_pointer_get_patch(const rapidjson::Value &patch, const char *json_ptr)
+{
+    return pointer_get(patch, json_ptr, true);
+}
+
+rapidjson::Value &config_state_pointer_create(rapidjson::Value &root, const char *json_ptr, rapidjson::Value::AllocatorType &allocator)
+{
+    rapidjson::Value *value = &root;
+    while (*json_ptr == '/')
+    {
+        const char *token = json_ptr + 1;
+        json_ptr = token_end(token);
+        size_t length = json_ptr - token;
+
+        // Same as rapidjson::Pointer::Create, index creates array, anything else object
+        rapidjson::SizeType index = 0;
+        bool is_index = token_index(token, length, index);
+        if (!value->IsObject() && !(is_index && value->IsArray()))
+        {
+            if (is_index)
+            {
+                value->SetArray();
+            }
+            else
+            {
+                value->SetObject();
+            }
+        }
+
+        if (value->IsArray())
+        {
+            if (index >= value->Size())
+            {
+                value->Reserve(index + 1, allocator);
+                while (index >= value->Size())
+                {
+                    value->PushBack(rapidjson::Value(), allocator);
+                }
+            }
+            value = &(*value)[index];
+            continue;
+        }
+
+        auto member = value->MemberBegin();
+        while (member != value->MemberEnd() && !token_equals(token, length, member->name))
+        {
+            ++member;
+        }
+        if (member == value->MemberEnd())
+        {
+            rapidjson::Value name;
+            if (std::memchr(token, '~', length))
+            {
+                // Unescape into allocated copy
+                std::string unescaped;
+                for (size_t i = 0; i < length; i++)
+                {
+                    char c = token[i];
+                    if (c == '~' && i + 1 < length)
+                    {
+                        c = token[++i] == '0' ? '~' : '/';
+                    }
+                    unescaped += c;
+                }
+                name.SetString(unescaped.c_str(), static_cast<rapidjson::SizeType>(unescaped.size()), allocator);
+            }
+            else
+            {
+                // Pointers are literals, reference them
+                name.SetString(rapidjson::StringRef(token, length));
+            }
+            value->AddMember(name, rapidjson::Value(), allocator);
+            member = value->MemberEnd() - 1;
+        }
+        value = &member->value;
+    }
+    return *value;
+}
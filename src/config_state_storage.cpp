@@ -0,0 +1,514 @@
+#include "config_state_storage.h"
+#include "config_state_blob.h"
+#include "config_state_helper.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+static constexpr size_t STORAGE_STRING_MAX_SIZE = 4000;
+static constexpr uint8_t STORAGE_FILE_VERSION = 1;
+static constexpr size_t STORAGE_HEADER_SIZE = 4;
+static constexpr size_t STORAGE_CRC_SIZE = 4;
+
+static nvs::ItemType storage_type(nvs::ItemType type)
+{
+    // Both blob formats are stored the same way
+    return type == nvs::ItemType::BLOB ? nvs::ItemType::BLOB_DATA : type;
+}
+
+static esp_err_t storage_check_key(const char *key)
+{
+    if (!key || key[0] == '\0')
+    {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    if (std::strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+    {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t config_state_memory_storage::set_string(const char *key, const char *value)
+{
+    if (!value)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t len = std::strlen(value) + 1;
+    if (len > STORAGE_STRING_MAX_SIZE)
+    {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+    return write(nvs::ItemType::SZ, key, value, len);
+}
+
+esp_err_t config_state_memory_storage::get_string(const char *key, char *out_str, size_t len)
+{
+    return read(nvs::ItemType::SZ, key, out_str, len, false);
+}
+
+esp_err_t config_state_memory_storage::get_item_size(nvs::ItemType datatype, const char *key, size_t &size)
+{
+    const item *found = nullptr;
+    esp_err_t err = find(datatype, key, found);
+    if (err == ESP_OK)
+    {
+        size = found->data.size();
+    }
+    return err;
+}
+
+esp_err_t config_state_memory_storage::set_blob(const char *key, const void *blob, size_t len)
+{
+    if (!blob && len > 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return write(nvs::ItemType::BLOB_DATA, key, blob, len);
+}
+
+esp_err_t config_state_memory_storage::get_blob(const char *key, void *blob, size_t len)
+{
+    return read(nvs::ItemType::BLOB_DATA, key, blob, len, false);
+}
+
+esp_err_t config_state_memory_storage::erase_item(const char *key)
+{
+    esp_err_t err = storage_check_key(key);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    if (items_.erase(key) == 0)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    dirty_ = true;
+    return ESP_OK;
+}
+
+esp_err_t config_state_memory_storage::erase_all()
+{
+    dirty_ |= !items_.empty();
+    items_.clear();
+    return ESP_OK;
+}
+
+esp_err_t config_state_memory_storage::commit()
+{
+    if (!dirty_)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t err = flush();
+    if (err == ESP_OK)
+    {
+        dirty_ = false;
+    }
+    return err;
+}
+
+esp_err_t config_state_memory_storage::get_used_entry_count(size_t &usedEntries)
+{
+    usedEntries = items_.size();
+    return ESP_OK;
+}
+
+std::vector<std::string> config_state_memory_storage::keys() const
+{
+    std::vector<std::string> result;
+    result.reserve(items_.size());
+    for (const auto &entry : items_)
+    {
+        result.push_back(entry.first);
+    }
+    return result;
+}
+
+esp_err_t config_state_memory_storage::set_typed_item(nvs::ItemType datatype, const char *key, const void *data, size_t dataSize)
+{
+    return write(datatype, key, data, dataSize);
+}
+
+esp_err_t config_state_memory_storage::get_typed_item(nvs::ItemType datatype, const char *key, void *data, size_t dataSize)
+{
+    return read(datatype, key, data, dataSize, true);
+}
+
+esp_err_t config_state_memory_storage::find(nvs::ItemType datatype, const char *key, const item *&out) const
+{
+    esp_err_t err = storage_check_key(key);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    auto it = items_.find(key);
+    if (it == items_.end() || (datatype != nvs::ItemType::ANY && it->second.type != storage_type(datatype)))
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    out = &it->second;
+    return ESP_OK;
+}
+
+esp_err_t config_state_memory_storage::read(nvs::ItemType datatype, const char *key, void *data, size_t size, bool exact_size) const
+{
+    const item *found = nullptr;
+    esp_err_t err = find(datatype, key, found);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    if (exact_size ? size != found->data.size() : size < found->data.size())
+    {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    if (!found->data.empty())
+    {
+        std::memcpy(data, found->data.data(), found->data.size());
+    }
+    return ESP_OK;
+}
+
+esp_err_t config_state_memory_storage::write(nvs::ItemType datatype, const char *key, const void *data, size_t size)
+{
+    esp_err_t err = storage_check_key(key);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    item &stored = items_[key];
+
+    // Same as NVS, unchanged value is not written again
+    if (stored.type == datatype && stored.data.size() == size && (size == 0 || std::memcmp(stored.data.data(), bytes, size) == 0))
+    {
+        return ESP_OK;
+    }
+
+    stored.type = datatype;
+    stored.data.assign(bytes, bytes + size);
+    dirty_ = true;
+    return ESP_OK;
+}
+
+static void storage_put_u32(std::vector<uint8_t> &buffer, uint32_t value)
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        buffer.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+static uint32_t storage_get_u32(const uint8_t *data)
+{
+    return data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+esp_err_t config_state_file_storage::open()
+{
+    items_.clear();
+    dirty_ = false;
+
+    FILE *file = std::fopen(path_.c_str(), "rb");
+    if (!file)
+    {
+        if (errno == ENOENT)
+        {
+            return ESP_OK; // Not stored yet
+        }
+        config_state_logw("failed to open %s: %d", path_.c_str(), errno);
+        return ESP_FAIL;
+    }
+
+    // Single read of the whole file
+    std::vector<uint8_t> buffer;
+    uint8_t chunk[256];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        buffer.insert(buffer.end(), chunk, chunk + n);
+    }
+    bool failed = std::ferror(file) != 0;
+    std::fclose(file);
+
+    if (failed)
+    {
+        config_state_logw("failed to read %s", path_.c_str());
+        return ESP_FAIL;
+    }
+
+    // Validate
+    if (buffer.size() < STORAGE_HEADER_SIZE + STORAGE_CRC_SIZE || buffer[0] != 'C' || buffer[1] != 'K')
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (buffer[2] != STORAGE_FILE_VERSION)
+    {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    size_t end = buffer.size() - STORAGE_CRC_SIZE;
+    if (config_state_crc32(0, buffer.data(), end) != storage_get_u32(&buffer[end]))
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    // Items
+    size_t pos = STORAGE_HEADER_SIZE;
+    while (pos < end)
+    {
+        if (end - pos < 2 || end - pos - 2 < buffer[pos + 1] + 4u)
+        {
+            items_.clear();
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        auto type = static_cast<nvs::ItemType>(buffer[pos]);
+        size_t key_length = buffer[pos + 1];
+        std::string key(reinterpret_cast<const char *>(&buffer[pos + 2]), key_length);
+        pos += 2 + key_length;
+
+        uint32_t length = storage_get_u32(&buffer[pos]);
+        pos += 4;
+        if (end - pos < length)
+        {
+            items_.clear();
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        item &stored = items_[key];
+        stored.type = type;
+        stored.data.assign(buffer.begin() + static_cast<ptrdiff_t>(pos), buffer.begin() + static_cast<ptrdiff_t>(pos + length));
+        pos += length;
+    }
+    return ESP_OK;
+}
+
+esp_err_t config_state_file_storage::flush()
+{
+    std::vector<uint8_t> buffer = {'C', 'K', STORAGE_FILE_VERSION, 0};
+    for (const auto &entry : items_)
+    {
+        buffer.push_back(static_cast<uint8_t>(entry.second.type));
+        buffer.push_back(static_cast<uint8_t>(entry.first.size()));
+        buffer.insert(buffer.end(), entry.first.begin(), entry.first.end());
+        storage_put_u32(buffer, static_cast<uint32_t>(entry.second.data.size()));
+        buffer.insert(buffer.end(), entry.second.data.begin(), entry.second.data.end());
+    }
+    storage_put_u32(buffer, config_state_crc32(0, buffer.data(), buffer.size()));
+
+    // Write new file, and replace the old one only when it is complete
+    const std::string tmp_path = path_ + ".tmp";
+    FILE *file = std::fopen(tmp_path.c_str(), "wb");
+    if (!file)
+    {
+        config_state_logw("failed to open %s: %d", tmp_path.c_str(), errno);
+        return ESP_FAIL;
+    }
+
+    bool ok = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size() && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok &= std::fclose(file) == 0;
+    if (!ok)
+    {
+        config_state_logw("failed to write %s: %d", tmp_path.c_str(), errno);
+        std::remove(tmp_path.c_str());
+        return ESP_FAIL;
+    }
+
+    // SPIFFS and FAT can't rename over existing file
+    if (std::rename(tmp_path.c_str(), path_.c_str()) != 0)
+    {
+        std::remove(path_.c_str());
+        if (std::rename(tmp_path.c_str(), path_.c_str()) != 0)
+        {
+            config_state_logw("failed to rename %s: %d", tmp_path.c_str(), errno);
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+size_t config_state_indexed_handle::index(const char *namespace_name, const char *partition_name)
+{
+    keys_.clear();
+    config_state_nvs_list(partition_name, namespace_name, [this](const char *key) { keys_.emplace(key); });
+    return keys_.size();
+}
+
+bool config_state_indexed_handle::check(const char *key)
+{
+    if (contains(key))
+    {
+        return true;
+    }
+    missing_++;
+    return false;
+}
+
+esp_err_t config_state_indexed_handle::written(const char *key, esp_err_t err)
+{
+    if (err == ESP_OK)
+    {
+        keys_.emplace(key);
+    }
+    return err;
+}
+
+esp_err_t config_state_indexed_handle::set_string(const char *key, const char *value)
+{
+    return written(key, handle_.set_string(key, value));
+}
+
+esp_err_t config_state_indexed_handle::get_string(const char *key, char *out_str, size_t len)
+{
+    return check(key) ? handle_.get_string(key, out_str, len) : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t config_state_indexed_handle::get_item_size(nvs::ItemType datatype, const char *key, size_t &size)
+{
+    return check(key) ? handle_.get_item_size(datatype, key, size) : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t config_state_indexed_handle::set_blob(const char *key, const void *blob, size_t len)
+{
+    return written(key, handle_.set_blob(key, blob, len));
+}
+
+esp_err_t config_state_indexed_handle::get_blob(const char *key, void *blob, size_t len)
+{
+    return check(key) ? handle_.get_blob(key, blob, len) : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t config_state_indexed_handle::erase_item(const char *key)
+{
+    esp_err_t err = handle_.erase_item(key);
+    if (err == ESP_OK)
+    {
+        keys_.erase(key);
+    }
+    return err;
+}
+
+esp_err_t config_state_indexed_handle::erase_all()
+{
+    esp_err_t err = handle_.erase_all();
+    if (err == ESP_OK)
+    {
+        keys_.clear();
+    }
+    return err;
+}
+
+esp_err_t config_state_indexed_handle::commit()
+{
+    return handle_.commit();
+}
+
+esp_err_t config_state_indexed_handle::get_used_entry_count(size_t &usedEntries)
+{
+    return handle_.get_used_entry_count(usedEntries);
+}
+
+// Typed access of the wrapped handle is protected, so it goes via its public templates
+template<typename T>
+static esp_err_t indexed_set(nvs::NVSHandle &handle, const char *key, const void *data, size_t size)
+{
+    if (size != sizeof(T))
+    {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return handle.set_item(key, value);
+}
+
+template<typename T>
+static esp_err_t indexed_get(nvs::NVSHandle &handle, const char *key, void *data, size_t size)
+{
+    if (size != sizeof(T))
+    {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    T value;
+    esp_err_t err = handle.get_item(key, value);
+    if (err == ESP_OK)
+    {
+        std::memcpy(data, &value, sizeof(T));
+    }
+    return err;
+}
+
+esp_err_t config_state_indexed_handle::set_typed_item(nvs::ItemType datatype, const char *key, const void *data, size_t dataSize)
+{
+    esp_err_t err;
+    switch (datatype)
+    {
+    case nvs::ItemType::U8:
+        err = indexed_set<uint8_t>(handle_, key, data, dataSize);
+        break;
+    case nvs::ItemType::I8:
+        err = indexed_set<int8_t>(handle_, key, data, dataSize);
+        break;
+    case nvs::ItemType::U16:
+        err = indexed_set<uint16_t>(handle_, key, data, dataSize);
+        break;
+    case nvs::ItemType::I16:
+        err = indexed_set<int16_t>(handle_, key, data, dataSize);
+        break;
+    case nvs::ItemType::U32:
+        err = indexed_set<uint32_t>(handle_, key, data, dataSize);
+        break;
+    case nvs::ItemType::I32:
+        err = indexed_set<int32_t>(handle_, key, data, dataSize);
+        break;
+    case nvs::ItemType::U64:
+        err = indexed_set<uint64_t>(handle_, key, data, dataSize);
+        break;
+    case nvs::ItemType::I64:
+        err = indexed_set<int64_t>(handle_, key, data, dataSize);
+        break;
+    default:
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    return written(key, err);
+}
+
+esp_err_t config_state_indexed_handle::get_typed_item(nvs::ItemType datatype, const char *key, void *data, size_t dataSize)
+{
+    if (!check(key))
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    switch (datatype)
+    {
+    case nvs::ItemType::U8:
+        return indexed_get<uint8_t>(handle_, key, data, dataSize);
+    case nvs::ItemType::I8:
+        return indexed_get<int8_t>(handle_, key, data, dataSize);
+    case nvs::ItemType::U16:
+        return indexed_get<uint16_t>(handle_, key, data, dataSize);
+    case nvs::ItemType::I16:
+        return indexed_get<int16_t>(handle_, key, data, dataSize);
+    case nvs::ItemType::U32:
+        return indexed_get<uint32_t>(handle_, key, data, dataSize);
+    case nvs::ItemType::I32:
+        return indexed_get<int32_t>(handle_, key, data, dataSize);
+    case nvs::ItemType::U64:
+        return indexed_get<uint64_t>(handle_, key, data, dataSize);
+    case nvs::ItemType::I64:
+        return indexed_get<int64_t>(handle_, key, data, dataSize);
+    default:
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+}
@@ -1,6 +1,15 @@
 #include "app_config.h"
+#include "config_state_cbor.h"
+#include "config_state_fixed_string.h"
+#include "config_state_reader.h"
+#include "config_state_snapshot.h"
+#include "config_state_static.h"
 #include <iostream>
+#include <map>
+#include <unordered_map>
+#include <thread>
 #include <rapidjson/ostreamwrapper.h>
+#include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 #include <unity.h>
 
@@ -197,6 +206,168 @@ TEST_CASE("read invalid gpio", "[json][read]")
     TEST_ASSERT_EQUAL(GPIO_NUM_NC, val); // unchanged
 }
 
+TEST_CASE("read nested pointers with shared prefix", "[json][read]")
+{
+    rapidjson::Document doc;
+    doc.Parse(R"({"a":{"x":7,"y":8,"z":9},"b":[41,{"s":"foobar"}],"c":true})");
+    TEST_ASSERT_FALSE(doc.HasParseError());
+
+    config_state_set<app_config> state;
+    state.add_field(&app_config::num_i8, "/a/x");
+    state.add_field(&app_config::num_u8, "/a/y");
+    state.add_field(&app_config::num_i16, "/a/z", nullptr, config_state_disable_read);
+    state.add_field(&app_config::num_int, "/b/0");
+    state.add_field(&app_config::str, "/b/1/s");
+    state.add_field(&app_config::num_u16, "/b/2"); // missing
+    state.add_field(&app_config::boolean, "/c");
+
+    // Test
+    app_config config = {};
+    TEST_ASSERT_TRUE(state.read(config, doc));
+
+    // Verify
+    TEST_ASSERT_EQUAL(7, config.num_i8);
+    TEST_ASSERT_EQUAL(8, config.num_u8);
+    TEST_ASSERT_EQUAL(0, config.num_i16);
+    TEST_ASSERT_EQUAL(41, config.num_int);
+    TEST_ASSERT_EQUAL_STRING("foobar", config.str.c_str());
+    TEST_ASSERT_EQUAL(0, config.num_u16);
+    TEST_ASSERT_EQUAL(true, config.boolean);
+
+    // Repeated read should be without change
+    TEST_ASSERT_FALSE(state.read(config, doc));
+}
+
+template<typename S>
+static bool read_stream(const config_state<S> &state, S &config, const char *json)
+{
+    config_state_reader<S> handler(state, config);
+    rapidjson::Reader reader;
+    rapidjson::StringStream stream(json);
+    TEST_ASSERT_FALSE(reader.Parse(stream, handler).IsError());
+    return handler.changed();
+}
+
+TEST_CASE("read stream", "[json][sax]")
+{
+    const char json[] = R"({"numI8":7,"numU8":8,"numI16":15,"numU16":16,"numI32":31,"numU32":32,"numInt":41,)"
+                        R"("numFloat":42.123456,"numDouble":43.123456,"boolean":true,"pin":22,"str":"foobar",)"
+                        R"("unknown":{"a":[1,{"b":2}]},"numList":[4,8,6],"strList":["a","b"],"objList":[{"ids":[55,88]}]})";
+
+    // Test
+    app_config config = {};
+    TEST_ASSERT_TRUE(read_stream(*APP_CONFIG_STATE, config, json));
+
+    // Verify
+    TEST_ASSERT_EQUAL(7, config.num_i8);
+    TEST_ASSERT_EQUAL(8, config.num_u8);
+    TEST_ASSERT_EQUAL(15, config.num_i16);
+    TEST_ASSERT_EQUAL(16, config.num_u16);
+    TEST_ASSERT_EQUAL(31, config.num_i32);
+    TEST_ASSERT_EQUAL(32, config.num_u32);
+    TEST_ASSERT_EQUAL(41, config.num_int);
+    TEST_ASSERT_EQUAL(42.123456, config.num_float);
+    TEST_ASSERT_EQUAL(43.123456, config.num_double);
+    TEST_ASSERT_EQUAL(true, config.boolean);
+    TEST_ASSERT_EQUAL(22, config.pin);
+    TEST_ASSERT_EQUAL_STRING("foobar", config.str.c_str());
+    TEST_ASSERT_EQUAL(3, config.num_list.size());
+    TEST_ASSERT_EQUAL(4, config.num_list[0]);
+    TEST_ASSERT_EQUAL(8, config.num_list[1]);
+    TEST_ASSERT_EQUAL(6, config.num_list[2]);
+    TEST_ASSERT_EQUAL(2, config.str_list.size());
+    TEST_ASSERT_EQUAL_STRING("a", config.str_list[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("b", config.str_list[1].c_str());
+    TEST_ASSERT_EQUAL(1, config.obj_list.size());
+    TEST_ASSERT_EQUAL(2, config.obj_list[0].ids.size());
+    TEST_ASSERT_EQUAL(55, config.obj_list[0].ids[0]);
+    TEST_ASSERT_EQUAL(88, config.obj_list[0].ids[1]);
+
+    // Repeated read should be without change
+    TEST_ASSERT_FALSE(read_stream(*APP_CONFIG_STATE, config, json));
+
+    // Shrink list
+    TEST_ASSERT_FALSE(read_stream(*APP_CONFIG_STATE, config, R"({"numList":[4]})"));
+    TEST_ASSERT_EQUAL(1, config.num_list.size());
+}
+
+TEST_CASE("read stream invalid types", "[json][sax]")
+{
+    app_config config = {};
+    config.num_i8 = 7;
+    config.num_u8 = 8;
+    config.str = "foobar";
+    config.num_list.push_back(4);
+
+    // Test
+    const char json[] = R"({"numI8":{"x":1},"numU8":256,"str":[1],"numList":{"0":5},"pin":24})";
+    TEST_ASSERT_FALSE(read_stream(*APP_CONFIG_STATE, config, json));
+
+    // Verify
+    TEST_ASSERT_EQUAL(7, config.num_i8);
+    TEST_ASSERT_EQUAL(8, config.num_u8);
+    TEST_ASSERT_EQUAL_STRING("foobar", config.str.c_str());
+    TEST_ASSERT_EQUAL(1, config.num_list.size());
+    TEST_ASSERT_EQUAL(4, config.num_list[0]);
+    TEST_ASSERT_EQUAL(GPIO_NUM_NC, config.pin);
+}
+
+struct test_object_state : config_state<app_config>
+{
+    test_object_state()
+        : config_state<app_config>(config_state_no_flags)
+    {
+    }
+
+    // Custom state, reading whole root object
+    bool do_read(app_config &inst, const rapidjson::Value &root) const final
+    {
+        bool changed = false;
+        if (root.IsObject() && root.HasMember("obj") && root["obj"].IsObject() && root["obj"].HasMember("n") && root["obj"]["n"].IsInt())
+        {
+            changed = inst.num_i32 != root["obj"]["n"].GetInt();
+            inst.num_i32 = root["obj"]["n"].GetInt();
+        }
+        return changed;
+    }
+
+    void do_write(const app_config &inst, rapidjson::Value &root, rapidjson::Value::AllocatorType &allocator) const final
+    {
+    }
+
+    esp_err_t do_load(app_config &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t do_store(const app_config &inst, nvs::NVSHandle &handle, const char *prefix) const final
+    {
+        return ESP_OK;
+    }
+};
+
+TEST_CASE("read stream nested sets", "[json][sax]")
+{
+    auto nested = new config_state_set<app_config>();
+    nested->add_field(&app_config::num_u8, "/nested/u8");
+    nested->add_field(&app_config::str, "/str");
+
+    config_state_set<app_config> state;
+    state.add_field(&app_config::num_i8, "/nested/i8");
+    state.add(nested);
+    state.add(new test_object_state());
+
+    // Test
+    app_config config = {};
+    TEST_ASSERT_TRUE(read_stream(state, config, R"({"nested":{"i8":-7,"u8":8},"str":"foo","obj":{"n":42}})"));
+
+    // Verify
+    TEST_ASSERT_EQUAL(-7, config.num_i8);
+    TEST_ASSERT_EQUAL(8, config.num_u8);
+    TEST_ASSERT_EQUAL_STRING("foo", config.str.c_str());
+    TEST_ASSERT_EQUAL(42, config.num_i32);
+}
+
 TEST_CASE("write document", "[json][write]")
 {
     // Data
@@ -263,4 +434,867 @@ TEST_CASE("write document", "[json][write]")
     TEST_ASSERT_EQUAL(88, obj_obj["ids"].GetArray()[1].IsInt() ? obj_obj["ids"].GetArray()[1].GetInt() : 0);
 }
 
+static std::string write_string(const config_state<app_config> &state, const app_config &config)
+{
+    rapidjson::Document doc;
+    state.write(config, doc, doc.GetAllocator());
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    doc.Accept(writer);
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+static std::string serialize_string(const config_state<app_config> &state, const app_config &config)
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    TEST_ASSERT_TRUE(state.serialize(config, writer));
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+TEST_CASE("serialize document", "[json][sax]")
+{
+    // Data
+    app_config config = {};
+    config.num_i8 = -7;
+    config.num_u8 = 8;
+    config.num_float = 42.123456;
+    config.pin = GPIO_NUM_22;
+    config.str = "foo\"bar";
+    config.num_list.push_back(4);
+    config.num_list.push_back(8);
+    config.str_list.emplace_back("x");
+
+    app_config_obj obj;
+    obj.ids.push_back(55);
+    config.obj_list.push_back(obj);
+    config.obj_list.emplace_back();
+
+    // Verify
+    TEST_ASSERT_EQUAL_STRING(write_string(*APP_CONFIG_STATE, config).c_str(), serialize_string(*APP_CONFIG_STATE, config).c_str());
+}
+
+TEST_CASE("serialize nested pointers", "[json][sax]")
+{
+    auto nested = new config_state_set<app_config>();
+    nested->add_field(&app_config::num_u8, "/nested/u8");
+    nested->add_field(&app_config::str, "/str");
+
+    config_state_set<app_config> state;
+    state.add_field(&app_config::num_i8, "/nested/i8");
+    state.add_field(&app_config::num_i16, "/arr/1");
+    state.add(nested);
+    state.add_field(&app_config::num_u16, "/nested/deep/u16");
+    state.add_field(&app_config::num_int, "/disabled", nullptr, config_state_disable_write);
+
+    app_config config = {};
+    config.num_i8 = -7;
+    config.num_u8 = 8;
+    config.num_i16 = 15;
+    config.num_u16 = 16;
+    config.str = "foo";
+
+    // Verify
+    std::string json = serialize_string(state, config);
+    TEST_ASSERT_EQUAL_STRING(R"({"nested":{"i8":-7,"u8":8,"deep":{"u16":16}},"arr":[null,15],"str":"foo"})", json.c_str());
+    TEST_ASSERT_EQUAL_STRING(write_string(state, config).c_str(), json.c_str());
+
+    // Custom state writing into root falls back to DOM
+    state.add(new test_object_state());
+    TEST_ASSERT_EQUAL_STRING(write_string(state, config).c_str(), serialize_string(state, config).c_str());
+}
+
+static constexpr auto STATIC_SCHEMA = config_state_schema_of<app_config>(
+    config_state_static_field_of(&app_config::num_i8, "/nested/i8"),
+    config_state_static_field_of(&app_config::num_i16, "/arr/1"),
+    config_state_static_field_of(&app_config::num_u16, "/nested/deep/u16"),
+    config_state_static_field_of(&app_config::str, "/a~1b"),
+    config_state_static_field_of(&app_config::num_int, "/disabled", nullptr, config_state_disable_serialization));
+
+TEST_CASE("static schema", "[json][static]")
+{
+    config_state_set<app_config> state;
+    state.add_field(&app_config::num_i8, "/nested/i8");
+    state.add_field(&app_config::num_i16, "/arr/1");
+    state.add_field(&app_config::num_u16, "/nested/deep/u16");
+    state.add_field(&app_config::str, "/a~1b");
+
+    config_state_static<app_config, decltype(STATIC_SCHEMA)> adapter(STATIC_SCHEMA);
+
+    app_config config = {};
+    config.num_i8 = -7;
+    config.num_i16 = 15;
+    config.num_u16 = 16;
+    config.str = "foo";
+    config.num_int = 3;
+
+    // Same document as dynamic schema
+    std::string json = write_string(adapter, config);
+    TEST_ASSERT_EQUAL_STRING(R"({"nested":{"i8":-7,"deep":{"u16":16}},"arr":[null,15],"a/b":"foo"})", json.c_str());
+    TEST_ASSERT_EQUAL_STRING(write_string(state, config).c_str(), json.c_str());
+
+    // Read back
+    rapidjson::Document doc;
+    doc.Parse(R"({"nested":{"i8":-7,"deep":{"u16":17}},"arr":[null,15],"a/b":"bar","disabled":9})");
+    TEST_ASSERT_FALSE(doc.HasParseError());
+
+    TEST_ASSERT_TRUE(STATIC_SCHEMA.read(config, doc));
+    TEST_ASSERT_EQUAL(-7, config.num_i8);
+    TEST_ASSERT_EQUAL(15, config.num_i16);
+    TEST_ASSERT_EQUAL(17, config.num_u16);
+    TEST_ASSERT_EQUAL_STRING("bar", config.str.c_str());
+    TEST_ASSERT_EQUAL(3, config.num_int);
+    TEST_ASSERT_FALSE(adapter.read(config, doc));
+
+    // Compare and write only differences
+    app_config baseline = config;
+    TEST_ASSERT_TRUE(adapter.equals(config, baseline));
+    config.num_u16 = 18;
+    TEST_ASSERT_FALSE(adapter.equals(config, baseline));
+
+    rapidjson::Document diff;
+    TEST_ASSERT_TRUE(adapter.write_diff(config, baseline, diff, diff.GetAllocator()));
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    diff.Accept(writer);
+    TEST_ASSERT_EQUAL_STRING(R"({"nested":{"deep":{"u16":18}}})", buffer.GetString());
+
+    // Null resets, also on the way
+    rapidjson::Document patch;
+    patch.Parse(R"({"nested":null,"a/b":"baz"})");
+    TEST_ASSERT_TRUE(adapter.apply_patch(config, patch));
+    TEST_ASSERT_EQUAL(0, config.num_i8);
+    TEST_ASSERT_EQUAL(0, config.num_u16);
+    TEST_ASSERT_EQUAL(15, config.num_i16);
+    TEST_ASSERT_EQUAL_STRING("baz", config.str.c_str());
+    TEST_ASSERT_FALSE(adapter.apply_patch(config, patch));
+
+    TEST_ASSERT_TRUE(adapter.reset(config));
+    TEST_ASSERT_EQUAL(0, config.num_i16);
+    TEST_ASSERT_TRUE(config.str.empty());
+    TEST_ASSERT_FALSE(adapter.reset(config));
+}
+
+struct test_change_item
+{
+    int a = 0;
+    int b = 0;
+};
+
+struct test_change_config
+{
+    int x = 0;
+    int y = 0;
+    std::vector<test_change_item> items;
+};
+
+TEST_CASE("read change mask and callbacks", "[json][read]")
+{
+    size_t item_calls = 0;
+    auto item_state = new config_state_set<test_change_item>();
+    item_state->add_field(&test_change_item::a, "/a", nullptr, config_state_no_flags, [&](test_change_item &item) {
+        TEST_ASSERT_EQUAL(5, item.a);
+        item_calls++;
+    });
+    item_state->add_field(&test_change_item::b, "/b");
+
+    size_t x_calls = 0;
+    config_state_set<test_change_config> state;
+    state.add_field(&test_change_config::x, "/x", nullptr, config_state_no_flags, [&](test_change_config &) { x_calls++; });
+    state.add_field(&test_change_config::y, "/y");
+    state.add_list(&test_change_config::items, "/items", item_state);
+    TEST_ASSERT_EQUAL(3, state.size());
+
+    test_change_config config = {};
+
+    rapidjson::Document doc;
+    doc.Parse(R"({"x":1,"items":[{"a":5,"b":1},{"a":5}]})");
+    TEST_ASSERT_FALSE(doc.HasParseError());
+
+    config_state_changes changes;
+    TEST_ASSERT_TRUE(state.read(config, doc, changes));
+    TEST_ASSERT_TRUE(changes.any());
+    TEST_ASSERT_TRUE(changes.test(0));
+    TEST_ASSERT_FALSE(changes.test(1));
+    TEST_ASSERT_TRUE(changes.test(2));
+    TEST_ASSERT_EQUAL(1, x_calls);
+    TEST_ASSERT_EQUAL(2, item_calls);
+
+    // Only y changes
+    doc.Parse(R"({"x":1,"y":2,"items":[{"a":5,"b":1},{"a":5}]})");
+    changes.clear();
+    TEST_ASSERT_TRUE(state.read(config, doc, changes));
+    TEST_ASSERT_FALSE(changes.test(0));
+    TEST_ASSERT_TRUE(changes.test(1));
+    TEST_ASSERT_FALSE(changes.test(2));
+    TEST_ASSERT_EQUAL(1, x_calls);
+    TEST_ASSERT_EQUAL(2, item_calls);
+
+    // Callbacks are called by streamed read as well
+    config = {};
+    TEST_ASSERT_TRUE(read_stream(state, config, R"({"x":1,"items":[{"a":5}]})"));
+    TEST_ASSERT_EQUAL(2, x_calls);
+    TEST_ASSERT_EQUAL(3, item_calls);
+}
+
+TEST_CASE("apply merge patch", "[json][patch]")
+{
+    app_config config = {};
+    config.num_u8 = 8;
+    config.pin = GPIO_NUM_22;
+    config.str = "foo";
+    config.num_list = {1, 2, 3};
+    config.obj_list.emplace_back();
+    config.obj_list[0].ids = {5, 6};
+
+    rapidjson::Document patch;
+    patch.Parse(R"({"numU8":9,"pin":null,"str":"foo","numList":[1,2],"objList":[{"ids":[7]},{}],"unknown":1})");
+    TEST_ASSERT_FALSE(patch.HasParseError());
+
+    TEST_ASSERT_TRUE(APP_CONFIG_STATE->apply_patch(config, patch));
+    TEST_ASSERT_EQUAL(9, config.num_u8);
+    TEST_ASSERT_EQUAL(GPIO_NUM_NC, config.pin); // Default value, not zero
+    TEST_ASSERT_EQUAL_STRING("foo", config.str.c_str());
+    TEST_ASSERT_EQUAL(2, config.num_list.size());
+    TEST_ASSERT_EQUAL(2, config.obj_list.size());
+    TEST_ASSERT_EQUAL(1, config.obj_list[0].ids.size());
+    TEST_ASSERT_EQUAL(7, config.obj_list[0].ids[0]);
+    TEST_ASSERT_EQUAL(0, config.obj_list[1].ids.size());
+
+    // Same patch again is without change
+    TEST_ASSERT_FALSE(APP_CONFIG_STATE->apply_patch(config, patch));
+
+    // Null removes the list
+    patch.Parse(R"({"numList":null})");
+    TEST_ASSERT_TRUE(APP_CONFIG_STATE->apply_patch(config, patch));
+    TEST_ASSERT_EQUAL(0, config.num_list.size());
+    TEST_ASSERT_EQUAL(2, config.obj_list.size());
+
+    // Already default list is not changed
+    TEST_ASSERT_FALSE(APP_CONFIG_STATE->apply_patch(config, patch));
+
+    // Elements are replaced, not merged
+    patch.Parse(R"({"objList":[{}]})");
+    TEST_ASSERT_TRUE(APP_CONFIG_STATE->apply_patch(config, patch));
+    TEST_ASSERT_EQUAL(1, config.obj_list.size());
+    TEST_ASSERT_EQUAL(0, config.obj_list[0].ids.size());
+}
+
+TEST_CASE("apply merge patch to nested object", "[json][patch]")
+{
+    config_state_set<app_config> state;
+    state.add_field(&app_config::num_i8, "/nested/i8");
+    state.add_field(&app_config::num_u8, "/nested/u8");
+    state.add_field(&app_config::num_i16, "/other");
+
+    app_config config = {};
+    config.num_i8 = -7;
+    config.num_u8 = 8;
+    config.num_i16 = 15;
+
+    rapidjson::Document patch;
+    patch.Parse(R"({"nested":{"u8":9}})");
+
+    config_state_changes changes;
+    TEST_ASSERT_TRUE(state.apply_patch(config, patch, changes));
+    TEST_ASSERT_FALSE(changes.test(0));
+    TEST_ASSERT_TRUE(changes.test(1));
+    TEST_ASSERT_FALSE(changes.test(2));
+    TEST_ASSERT_EQUAL(-7, config.num_i8);
+    TEST_ASSERT_EQUAL(9, config.num_u8);
+
+    // Whole object removed
+    patch.Parse(R"({"nested":null})");
+    changes.clear();
+    TEST_ASSERT_TRUE(state.apply_patch(config, patch, changes));
+    TEST_ASSERT_TRUE(changes.test(0));
+    TEST_ASSERT_TRUE(changes.test(1));
+    TEST_ASSERT_FALSE(changes.test(2));
+    TEST_ASSERT_EQUAL(0, config.num_i8);
+    TEST_ASSERT_EQUAL(0, config.num_u8);
+    TEST_ASSERT_EQUAL(15, config.num_i16);
+}
+
+TEST_CASE("write diff", "[json][patch]")
+{
+    app_config baseline = {};
+    baseline.num_u8 = 8;
+    baseline.str = "foo";
+    baseline.num_list = {1, 2};
+    baseline.obj_list.emplace_back();
+    baseline.obj_list[0].ids = {5};
+
+    // No difference
+    rapidjson::Document doc;
+    TEST_ASSERT_TRUE(APP_CONFIG_STATE->equals(baseline, baseline));
+    TEST_ASSERT_FALSE(APP_CONFIG_STATE->write_diff(baseline, baseline, doc, doc.GetAllocator()));
+    TEST_ASSERT_TRUE(doc.IsNull());
+
+    app_config current = baseline;
+    current.num_u8 = 9;
+    current.num_list.push_back(3);
+    current.obj_list[0].ids[0] = 6;
+    TEST_ASSERT_FALSE(APP_CONFIG_STATE->equals(current, baseline));
+
+    // Changed values only, lists as a whole
+    TEST_ASSERT_TRUE(APP_CONFIG_STATE->write_diff(current, baseline, doc, doc.GetAllocator()));
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    doc.Accept(writer);
+    TEST_ASSERT_EQUAL_STRING(R"({"numU8":9,"numList":[1,2,3],"objList":[{"ids":[6]}]})", buffer.GetString());
+
+    // Diff is a merge patch
+    TEST_ASSERT_TRUE(APP_CONFIG_STATE->apply_patch(baseline, doc));
+    TEST_ASSERT_TRUE(APP_CONFIG_STATE->equals(current, baseline));
+}
+
+TEST_CASE("cbor encode and decode", "[cbor]")
+{
+    config_state_set<app_config> small;
+    small.add_field(&app_config::num_u8, "/a");
+    small.add_field(&app_config::num_i16, "/b/1");
+    small.add_field(&app_config::str, "/s");
+
+    app_config config = {};
+    config.num_u8 = 8;
+    config.num_i16 = -500;
+    config.str = "x";
+
+    // {"a":8,"b":[null,-500],"s":"x"}, with indefinite-length containers
+    uint8_t buffer[512] = {};
+    size_t length = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, config_state_cbor_encode<app_config>(small, config, buffer, sizeof(buffer), &length));
+    const uint8_t expected[] = {0xbf, 0x61, 'a', 0x08, 0x61, 'b', 0x9f, 0xf6, 0x39, 0x01, 0xf3, 0xff, 0x61, 's', 0x61, 'x', 0xff};
+    TEST_ASSERT_EQUAL(sizeof(expected), length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+
+    // Buffer too small
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, config_state_cbor_encode<app_config>(small, config, buffer, sizeof(expected) - 1, &length));
+
+    // Whole config round trip
+    config.num_float = 42.5;
+    config.num_double = 43.123456;
+    config.boolean = true;
+    config.pin = GPIO_NUM_22;
+    config.num_list = {4, -8};
+    config.str_list = {"y"};
+    config.obj_list.emplace_back();
+    config.obj_list[0].ids = {55, 88};
+
+    TEST_ASSERT_EQUAL(ESP_OK, config_state_cbor_encode(*APP_CONFIG_STATE, config, buffer, sizeof(buffer), &length));
+
+    app_config decoded = {};
+    bool changed = false;
+    TEST_ASSERT_EQUAL(ESP_OK, config_state_cbor_decode(*APP_CONFIG_STATE, decoded, buffer, length, &changed));
+    TEST_ASSERT_TRUE(changed);
+    TEST_ASSERT_TRUE(APP_CONFIG_STATE->equals(config, decoded));
+
+    // Truncated
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, config_state_cbor_decode(*APP_CONFIG_STATE, decoded, buffer, length - 1));
+
+    // Definite-length map {"numU8": 9} with half float {"numFloat": 1.5}
+    const uint8_t definite[] = {0xa2, 0x65, 'n', 'u', 'm', 'U', '8', 0x09, 0x68, 'n', 'u', 'm', 'F', 'l', 'o', 'a', 't', 0xf9, 0x3e, 0x00};
+    TEST_ASSERT_EQUAL(ESP_OK, config_state_cbor_decode(*APP_CONFIG_STATE, decoded, definite, sizeof(definite)));
+    TEST_ASSERT_EQUAL(9, decoded.num_u8);
+    TEST_ASSERT_EQUAL_FLOAT(1.5, decoded.num_float);
+}
+
+TEST_CASE("publish snapshots", "[json][snapshot]")
+{
+    config_state_snapshot<app_config> config;
+    TEST_ASSERT_EQUAL(1, config.version());
+
+    rapidjson::Document doc;
+    doc.Parse(R"({"numI8":7})");
+
+    // Held handle keeps its version
+    auto old = config.acquire();
+    TEST_ASSERT_TRUE(config.read(*APP_CONFIG_STATE, doc));
+    TEST_ASSERT_FALSE(config.read(*APP_CONFIG_STATE, doc)); // Unchanged, not published
+    TEST_ASSERT_EQUAL(2, config.version());
+    TEST_ASSERT_EQUAL(0, old->num_i8);
+    TEST_ASSERT_EQUAL(7, config.acquire()->num_i8);
+
+    // Writers cycle through remaining slots
+    for (int8_t i = 10; i < 20; i++)
+    {
+        config.update([&](app_config &c) {
+            c.num_i8 = i;
+            return true;
+        });
+    }
+    TEST_ASSERT_EQUAL(0, old->num_i8);
+    TEST_ASSERT_EQUAL(19, config.acquire()->num_i8);
+}
+
+TEST_CASE("publish snapshots concurrently", "[json][snapshot]")
+{
+    config_state_snapshot<app_config> config;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> inconsistent{0};
+
+    // Reader sees either old or new version, never a mix
+    std::thread reader([&]() {
+        while (!done)
+        {
+            auto current = config.acquire();
+            if (current->num_i32 != static_cast<int32_t>(current->num_u32) || current->str.size() != current->num_u32 % 8)
+            {
+                inconsistent++;
+            }
+        }
+    });
+
+    for (uint32_t i = 1; i <= 1000; i++)
+    {
+        config.update([&](app_config &c) {
+            c.num_i32 = static_cast<int32_t>(i);
+            c.num_u32 = i;
+            c.str.assign(i % 8, 'x');
+            return true;
+        });
+    }
+
+    done = true;
+    reader.join();
+    TEST_ASSERT_EQUAL(0, inconsistent.load());
+    TEST_ASSERT_EQUAL(1000, config.acquire()->num_u32);
+}
+
+struct test_string_config
+{
+    config_state_fixed_string<8> name;
+    std::string text;
+};
+
+TEST_CASE("read fixed capacity strings", "[json][read]")
+{
+    config_state_set<test_string_config> state;
+    state.add_field(&test_string_config::name, "/name");
+    state.add_field(&test_string_config::text, "/text");
+
+    test_string_config config = {};
+
+    rapidjson::Document doc;
+    doc.Parse(R"({"name":"foo","text":"foobar"})");
+    TEST_ASSERT_FALSE(doc.HasParseError());
+
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL_STRING("foo", config.name.c_str());
+    TEST_ASSERT_EQUAL(3, config.name.size());
+    TEST_ASSERT_FALSE(state.read(config, doc));
+
+    // Changed std::string reuses its buffer
+    const char *text_data = config.text.data();
+    doc.Parse(R"({"name":"foo","text":"barfoo"})");
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL_STRING("barfoo", config.text.c_str());
+    TEST_ASSERT_EQUAL_PTR(text_data, config.text.data());
+
+    // Too long value is ignored
+    doc.Parse(R"({"name":"123456789"})");
+    TEST_ASSERT_FALSE(state.read(config, doc));
+    TEST_ASSERT_EQUAL_STRING("foo", config.name.c_str());
+    TEST_ASSERT_TRUE(read_stream(state, config, R"({"name":"12345678"})"));
+    TEST_ASSERT_EQUAL_STRING("12345678", config.name.c_str());
+
+    // Write
+    rapidjson::Document out;
+    state.write(config, out, out.GetAllocator());
+    TEST_ASSERT_EQUAL_STRING("12345678", out["name"].GetString());
+
+    // Store and load
+    config_state_memory_storage storage;
+    TEST_ASSERT_EQUAL(ESP_OK, state.store(config, storage));
+    test_string_config loaded = {};
+    TEST_ASSERT_EQUAL(ESP_OK, state.load(loaded, storage));
+    TEST_ASSERT_TRUE(loaded.name == config.name);
+    TEST_ASSERT_EQUAL_STRING("barfoo", loaded.text.c_str());
+
+    // Stored value longer than capacity is not loaded
+    TEST_ASSERT_EQUAL(ESP_OK, storage.set_string("name", "123456789"));
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, state.load(loaded, storage));
+    TEST_ASSERT_EQUAL_STRING("12345678", loaded.name.c_str());
+}
+
+struct test_mqtt_config
+{
+    std::string host;
+    int port = 1883;
+};
+
+struct test_object_config
+{
+    int x = 0;
+    test_mqtt_config mqtt;
+};
+
+TEST_CASE("read and write nested object", "[json][object]")
+{
+    auto mqtt_state = new config_state_set<test_mqtt_config>();
+    mqtt_state->add_field(&test_mqtt_config::host, "/host");
+    mqtt_state->add_field(&test_mqtt_config::port, "/port");
+
+    config_state_set<test_object_config> state;
+    state.add_field(&test_object_config::x, "/x");
+    state.add_object(&test_object_config::mqtt, "/mqtt", mqtt_state);
+
+    test_object_config config = {};
+
+    // Read relative to the object
+    rapidjson::Document doc;
+    doc.Parse(R"({"x":1,"mqtt":{"host":"broker","port":8883}})");
+    TEST_ASSERT_FALSE(doc.HasParseError());
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(1, config.x);
+    TEST_ASSERT_EQUAL_STRING("broker", config.mqtt.host.c_str());
+    TEST_ASSERT_EQUAL(8883, config.mqtt.port);
+    TEST_ASSERT_FALSE(state.read(config, doc));
+
+    // Write and serialize
+    rapidjson::Document out;
+    state.write(config, out, out.GetAllocator());
+    TEST_ASSERT_EQUAL_STRING("broker", out["mqtt"]["host"].GetString());
+    TEST_ASSERT_EQUAL(8883, out["mqtt"]["port"].GetInt());
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    TEST_ASSERT_TRUE(state.serialize(config, writer));
+    TEST_ASSERT_EQUAL_STRING(R"({"x":1,"mqtt":{"host":"broker","port":8883}})", buffer.GetString());
+
+    // Streamed read
+    TEST_ASSERT_TRUE(read_stream(state, config, R"({"mqtt":{"port":1}})"));
+    TEST_ASSERT_EQUAL(1, config.mqtt.port);
+    TEST_ASSERT_EQUAL_STRING("broker", config.mqtt.host.c_str());
+
+    // Patch and reset
+    rapidjson::Document patch;
+    patch.Parse(R"({"mqtt":{"port":2}})");
+    config_state_changes changes;
+    TEST_ASSERT_TRUE(state.apply_patch(config, patch, changes));
+    TEST_ASSERT_FALSE(changes.test(0));
+    TEST_ASSERT_TRUE(changes.test(1));
+    TEST_ASSERT_EQUAL(2, config.mqtt.port);
+
+    patch.Parse(R"({"mqtt":null})");
+    TEST_ASSERT_TRUE(state.apply_patch(config, patch));
+    TEST_ASSERT_EQUAL(1883, config.mqtt.port);
+    TEST_ASSERT_TRUE(config.mqtt.host.empty());
+
+    // Members are stored under the object key
+    config.mqtt.host = "broker";
+    config_state_memory_storage storage;
+    TEST_ASSERT_EQUAL(ESP_OK, state.store(config, storage));
+    char host[16] = {};
+    TEST_ASSERT_EQUAL(ESP_OK, storage.get_string("mqtt/host", host, sizeof(host)));
+    TEST_ASSERT_EQUAL_STRING("broker", host);
+    TEST_ASSERT_TRUE(state.owns_key(config, "mqtt/port"));
+
+    test_object_config loaded = {};
+    TEST_ASSERT_EQUAL(ESP_OK, state.load(loaded, storage));
+    TEST_ASSERT_EQUAL_STRING("broker", loaded.mqtt.host.c_str());
+    TEST_ASSERT_EQUAL(1883, loaded.mqtt.port);
+}
+
+struct test_sensor_config
+{
+    float offset = 0;
+    bool enabled = false;
+};
+
+struct test_map_config
+{
+    std::map<std::string, test_sensor_config> sensors;
+    std::unordered_map<uint16_t, int> limits;
+};
+
+TEST_CASE("read and write maps", "[json][map]")
+{
+    auto sensor_state = new config_state_set<test_sensor_config>();
+    sensor_state->add_field(&test_sensor_config::offset, "/offset", "/o");
+    sensor_state->add_field(&test_sensor_config::enabled, "/enabled", "/e");
+
+    config_state_set<test_map_config> state;
+    state.add_map(&test_map_config::sensors, "/sensors", "s", sensor_state);
+    state.add_value_map(&test_map_config::limits, "/limits", "l");
+
+    test_map_config config = {};
+
+    // Read
+    rapidjson::Document doc;
+    doc.Parse(R"({"sensors":{"t1":{"offset":1.5,"enabled":true},"t2":{}},"limits":{"10":100,"x":1}})");
+    TEST_ASSERT_FALSE(doc.HasParseError());
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(2, config.sensors.size());
+    TEST_ASSERT_EQUAL_FLOAT(1.5f, config.sensors["t1"].offset);
+    TEST_ASSERT_TRUE(config.sensors["t1"].enabled);
+    TEST_ASSERT_FALSE(config.sensors["t2"].enabled);
+    TEST_ASSERT_EQUAL(1, config.limits.size()); // Invalid key is ignored
+    TEST_ASSERT_EQUAL(100, config.limits[10]);
+    TEST_ASSERT_FALSE(state.read(config, doc));
+
+    // Entries are updated in place, missing ones removed
+    const test_sensor_config *t1 = &config.sensors["t1"];
+    doc.Parse(R"({"sensors":{"t1":{"offset":2.5}},"limits":{"10":100}})");
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(1, config.sensors.size());
+    TEST_ASSERT_EQUAL_PTR(t1, &config.sensors["t1"]);
+    TEST_ASSERT_EQUAL_FLOAT(2.5f, t1->offset);
+
+    // Write
+    rapidjson::Document out;
+    state.write(config, out, out.GetAllocator());
+    TEST_ASSERT_EQUAL_FLOAT(2.5f, out["sensors"]["t1"]["offset"].GetFloat());
+    TEST_ASSERT_EQUAL(100, out["limits"]["10"].GetInt());
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    TEST_ASSERT_TRUE(state.serialize(config, writer));
+    TEST_ASSERT_EQUAL_STRING(R"({"sensors":{"t1":{"offset":2.5,"enabled":true}},"limits":{"10":100}})", buffer.GetString());
+
+    // Patch inserts, updates and removes single entries
+    test_map_config baseline = config;
+    rapidjson::Document patch;
+    patch.Parse(R"({"sensors":{"t3":{"enabled":true}},"limits":{"10":null}})");
+    TEST_ASSERT_TRUE(state.apply_patch(config, patch));
+    TEST_ASSERT_EQUAL(2, config.sensors.size());
+    TEST_ASSERT_TRUE(config.sensors["t3"].enabled);
+    TEST_ASSERT_TRUE(config.limits.empty());
+
+    rapidjson::Document reset;
+    reset.Parse(R"({"limits":null})");
+    TEST_ASSERT_FALSE(state.apply_patch(config, reset)); // Already empty
+
+    rapidjson::Document diff;
+    TEST_ASSERT_TRUE(state.write_diff(config, baseline, diff, diff.GetAllocator()));
+    TEST_ASSERT_FALSE(diff["sensors"].HasMember("t1"));
+    TEST_ASSERT_TRUE(diff["sensors"]["t3"]["enabled"].GetBool());
+    TEST_ASSERT_TRUE(diff["limits"]["10"].IsNull());
+
+    // Entries are stored under their map keys
+    config_state_memory_storage storage;
+    TEST_ASSERT_EQUAL(ESP_OK, state.store(config, storage));
+    TEST_ASSERT_TRUE(state.owns_key(config, "s/t3/e"));
+    TEST_ASSERT_TRUE(state.owns_key(config, "s/keys"));
+    TEST_ASSERT_FALSE(state.owns_key(config, "s/t4/e"));
+
+    test_map_config loaded = {};
+    loaded.sensors["t9"] = {};
+    TEST_ASSERT_EQUAL(ESP_OK, state.load(loaded, storage));
+    TEST_ASSERT_EQUAL(2, loaded.sensors.size());
+    TEST_ASSERT_TRUE(loaded.sensors["t3"].enabled);
+    TEST_ASSERT_EQUAL_FLOAT(2.5f, loaded.sensors["t1"].offset);
+
+    // Inserting an entry writes only the entry and the keys
+    TEST_ASSERT_EQUAL(ESP_OK, storage.commit());
+    test_map_config persisted = config;
+    config.sensors["t4"].offset = 4;
+    TEST_ASSERT_EQUAL(ESP_OK, state.store_changed(config, persisted, storage));
+    TEST_ASSERT_EQUAL(3, persisted.sensors.size());
+    uint32_t offset_bits = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, storage.get_item("s/t4/o", offset_bits));
+
+    // Removed entries are erased
+    config.sensors.erase("t1");
+    TEST_ASSERT_EQUAL(ESP_OK, state.store(config, storage));
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, storage.get_item("s/t1/o", offset_bits));
+
+    TEST_ASSERT_EQUAL(ESP_OK, state.load(loaded, storage));
+    TEST_ASSERT_EQUAL(2, loaded.sensors.size());
+    TEST_ASSERT_EQUAL_FLOAT(4.0f, loaded.sensors["t4"].offset);
+}
+
+TEST_CASE("ignore invalid map keys", "[json][map]")
+{
+    config_state_set<test_map_config> state;
+    state.add_map(&test_map_config::sensors, "/sensors", "s", new config_state_set<test_sensor_config>());
+
+    test_map_config config = {};
+    rapidjson::Document doc;
+
+    // Empty key
+    doc.Parse(R"({"sensors":{"":{}}})");
+    TEST_ASSERT_FALSE(state.read(config, doc));
+    TEST_ASSERT_TRUE(config.sensors.empty());
+
+    // Key of the stored key list
+    doc.Parse(R"({"sensors":{"keys":{}}})");
+    TEST_ASSERT_FALSE(state.read(config, doc));
+    TEST_ASSERT_TRUE(config.sensors.empty());
+
+    // Separator of NVS keys
+    doc.Parse(R"({"sensors":{"a/b":{}}})");
+    TEST_ASSERT_FALSE(state.apply_patch(config, doc));
+    TEST_ASSERT_TRUE(config.sensors.empty());
+
+    // "s/" and the key must fit the entry prefix
+    doc.Parse(R"({"sensors":{"abcdefghijkl":{},"abcdefghijklm":{}}})");
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(1, config.sensors.size());
+    TEST_ASSERT_EQUAL(1, config.sensors.count("abcdefghijkl"));
+
+    // Invalid keys inserted directly are not stored
+    config.sensors["keys"] = {};
+    config_state_memory_storage storage;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, state.store(config, storage));
+
+    test_map_config loaded = {};
+    TEST_ASSERT_EQUAL(ESP_OK, state.load(loaded, storage));
+    TEST_ASSERT_EQUAL(1, loaded.sensors.size());
+    TEST_ASSERT_EQUAL(1, loaded.sensors.count("abcdefghijkl"));
+}
+
+struct test_channel
+{
+    int id = 0;
+    int pin = 0;
+};
+
+struct test_channels_config
+{
+    std::vector<test_channel> channels;
+};
+
+TEST_CASE("read list matched by id", "[json][list]")
+{
+    int reconfigured = 0;
+    auto channel_state = new config_state_set<test_channel>();
+    channel_state->add_field(&test_channel::id, "/id");
+    channel_state->add_field(&test_channel::pin, "/pin", nullptr, config_state_no_flags, [&reconfigured](test_channel &) { reconfigured++; });
+
+    config_state_set<test_channels_config> state;
+    state.add_keyed_list(&test_channels_config::channels, "/channels", &test_channel::id, "/id", channel_state);
+
+    test_channels_config config = {};
+    rapidjson::Document doc;
+    doc.Parse(R"({"channels":[{"id":1,"pin":10},{"id":2,"pin":20},{"id":3,"pin":30}]})");
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(3, config.channels.size());
+    TEST_ASSERT_EQUAL(3, reconfigured);
+
+    // Removal of the first element doesn't touch the others
+    reconfigured = 0;
+    doc.Parse(R"({"channels":[{"id":2,"pin":20},{"id":3,"pin":30}]})");
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(2, config.channels.size());
+    TEST_ASSERT_EQUAL(2, config.channels[0].id);
+    TEST_ASSERT_EQUAL(30, config.channels[1].pin);
+    TEST_ASSERT_EQUAL(0, reconfigured);
+    TEST_ASSERT_FALSE(state.read(config, doc));
+
+    // Reordering alone is not a change
+    doc.Parse(R"({"channels":[{"id":3,"pin":30},{"id":2,"pin":20}]})");
+    TEST_ASSERT_FALSE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(3, config.channels[0].id);
+    TEST_ASSERT_EQUAL(20, config.channels[1].pin);
+
+    // Only modified and inserted elements are read as changed
+    doc.Parse(R"({"channels":[{"id":4,"pin":40},{"id":3,"pin":31},{"id":2,"pin":20}]})");
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(3, config.channels.size());
+    TEST_ASSERT_EQUAL(4, config.channels[0].id);
+    TEST_ASSERT_EQUAL(31, config.channels[1].pin);
+    TEST_ASSERT_EQUAL(2, reconfigured);
+
+    // Streamed read matches the same way
+    reconfigured = 0;
+    TEST_ASSERT_TRUE(read_stream(state, config, R"({"channels":[{"pin":20,"id":2}]})"));
+    TEST_ASSERT_EQUAL(1, config.channels.size());
+    TEST_ASSERT_EQUAL(2, config.channels[0].id);
+    TEST_ASSERT_EQUAL(0, reconfigured);
+
+    // Patch replaces matched elements, absent members are reset
+    rapidjson::Document patch;
+    patch.Parse(R"({"channels":[{"id":1,"pin":10},{"id":2}]})");
+    TEST_ASSERT_TRUE(state.apply_patch(config, patch));
+    TEST_ASSERT_EQUAL(2, config.channels.size());
+    TEST_ASSERT_EQUAL(2, config.channels[1].id);
+    TEST_ASSERT_EQUAL(0, config.channels[1].pin);
+    TEST_ASSERT_EQUAL(2, reconfigured);
+
+    // Unchanged elements don't call callbacks
+    reconfigured = 0;
+    TEST_ASSERT_FALSE(state.apply_patch(config, patch));
+    TEST_ASSERT_EQUAL(0, reconfigured);
+}
+
+struct test_numeric_config
+{
+    std::vector<int16_t> table;
+    std::vector<float> coefficients;
+};
+
+TEST_CASE("read and write numeric lists", "[json][list]")
+{
+    config_state_set<test_numeric_config> state;
+    state.add_value_list(&test_numeric_config::table, "/table");
+    state.add_value_list(&test_numeric_config::coefficients, "/coefficients");
+
+    test_numeric_config config = {};
+    rapidjson::Document doc;
+    doc.Parse(R"({"table":[1,-2,3],"coefficients":[0.5,-1.25]})");
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(3, config.table.size());
+    TEST_ASSERT_EQUAL(-2, config.table[1]);
+    TEST_ASSERT_EQUAL_FLOAT(-1.25f, config.coefficients[1]);
+    TEST_ASSERT_FALSE(state.read(config, doc));
+
+    // Invalid and out of range values are ignored, same as with any other list
+    doc.Parse(R"({"table":[1,70000,4]})");
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(-2, config.table[1]);
+    TEST_ASSERT_EQUAL(4, config.table[2]);
+
+    doc.Parse(R"({"table":["x",5]})");
+    TEST_ASSERT_TRUE(state.read(config, doc));
+    TEST_ASSERT_EQUAL(2, config.table.size());
+    TEST_ASSERT_EQUAL(1, config.table[0]);
+    TEST_ASSERT_EQUAL(5, config.table[1]);
+
+    // Write and serialize
+    rapidjson::Document out;
+    state.write(config, out, out.GetAllocator());
+    TEST_ASSERT_EQUAL(2, out["table"].Size());
+    TEST_ASSERT_EQUAL(5, out["table"][1].GetInt());
+    TEST_ASSERT_EQUAL_FLOAT(0.5f, out["coefficients"][0].GetFloat());
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    TEST_ASSERT_TRUE(state.serialize(config, writer));
+    TEST_ASSERT_EQUAL_STRING(R"({"table":[1,5],"coefficients":[0.5,-1.25]})", buffer.GetString());
+
+    // Patch replaces whole list
+    rapidjson::Document patch;
+    patch.Parse(R"({"table":[7]})");
+    TEST_ASSERT_TRUE(state.apply_patch(config, patch));
+    TEST_ASSERT_EQUAL(1, config.table.size());
+    TEST_ASSERT_EQUAL(7, config.table[0]);
+}
+
+TEST_CASE("report schema footprint", "[json][footprint]")
+{
+    // Same pointers share their tokens
+    rapidjson::Pointer a = config_state_pointer("/a/b");
+    rapidjson::Pointer b = config_state_pointer("/a/b");
+    TEST_ASSERT_EQUAL(2, a.GetTokenCount());
+    TEST_ASSERT_EQUAL_PTR(a.GetTokens(), b.GetTokens());
+    TEST_ASSERT_EQUAL(0, config_state_pointer_footprint(a));
+    TEST_ASSERT_TRUE(rapidjson::Pointer("/a/b") == a);
+    TEST_ASSERT_GREATER_THAN(0, config_state_pointer_footprint(rapidjson::Pointer("/a/b")));
+
+    // Another instance of the same schema doesn't grow the pool
+    size_t pool = config_state_pointer_pool_footprint();
+    auto state = app_config::state();
+    TEST_ASSERT_EQUAL(pool, config_state_pointer_pool_footprint());
+
+    // Schema is counted with all its states
+    TEST_ASSERT_EQUAL(APP_CONFIG_STATE->footprint(), state->footprint());
+    TEST_ASSERT_GREATER_THAN(sizeof(config_state_set<app_config>), state->footprint());
+
+    config_state_field<app_config, int> field(&app_config::num_int, "/foo");
+    TEST_ASSERT_EQUAL(sizeof(field), field.footprint());
+}
+
 // TODO test flags
@@ -1,6 +1,18 @@
 #include "app_config.h"
+#include "config_state_blob.h"
+#include "config_state_persister.h"
+#include "config_state_storage.h"
+#include <atomic>
+#include <cstdio>
 #include <nvs_flash.h>
+#include <thread>
 #include <unity.h>
+#include <vector>
+
+#ifndef TEST_STORAGE_PATH
+// File storage test needs a mounted filesystem, it is ignored when the file can't be created
+#define TEST_STORAGE_PATH "/spiffs/config_state_test.bin"
+#endif
 
 static const char NVS_TEST_NAMESPACE[] = "unit_test";
 static const std::unique_ptr<config_state<app_config>> APP_CONFIG_STATE = app_config::state();
@@ -151,4 +163,630 @@ TEST_CASE("store and load full config", "[nvs][store]")
     TEST_ASSERT_EQUAL(55, id_0);
 }
 
+TEST_CASE("store only changed values", "[nvs][store]")
+{
+    // Setup
+    test_nvs_cleanup();
+
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_TEST_NAMESPACE, NVS_READWRITE, &err);
+    TEST_ASSERT_EQUAL(ESP_OK, err);
+    TEST_ASSERT_NOT_NULL(handle.get());
+
+    app_config config = {};
+    config.num_i8 = -7;
+    config.num_u8 = 8;
+    config.str = "foobar";
+    config.num_list.push_back(4);
+
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(config, handle));
+    app_config persisted = config;
+
+    // Erase keys behind its back, so we know what has been written again
+    TEST_ASSERT_EQUAL(ESP_OK, handle->erase_item("numI8"));
+    TEST_ASSERT_EQUAL(ESP_OK, handle->erase_item("numU8"));
+    TEST_ASSERT_EQUAL(ESP_OK, handle->erase_item("numList/0"));
+
+    // Test
+    config.num_u8 = 9;
+    config.num_list.push_back(5);
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store_changed(config, persisted, handle));
+
+    // Verify
+    int8_t num_i8 = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("numI8", num_i8)); // unchanged
+    uint8_t num_u8 = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item("numU8", num_u8));
+    TEST_ASSERT_EQUAL(9, num_u8);
+    int num_list_0 = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("numList/0", num_list_0)); // unchanged
+    int num_list_1 = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item("numList/1", num_list_1));
+    TEST_ASSERT_EQUAL(5, num_list_1);
+    uint16_t num_list_len = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item("numList/len", num_list_len));
+    TEST_ASSERT_EQUAL(2, num_list_len);
+
+    // Persisted copy follows
+    TEST_ASSERT_EQUAL(9, persisted.num_u8);
+    TEST_ASSERT_EQUAL(2, persisted.num_list.size());
+    TEST_ASSERT_EQUAL(5, persisted.num_list[1]);
+}
+
+TEST_CASE("store and load blob", "[nvs][blob]")
+{
+    // Setup
+    test_nvs_cleanup();
+
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_TEST_NAMESPACE, NVS_READWRITE, &err);
+    TEST_ASSERT_EQUAL(ESP_OK, err);
+    TEST_ASSERT_NOT_NULL(handle.get());
+
+    auto state = app_config::state();
+    static_cast<config_state_set<app_config> &>(*state).store_as_blob("cfg");
+
+    app_config expected = {};
+    expected.num_i8 = -7;
+    expected.num_u32 = 32;
+    expected.num_double = -43.123456;
+    expected.pin = GPIO_NUM_22;
+    expected.str = "foobar";
+    expected.num_list.push_back(4);
+    expected.num_list.push_back(-8);
+    expected.str_list.emplace_back("x");
+
+    app_config_obj obj;
+    obj.ids.push_back(55);
+    obj.ids.push_back(88);
+    expected.obj_list.push_back(obj);
+
+    // Test
+    TEST_ASSERT_EQUAL(ESP_OK, state->store(expected, handle));
+
+    app_config loaded = {};
+    TEST_ASSERT_EQUAL(ESP_OK, state->load(loaded, handle));
+
+    // Verify
+    size_t entries = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_used_entry_count(entries));
+    int8_t num_i8 = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("numI8", num_i8)); // Only in blob
+
+    TEST_ASSERT_EQUAL(expected.num_i8, loaded.num_i8);
+    TEST_ASSERT_EQUAL(expected.num_u32, loaded.num_u32);
+    TEST_ASSERT_EQUAL(0, loaded.num_int); // disabled persistence for this field
+    TEST_ASSERT_EQUAL(expected.num_double, loaded.num_double);
+    TEST_ASSERT_EQUAL(expected.pin, loaded.pin);
+    TEST_ASSERT_EQUAL_STRING(expected.str.c_str(), loaded.str.c_str());
+    TEST_ASSERT_EQUAL(2, loaded.num_list.size());
+    TEST_ASSERT_EQUAL(-8, loaded.num_list[1]);
+    TEST_ASSERT_EQUAL(1, loaded.str_list.size());
+    TEST_ASSERT_EQUAL_STRING("x", loaded.str_list[0].c_str());
+    TEST_ASSERT_EQUAL(1, loaded.obj_list.size());
+    TEST_ASSERT_EQUAL(2, loaded.obj_list[0].ids.size());
+    TEST_ASSERT_EQUAL(88, loaded.obj_list[0].ids[1]);
+}
+
+TEST_CASE("load blob with different schema", "[nvs][blob]")
+{
+    // Setup
+    test_nvs_cleanup();
+
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_TEST_NAMESPACE, NVS_READWRITE, &err);
+    TEST_ASSERT_EQUAL(ESP_OK, err);
+    TEST_ASSERT_NOT_NULL(handle.get());
+
+    config_state_set<app_config> newer;
+    newer.add_field(&app_config::num_i8, "/a");
+    newer.add_field(&app_config::num_u8, "/b");
+    newer.add_field(&app_config::str, "/c");
+    newer.store_as_blob("cfg");
+
+    config_state_set<app_config> older;
+    older.add_field(&app_config::num_u8, "/b");
+    older.add_field(&app_config::num_i16, "/d");
+    older.store_as_blob("cfg");
+
+    app_config config = {};
+    config.num_i8 = -7;
+    config.num_u8 = 8;
+    config.str = "foobar";
+    TEST_ASSERT_EQUAL(ESP_OK, newer.store(config, handle));
+
+    // Test
+    app_config loaded = {};
+    loaded.num_i16 = 15;
+    TEST_ASSERT_EQUAL(ESP_OK, older.load(loaded, handle));
+
+    // Verify
+    TEST_ASSERT_EQUAL(0, loaded.num_i8); // unknown to this schema
+    TEST_ASSERT_EQUAL(8, loaded.num_u8);
+    TEST_ASSERT_EQUAL(15, loaded.num_i16); // not in the blob
+
+    // Corrupted
+    size_t length = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item_size(nvs::ItemType::BLOB, "cfg", length));
+    std::vector<uint8_t> blob(length);
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_blob("cfg", blob.data(), length));
+    blob[5] ^= 0xFF;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->set_blob("cfg", blob.data(), length));
+
+    loaded = {};
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, older.load(loaded, handle));
+    TEST_ASSERT_EQUAL(0, loaded.num_u8);
+}
+
+TEST_CASE("store and load packed list", "[nvs][store]")
+{
+    // Setup
+    test_nvs_cleanup();
+
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_TEST_NAMESPACE, NVS_READWRITE, &err);
+    TEST_ASSERT_EQUAL(ESP_OK, err);
+    TEST_ASSERT_NOT_NULL(handle.get());
+
+    config_state_set<app_config> state;
+    state.add_packed_list(&app_config::num_list, "/numList", "/nl");
+
+    const size_t chunk_length = CONFIG_STATE_PACKED_CHUNK_SIZE / sizeof(int);
+
+    app_config config = {};
+    for (size_t i = 0; i < chunk_length * 2 + 10; i++)
+    {
+        config.num_list.push_back(static_cast<int>(i) - 100);
+    }
+
+    // Test
+    TEST_ASSERT_EQUAL(ESP_OK, state.store(config, handle));
+
+    app_config loaded = {};
+    TEST_ASSERT_EQUAL(ESP_OK, state.load(loaded, handle));
+
+    // Verify
+    TEST_ASSERT_TRUE(config.num_list == loaded.num_list);
+
+    uint16_t len = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("nl/len", len));
+    size_t size = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item_size(nvs::ItemType::BLOB, "nl/2", size));
+    TEST_ASSERT_EQUAL(10 * sizeof(int), size);
+
+    // Shrink to exactly one chunk
+    config.num_list.resize(chunk_length);
+    TEST_ASSERT_EQUAL(ESP_OK, state.store(config, handle));
+    TEST_ASSERT_EQUAL(ESP_OK, state.load(loaded, handle));
+    TEST_ASSERT_TRUE(config.num_list == loaded.num_list);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item_size(nvs::ItemType::BLOB, "nl/1", size));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item_size(nvs::ItemType::BLOB, "nl/2", size));
+
+    // Stale chunk must not be loaded after growing again
+    config.num_list.resize(chunk_length * 2);
+    TEST_ASSERT_EQUAL(ESP_OK, state.store(config, handle));
+    TEST_ASSERT_EQUAL(ESP_OK, state.load(loaded, handle));
+    TEST_ASSERT_TRUE(config.num_list == loaded.num_list);
+
+    // Empty
+    config.num_list.clear();
+    TEST_ASSERT_EQUAL(ESP_OK, state.store(config, handle));
+    TEST_ASSERT_EQUAL(ESP_OK, state.load(loaded, handle));
+    TEST_ASSERT_EQUAL(0, loaded.num_list.size());
+}
+
+TEST_CASE("erase stale list elements", "[nvs][store]")
+{
+    // Setup
+    test_nvs_cleanup();
+
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_TEST_NAMESPACE, NVS_READWRITE, &err);
+    TEST_ASSERT_EQUAL(ESP_OK, err);
+    TEST_ASSERT_NOT_NULL(handle.get());
+
+    app_config config = {};
+    config.num_list.push_back(4);
+    config.num_list.push_back(8);
+    config.obj_list.resize(3);
+    config.obj_list[2].ids.push_back(55);
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(config, handle));
+
+    // Test
+    config.num_list.resize(1);
+    config.obj_list.resize(1);
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(config, handle));
+
+    // Verify
+    int num = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item("numList/0", num));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("numList/1", num));
+    uint16_t len = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item("ol/0/ids/len", len));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("ol/1/ids/len", len));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("ol/2/ids/len", len));
+    uint32_t id = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("ol/2/ids/0", id));
+}
+
+TEST_CASE("compact namespace", "[nvs][store]")
+{
+    // Setup
+    test_nvs_cleanup();
+
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_TEST_NAMESPACE, NVS_READWRITE, &err);
+    TEST_ASSERT_EQUAL(ESP_OK, err);
+    TEST_ASSERT_NOT_NULL(handle.get());
+
+    app_config config = {};
+    config.num_list.push_back(4);
+    config.obj_list.resize(1);
+    config.obj_list[0].ids.push_back(55);
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(config, handle));
+
+    // Keys of removed fields and past list elements
+    TEST_ASSERT_EQUAL(ESP_OK, handle->set_item("removed", 1));
+    TEST_ASSERT_EQUAL(ESP_OK, handle->set_item("numList/7", 1));
+    TEST_ASSERT_EQUAL(ESP_OK, handle->set_item("ol/0/ids/3", 1));
+    TEST_ASSERT_EQUAL(ESP_OK, handle->set_item("numInt", 1)); // Persistence disabled
+
+    // Test
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->compact(config, *handle, NVS_TEST_NAMESPACE));
+
+    // Verify
+    int num = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("removed", num));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("numList/7", num));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("ol/0/ids/3", num));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, handle->get_item("numInt", num));
+
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item("numList/0", num));
+    int8_t num_i8 = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item("numI8", num_i8));
+    uint32_t id = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item("ol/0/ids/0", id));
+    uint16_t len = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, handle->get_item("ol/len", len));
+}
+
+TEST_CASE("store and load memory storage", "[storage]")
+{
+    config_state_memory_storage storage;
+
+    app_config expected = {};
+    expected.num_i8 = -7;
+    expected.num_float = 42.123456;
+    expected.str = "foobar";
+    expected.num_list = {4, -8};
+    expected.obj_list.emplace_back();
+    expected.obj_list[0].ids = {55};
+
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(expected, storage));
+    TEST_ASSERT_TRUE(storage.dirty());
+    TEST_ASSERT_EQUAL(ESP_OK, storage.commit());
+    TEST_ASSERT_FALSE(storage.dirty());
+
+    // Unchanged values are not written again
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(expected, storage));
+    TEST_ASSERT_FALSE(storage.dirty());
+
+    app_config loaded = {};
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->load(loaded, storage));
+    TEST_ASSERT_EQUAL(-7, loaded.num_i8);
+    TEST_ASSERT_EQUAL_STRING("foobar", loaded.str.c_str());
+    TEST_ASSERT_EQUAL(2, loaded.num_list.size());
+    TEST_ASSERT_EQUAL(55, loaded.obj_list[0].ids[0]);
+
+    // Same rules as NVS
+    int8_t num_i8 = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, storage.get_item("numI8", num_i8));
+    TEST_ASSERT_EQUAL(-7, num_i8);
+    uint8_t wrong_type = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, storage.get_item("numI8", wrong_type));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_KEY_TOO_LONG, storage.set_item("0123456789abcdef", 1));
+}
+
+static std::vector<uint8_t> test_read_file(const char *path)
+{
+    std::vector<uint8_t> data;
+    FILE *file = std::fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    int c;
+    while ((c = std::fgetc(file)) != EOF)
+    {
+        data.push_back(static_cast<uint8_t>(c));
+    }
+    std::fclose(file);
+    return data;
+}
+
+static void test_write_file(const char *path, const std::vector<uint8_t> &data)
+{
+    FILE *file = std::fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL(data.size(), std::fwrite(data.data(), 1, data.size(), file));
+    std::fclose(file);
+}
+
+TEST_CASE("store and load file storage", "[storage]")
+{
+    // Setup
+    FILE *probe = std::fopen(TEST_STORAGE_PATH, "wb");
+    if (!probe)
+    {
+        TEST_IGNORE_MESSAGE("no filesystem at " TEST_STORAGE_PATH);
+    }
+    std::fclose(probe);
+    std::remove(TEST_STORAGE_PATH);
+
+    app_config expected = {};
+    expected.num_i8 = -7;
+    expected.str = "foobar";
+    expected.num_list = {4, -8};
+
+    // Missing file is empty storage
+    {
+        config_state_file_storage storage(TEST_STORAGE_PATH);
+        TEST_ASSERT_EQUAL(ESP_OK, storage.open());
+        TEST_ASSERT_TRUE(storage.keys().empty());
+
+        TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(expected, storage));
+        TEST_ASSERT_EQUAL(ESP_OK, storage.commit());
+        TEST_ASSERT_FALSE(storage.dirty());
+    }
+
+    // Temporary file has been renamed
+    TEST_ASSERT_NULL(std::fopen(TEST_STORAGE_PATH ".tmp", "rb"));
+
+    // Reopen
+    {
+        config_state_file_storage storage(TEST_STORAGE_PATH);
+        TEST_ASSERT_EQUAL(ESP_OK, storage.open());
+
+        app_config loaded = {};
+        TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->load(loaded, storage));
+        TEST_ASSERT_EQUAL(-7, loaded.num_i8);
+        TEST_ASSERT_EQUAL_STRING("foobar", loaded.str.c_str());
+        TEST_ASSERT_TRUE(expected.num_list == loaded.num_list);
+
+        // Commit of an existing file replaces it
+        expected.num_i8 = 8;
+        TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(expected, storage));
+        TEST_ASSERT_EQUAL(ESP_OK, storage.commit());
+    }
+
+    config_state_file_storage storage(TEST_STORAGE_PATH);
+    TEST_ASSERT_EQUAL(ESP_OK, storage.open());
+    int8_t num_i8 = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, storage.get_item("numI8", num_i8));
+    TEST_ASSERT_EQUAL(8, num_i8);
+
+    // Corrupted files are empty storage
+    const std::vector<uint8_t> valid = test_read_file(TEST_STORAGE_PATH);
+
+    std::vector<uint8_t> corrupted = valid;
+    corrupted[corrupted.size() / 2] ^= 0xFF;
+    test_write_file(TEST_STORAGE_PATH, corrupted);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, storage.open());
+    TEST_ASSERT_TRUE(storage.keys().empty());
+
+    corrupted = valid;
+    corrupted[2]++;
+    test_write_file(TEST_STORAGE_PATH, corrupted);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, storage.open());
+    TEST_ASSERT_TRUE(storage.keys().empty());
+
+    corrupted.assign(valid.begin(), valid.begin() + 3);
+    test_write_file(TEST_STORAGE_PATH, corrupted);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, storage.open());
+    TEST_ASSERT_TRUE(storage.keys().empty());
+
+    // Item longer than the file, with valid CRC
+    corrupted = {'C', 'K', valid[2], 0, static_cast<uint8_t>(nvs::ItemType::U8), 1, 'x', 100, 0, 0, 0, 1};
+    uint32_t crc = config_state_crc32(0, corrupted.data(), corrupted.size());
+    for (size_t i = 0; i < 4; i++)
+    {
+        corrupted.push_back(static_cast<uint8_t>(crc >> (8 * i)));
+    }
+    test_write_file(TEST_STORAGE_PATH, corrupted);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, storage.open());
+    TEST_ASSERT_TRUE(storage.keys().empty());
+
+    // Cleanup
+    std::remove(TEST_STORAGE_PATH);
+}
+
+TEST_CASE("store asynchronously with coalescing", "[storage]")
+{
+    config_state_memory_storage storage;
+    app_config config = {};
+
+    {
+        config_state_persister<app_config> persister(*APP_CONFIG_STATE, storage, std::chrono::milliseconds(10000));
+
+        // Successive requests are coalesced, nothing is written until the window ends
+        for (int8_t i = 1; i <= 3; i++)
+        {
+            config.num_i8 = i;
+            persister.store(config);
+        }
+        TEST_ASSERT_TRUE(persister.pending());
+
+        // Flush writes the latest snapshot and commits
+        TEST_ASSERT_EQUAL(ESP_OK, persister.flush());
+        TEST_ASSERT_FALSE(persister.pending());
+        TEST_ASSERT_FALSE(storage.dirty());
+
+        int8_t num_i8 = 0;
+        TEST_ASSERT_EQUAL(ESP_OK, storage.get_item("numI8", num_i8));
+        TEST_ASSERT_EQUAL(3, num_i8);
+
+        // Destructor flushes as well
+        config.str = "foo";
+        persister.store(config);
+    }
+
+    app_config loaded = {};
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->load(loaded, storage));
+    TEST_ASSERT_EQUAL(3, loaded.num_i8);
+    TEST_ASSERT_EQUAL_STRING("foo", loaded.str.c_str());
+}
+
+TEST_CASE("flush while storing", "[storage]")
+{
+    config_state_memory_storage storage;
+    config_state_persister<app_config> persister(*APP_CONFIG_STATE, storage, std::chrono::milliseconds(10000));
+
+    // Requests arriving between flush and the write make the worker write a newer generation than flush waits for
+    std::atomic<bool> done(false);
+    std::thread storer([&]() {
+        app_config config = {};
+        for (int8_t i = 0; !done; i++)
+        {
+            config.num_i8 = i;
+            persister.store(config);
+        }
+    });
+
+    for (int i = 0; i < 200; i++)
+    {
+        TEST_ASSERT_EQUAL(ESP_OK, persister.flush());
+    }
+
+    done = true;
+    storer.join();
+    TEST_ASSERT_EQUAL(ESP_OK, persister.flush());
+    TEST_ASSERT_FALSE(persister.pending());
+}
+
+TEST_CASE("store and load in steps", "[nvs][store]")
+{
+    config_state_memory_storage storage;
+
+    app_config config = {};
+    config.num_i8 = -7;
+    config.str = "foobar";
+    config.num_list = {4, -8, 6};
+    config.obj_list.resize(3);
+    config.obj_list[1].ids = {55, 88};
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(config, storage));
+
+    // Store single value per step, including elements of nested lists
+    config.num_i8 = 8;
+    config.obj_list.resize(2);
+    config.obj_list[1].ids.push_back(99);
+
+    config_state_cursor cursor;
+    size_t steps = 0;
+    while (true)
+    {
+        config_state_budget budget(1);
+        steps++;
+        if (APP_CONFIG_STATE->store_step(config, storage, cursor, budget))
+        {
+            break;
+        }
+        TEST_ASSERT_EQUAL(1, budget.used());
+    }
+    TEST_ASSERT_TRUE(cursor.done());
+    TEST_ASSERT_EQUAL(ESP_OK, cursor.error());
+    TEST_ASSERT_GREATER_THAN(10, steps);
+
+    uint16_t len = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, storage.get_item("ol/len", len));
+    TEST_ASSERT_EQUAL(2, len);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, storage.get_item("ol/2/ids/len", len));
+
+    // Load with a larger budget
+    app_config loaded = {};
+    cursor.reset();
+    steps = 0;
+    while (true)
+    {
+        config_state_budget budget(3);
+        steps++;
+        if (APP_CONFIG_STATE->load_step(loaded, storage, cursor, budget))
+        {
+            break;
+        }
+    }
+    TEST_ASSERT_GREATER_THAN(1, steps);
+    TEST_ASSERT_EQUAL(8, loaded.num_i8);
+    TEST_ASSERT_EQUAL_STRING("foobar", loaded.str.c_str());
+    TEST_ASSERT_EQUAL(3, loaded.num_list.size());
+    TEST_ASSERT_EQUAL(6, loaded.num_list[2]);
+    TEST_ASSERT_EQUAL(2, loaded.obj_list.size());
+    TEST_ASSERT_EQUAL(3, loaded.obj_list[1].ids.size());
+    TEST_ASSERT_EQUAL(99, loaded.obj_list[1].ids[2]);
+
+    // Time budget, always makes progress
+    cursor.reset();
+    config_state_budget budget(std::chrono::microseconds(0));
+    TEST_ASSERT_FALSE(APP_CONFIG_STATE->load_step(loaded, storage, cursor, budget));
+    TEST_ASSERT_EQUAL(1, budget.used());
+}
+
+TEST_CASE("intern list keys", "[nvs][store]")
+{
+    config_state_list_keys keys("/numList", 2);
+    TEST_ASSERT_EQUAL_STRING("numList/len", keys.len());
+    TEST_ASSERT_EQUAL_STRING("numList/0", keys.item(0));
+    TEST_ASSERT_EQUAL_STRING("numList/1", keys.item(1));
+    TEST_ASSERT_NULL(keys.item(2));
+
+    // Keys which would be cut are not interned
+    config_state_list_keys long_keys("/longListKey", 20);
+    TEST_ASSERT_NULL(long_keys.len());
+    TEST_ASSERT_NULL(long_keys.item(0));
+    TEST_ASSERT_EQUAL(0, long_keys.size());
+
+    // Full key without allocation
+    config_state_nvs_full_key full_key("ol/0", "/ids");
+    TEST_ASSERT_EQUAL_STRING("ol/0/ids", full_key.c_str());
+    config_state_nvs_full_key root_key(nullptr, "/numI8");
+    TEST_ASSERT_EQUAL_STRING("numI8", root_key.c_str());
+}
+
+TEST_CASE("load by listing namespace once", "[nvs][load]")
+{
+    // Setup
+    test_nvs_cleanup();
+
+    esp_err_t err = ESP_OK;
+    std::unique_ptr<nvs::NVSHandle> handle = nvs::open_nvs_handle(NVS_TEST_NAMESPACE, NVS_READWRITE, &err);
+    TEST_ASSERT_EQUAL(ESP_OK, err);
+    TEST_ASSERT_NOT_NULL(handle.get());
+
+    app_config expected = {};
+    expected.num_u16 = 16;
+    expected.str = "foobar";
+    expected.num_list = {4, -8};
+    TEST_ASSERT_EQUAL(ESP_OK, APP_CONFIG_STATE->store(expected, handle));
+    TEST_ASSERT_EQUAL(ESP_OK, handle->erase_item("numI8"));
+    TEST_ASSERT_EQUAL(ESP_OK, handle->erase_item("numList/1"));
+    TEST_ASSERT_EQUAL(ESP_OK, handle->set_item("removed", 1)); // Stale keys are ignored
+    TEST_ASSERT_EQUAL(ESP_OK, handle->commit());
+
+    // Test
+    app_config loaded = {};
+    loaded.num_i8 = 5;
+    size_t missing = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, APP_CONFIG_STATE->load_bulk(loaded, *handle, NVS_TEST_NAMESPACE, NVS_DEFAULT_PART_NAME, &missing));
+
+    // Verify
+    TEST_ASSERT_EQUAL(2, missing);
+    TEST_ASSERT_EQUAL(5, loaded.num_i8); // Missing value is left as is, same as load
+    TEST_ASSERT_EQUAL(16, loaded.num_u16);
+    TEST_ASSERT_EQUAL_STRING("foobar", loaded.str.c_str());
+    TEST_ASSERT_EQUAL(2, loaded.num_list.size());
+    TEST_ASSERT_EQUAL(4, loaded.num_list[0]);
+
+    // Empty namespace
+    test_nvs_cleanup();
+    loaded = {};
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, APP_CONFIG_STATE->load_bulk(loaded, *handle, NVS_TEST_NAMESPACE, NVS_DEFAULT_PART_NAME, &missing));
+    TEST_ASSERT_GREATER_THAN(10, missing);
+}
+
 // TODO test flags